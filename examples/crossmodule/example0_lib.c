@@ -0,0 +1,13 @@
+#include <stdlib.h>
+
+int get(int *p) {
+    return *p;
+}
+
+int wrap(int *q) {
+    return get(q);
+}
+
+int *find(int key) {
+    return NULL;
+}
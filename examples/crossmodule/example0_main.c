@@ -0,0 +1,10 @@
+int get(int *p);
+int wrap(int *q);
+int *find(int key);
+
+int main() {
+    int *x = 0;
+    int a = wrap(x);     // wrap passes x on to get, which dereferences it
+    int *y = find(a);
+    return *y;           // find returns NULL
+}
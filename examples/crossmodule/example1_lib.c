@@ -0,0 +1,8 @@
+#include <stdlib.h>
+
+int *lookup(int key, int *p) {
+    if (key > 0) {
+        return p;
+    }
+    return NULL;
+}
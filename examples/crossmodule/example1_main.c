@@ -0,0 +1,7 @@
+int *lookup(int key, int *p);
+
+int main() {
+    int x = 1;
+    int *y = lookup(x, &x);
+    return *y;           // lookup returns NULL if key <= 0
+}
@@ -0,0 +1,11 @@
+/*
+Dereference a heap pointer after it has been freed
+*/
+
+#include <stdlib.h>
+
+int main() {
+    int *pointer = (int*) malloc(sizeof(int));
+    free(pointer);
+    int value = *pointer;
+}
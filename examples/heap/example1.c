@@ -0,0 +1,14 @@
+/*
+A freed pointer is still not NULL: the branch that sets it to NULL and dereferences it is taken
+*/
+
+#include <stdlib.h>
+
+int main() {
+    int *pointer = (int*) malloc(sizeof(int));
+    free(pointer);
+    if (pointer != NULL) {
+        pointer = NULL;
+        int value = *pointer;
+    }
+}
@@ -0,0 +1,15 @@
+/*
+Free a heap pointer on both sides of an if-else, then free it again after they merge
+*/
+
+#include <stdlib.h>
+
+int main(int argc, char **argv) {
+    int *pointer = (int*) malloc(sizeof(int));
+    if (argc > 1) {
+        free(pointer);
+    } else {
+        free(pointer);
+    }
+    free(pointer);
+}
@@ -0,0 +1,23 @@
+; main passes NULL down a chain of calls to c, which dereferences it. With
+; -context-depth, every callee is analysed again per context, with the
+; steps of the caller's budget.
+
+define internal i32 @c(i32* %p) {
+  %v = load i32, i32* %p, align 4
+  ret i32 %v
+}
+
+define internal i32 @b(i32* %p) {
+  %v = call i32 @c(i32* %p)
+  ret i32 %v
+}
+
+define internal i32 @a(i32* %p) {
+  %v = call i32 @b(i32* %p)
+  ret i32 %v
+}
+
+define dso_local i32 @main() {
+  %v = call i32 @a(i32* null)
+  ret i32 %v
+}
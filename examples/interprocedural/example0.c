@@ -0,0 +1,9 @@
+/*
+Dereference a global pointer that is initialized to null and never assigned
+*/
+
+int *pointer = 0;
+
+int main() {
+    int value = *pointer;
+}
@@ -0,0 +1,11 @@
+/*
+Dereference a parameter; the only caller passes null
+*/
+
+int deref(int *pointer) {
+    return *pointer;
+}
+
+int main() {
+    deref(0);
+}
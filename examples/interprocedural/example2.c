@@ -0,0 +1,26 @@
+/*
+Helpers that behave differently depending on whether the caller passes
+null: first(0) dereferences it, value_or_zero(0) doesn't, same(0) returns it
+*/
+
+int first(int *list) {
+    return *list;
+}
+
+int value_or_zero(int *pointer) {
+    if (pointer == 0) return 0;
+    return *pointer;
+}
+
+int *same(int *pointer) {
+    return pointer;
+}
+
+int main() {
+    int value = 1;
+    first(&value);
+    value_or_zero(0);
+    first(0);
+    int *result = same(0);
+    return *result;
+}
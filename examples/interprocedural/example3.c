@@ -0,0 +1,11 @@
+/*
+Dereference a null pointer in a function nothing calls, which later passes delete
+*/
+
+int unused() {
+    int *pointer = 0;
+    return *pointer;
+}
+
+int main() {
+}
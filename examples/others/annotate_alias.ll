@@ -0,0 +1,20 @@
+; Two parameters that may point to the same place: if p == q, %v is NULL,
+; although the graph takes the store to p for the last one to its place.
+
+@g = dso_local global i32 0, align 4
+
+define dso_local i32* @f(i32** %p, i32** %q) {
+  store i32* @g, i32** %p, align 8
+  store i32* null, i32** %q, align 8
+  %v = load i32*, i32** %p, align 8
+  ret i32* %v
+}
+
+define dso_local i32* @local() {
+  %slot = alloca i32*, align 8
+  %other = alloca i32*, align 8
+  store i32* @g, i32** %slot, align 8
+  store i32* null, i32** %other, align 8
+  %v = load i32*, i32** %slot, align 8
+  ret i32* %v
+}
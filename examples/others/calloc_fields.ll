@@ -0,0 +1,28 @@
+; A calloc'd struct whose pointer field nothing stores to: it is still NULL
+; when get reads it.
+
+%struct.S = type { i32* }
+
+define internal i32 @get(%struct.S* %0) {
+  %2 = alloca %struct.S*, align 8
+  store %struct.S* %0, %struct.S** %2, align 8
+  %3 = load %struct.S*, %struct.S** %2, align 8
+  %4 = getelementptr inbounds %struct.S, %struct.S* %3, i32 0, i32 0
+  %5 = load i32*, i32** %4, align 8
+  %6 = load i32, i32* %5, align 4
+  ret i32 %6
+}
+
+define dso_local i32 @main() {
+  %1 = alloca i32, align 4
+  %2 = alloca %struct.S*, align 8
+  store i32 0, i32* %1, align 4
+  %3 = call noalias i8* @calloc(i64 1, i64 8)
+  %4 = bitcast i8* %3 to %struct.S*
+  store %struct.S* %4, %struct.S** %2, align 8
+  %5 = load %struct.S*, %struct.S** %2, align 8
+  %6 = call i32 @get(%struct.S* %5)
+  ret i32 %6
+}
+
+declare noalias i8* @calloc(i64, i64)
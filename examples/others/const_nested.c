@@ -0,0 +1,18 @@
+/*
+A constant struct nested in another one: t.in.b is the second field of the
+first field, not the second field of t, so only *t.c should be reported
+*/
+
+int x = 1;
+int y = 2;
+
+struct inner { int *a; int *b; };
+struct outer { struct inner in; int *c; };
+
+const struct outer t = { { &x, &y }, 0 };
+
+int main() {
+    int b = *t.in.b;
+    int c = *t.c;
+    return b + c;
+}
@@ -0,0 +1,16 @@
+/*
+A constant table of pointers with a null entry: whatever the rest of the
+program does, ops.second stays null, so dereferencing it should crash
+*/
+
+int value = 1;
+
+struct table { int *first; int *second; };
+
+const struct table ops = { &value, 0 };
+
+int main() {
+    int a = *ops.first;
+    int b = *ops.second;
+    return a + b;
+}
@@ -0,0 +1,22 @@
+; @hook is NULL unless some other module defines it, so checking it isn't
+; dead code: on the NULL branch, the dereference is a NULL_DEREF.
+
+@hook = extern_weak global i32
+
+define dso_local i32 @main() {
+  %1 = alloca i32*, align 8
+  store i32* @hook, i32** %1, align 8
+  %2 = load i32*, i32** %1, align 8
+  %3 = icmp ne i32* %2, null
+  br i1 %3, label %4, label %7
+
+4:
+  %5 = load i32*, i32** %1, align 8
+  %6 = load i32, i32* %5, align 4
+  ret i32 %6
+
+7:
+  %8 = load i32*, i32** %1, align 8
+  %9 = load i32, i32* %8, align 4
+  ret i32 %9
+}
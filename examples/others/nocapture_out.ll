@@ -0,0 +1,35 @@
+; An out-parameter: init() doesn't capture p, but it may still write *p, so
+; the dereference on line 6 isn't known to be null. The one on line 9 is.
+; Clang only marks parameters nocapture when it optimizes, and -query-lines
+; needs debug info, so this example is written in IR.
+
+declare void @init(i32** nocapture)
+
+define dso_local i32 @main() !dbg !5 {
+  %1 = alloca i32*, align 8
+  %2 = alloca i32*, align 8
+  store i32* null, i32** %1, align 8, !dbg !8
+  call void @init(i32** nocapture %1), !dbg !8
+  %3 = load i32*, i32** %1, align 8, !dbg !9
+  %4 = load i32, i32* %3, align 4, !dbg !9
+  store i32* null, i32** %2, align 8, !dbg !10
+  %5 = load i32*, i32** %2, align 8, !dbg !11
+  %6 = load i32, i32* %5, align 4, !dbg !11
+  %7 = add i32 %4, %6, !dbg !12
+  ret i32 %7, !dbg !12
+}
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!2, !3}
+
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "clang", isOptimized: false, runtimeVersion: 0, emissionKind: FullDebug)
+!1 = !DIFile(filename: "nocapture_out.c", directory: ".")
+!2 = !{i32 7, !"Dwarf Version", i32 4}
+!3 = !{i32 2, !"Debug Info Version", i32 3}
+!4 = !DISubroutineType(types: !{})
+!5 = distinct !DISubprogram(name: "main", scope: !1, file: !1, line: 3, type: !4, scopeLine: 3, spFlags: DISPFlagDefinition, unit: !0)
+!8 = !DILocation(line: 5, column: 5, scope: !5)
+!9 = !DILocation(line: 6, column: 12, scope: !5)
+!10 = !DILocation(line: 8, column: 5, scope: !5)
+!11 = !DILocation(line: 9, column: 12, scope: !5)
+!12 = !DILocation(line: 10, column: 5, scope: !5)
@@ -0,0 +1,10 @@
+/*
+What the nullness-info analysis knows: p is non-NULL where it was tested,
+and so is what is read from its slot there
+*/
+
+int get(int *p) {
+    if (p != 0)
+        return *p;
+    return 0;
+}
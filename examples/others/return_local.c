@@ -0,0 +1,13 @@
+/*
+A function that returns the address of its own local variable: the address is not NULL, but nothing can be read through it once the function has returned
+*/
+
+int **local() {
+    int value = 5;
+    int *pointer = &value;
+    return &pointer;
+}
+
+int main() {
+    int **dangling = local();
+}
@@ -0,0 +1,9 @@
+/*
+A pointer read before anything was stored to it: the flow engine reports
+the dereference as undefined, with or without -tiered
+*/
+
+int main() {
+    int *p;
+    return *p;
+}
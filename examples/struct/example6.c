@@ -0,0 +1,12 @@
+/*
+Copy a struct whose pointer field is null, then dereference that field of the copy
+*/
+
+struct A { int v; int* ptr; };
+
+int main() {
+    struct A a;
+    a.ptr = 0;
+    struct A b = a;
+    int i = *(b.ptr);
+}
@@ -0,0 +1,27 @@
+/*
+Zero a struct with memset, so that its pointer field is null, and dereference that field. A call that gets the
+struct's address may set the field again: in initialised(), dereferencing it is fine
+*/
+
+#include <string.h>
+
+struct A { int v; int* ptr; };
+
+int value = 5;
+
+void init(struct A *a) {
+    a->ptr = &value;
+}
+
+int initialised() {
+    struct A s;
+    memset(&s, 0, sizeof s);
+    init(&s);
+    return *s.ptr;
+}
+
+int main() {
+    struct A s;
+    memset(&s, 0, sizeof s);
+    int i = *s.ptr;
+}
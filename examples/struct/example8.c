@@ -0,0 +1,22 @@
+/*
+Move a struct whose pointer field is null over another one, and copy a struct of another type over a third one. The
+moved field is still null, so dereferencing it should crash; the third one's field comes from the other type
+*/
+
+#include <string.h>
+
+struct A { int v; int* ptr; };
+struct B { int v; int* ptr; int w; };
+
+int main() {
+    int value = 5;
+    struct A a, b, c;
+    struct B d;
+    a.ptr = 0;
+    c.ptr = 0;
+    d.ptr = &value;
+    memmove(&b, &a, sizeof a);
+    memcpy(&c, &d, sizeof c);
+    int i = *c.ptr;
+    int j = *b.ptr;
+}
@@ -0,0 +1,22 @@
+; Load a struct whose pointer field is null as a whole value, store it into
+; another struct, then dereference the field of the value and of the copy.
+; Clang doesn't emit first-class aggregate loads and stores at -O0, so this
+; example is written in IR.
+
+%struct.A = type { i32, i32* }
+
+define dso_local i32 @main() {
+  %1 = alloca %struct.A, align 8
+  %2 = alloca %struct.A, align 8
+  %3 = getelementptr inbounds %struct.A, %struct.A* %1, i32 0, i32 1
+  store i32* null, i32** %3, align 8
+  %4 = load %struct.A, %struct.A* %1, align 8
+  store %struct.A %4, %struct.A* %2, align 8
+  %5 = extractvalue %struct.A %4, 1
+  %6 = load i32, i32* %5, align 4
+  %7 = getelementptr inbounds %struct.A, %struct.A* %2, i32 0, i32 1
+  %8 = load i32*, i32** %7, align 8
+  %9 = load i32, i32* %8, align 4
+  %10 = add i32 %6, %9
+  ret i32 %10
+}
@@ -0,0 +1,50 @@
+#ifndef ANALYSIS_BUDGET_H
+#define ANALYSIS_BUDGET_H 1
+
+#include <chrono>
+#include <cstddef>
+
+#include "NullDereference.h" // AnalysisBudget itself, part of the library's API
+
+/// Keeps track of how much of an AnalysisBudget one function has used.
+/// Engines call `step` for every unit of work, and stop once it returns
+/// false; everything they haven't proven by then stays DONT_KNOW.
+class BudgetTracker {
+    typedef std::chrono::steady_clock Clock;
+
+    const AnalysisBudget &budget;
+    Clock::time_point start;
+    size_t steps = 0;
+    const char *exceeded = nullptr;
+
+public:
+    BudgetTracker(const AnalysisBudget &budget) : budget(budget), start(Clock::now()) {}
+
+    /// Account for one more step, with a graph of `nodes` nodes. Returns
+    /// false if the budget is used up.
+    bool step(size_t nodes = 0) {
+        if (exceeded != nullptr) return false;
+        ++steps;
+
+        if (budget.maxSteps != 0 && steps > budget.maxSteps) {
+            exceeded = "step limit";
+        } else if (budget.maxNodes != 0 && nodes > budget.maxNodes) {
+            exceeded = "node limit";
+        } else if (budget.maxMillis != 0 && steps % 256 == 0 && elapsedMillis() > budget.maxMillis) {
+            // reading the clock isn't free, so only do it now and then
+            exceeded = "time limit";
+        }
+        return exceeded == nullptr;
+    }
+
+    /// The limit that was hit, or NULL if there is budget left.
+    const char *exceededLimit() const { return exceeded; }
+
+    size_t stepsTaken() const { return steps; }
+
+    unsigned long elapsedMillis() const {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+    }
+};
+
+#endif // ANALYSIS_BUDGET_H
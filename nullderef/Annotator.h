@@ -0,0 +1,327 @@
+#ifndef ANNOTATOR_H
+#define ANNOTATOR_H 1
+
+#include <vector>
+#include <utility>
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/Analysis/AliasAnalysis.h>
+#include <llvm/Analysis/CaptureTracking.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/Attributes.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Module.h>
+
+#include "PointsTo.h"
+#include "Visitor.h"
+
+using std::pair;
+using std::vector;
+using namespace llvm;
+
+/// Writes the nullness facts found by the Visitor back into the IR, so
+/// that later optimizations can use them:
+///
+///  - `!nonnull` metadata on pointer loads whose result is NON_NIL,
+///  - `nonnull` and `dereferenceable(N)` on parameters that are
+///    dereferenced unconditionally,
+///  - `nonnull` on returned values and call site arguments that are
+///    NON_NIL, plus `dereferenceable(N)` when they are a global, or an
+///    alloca passed to a call (a returned alloca is dead in the caller).
+///
+/// The Visitor walks the instructions once in layout order and ignores
+/// both branches and calls, so its facts only hold for straight-line code
+/// up to the first call that may write memory or never return. Facts are
+/// therefore recorded while each instruction is visited (see `observe`),
+/// only within that prefix, and attached to the IR afterwards by `apply`.
+/// They are the graph engine's facts: the other engines don't run the
+/// Visitor, so there is nothing to annotate with them.
+///
+/// The graph also takes two different pointers for two different places.
+/// A pointer read from memory is only annotated if the graph knows what
+/// the load reads (see `readsExactly`): no store visited before it may
+/// write the location but through the same address, which must be shown
+/// with a local slot nothing else can reach, distinct objects, or the
+/// module's points-to analysis. Otherwise, when two parameters point to
+/// the same place, the facts would be wrong, and LLVM would optimize on
+/// them.
+class Annotator {
+    Function &function;
+    Visitor &visitor;
+    const PointsTo *pointsTo;
+    const DataLayout &layout;
+
+    /// Are we still in the part of the function where the graph is exact?
+    bool exact;
+
+    /// The stores visited so far: to each local slot (see isLocalSlot),
+    /// to merges of pointers (phi, select) that may be one, and the rest.
+    DenseMap<Value*, vector<StoreInst*>> slotStores;
+    vector<StoreInst*> mergedStores;
+    vector<StoreInst*> sharedStores;
+    DenseMap<Value*, bool> localSlots; // alloca => see isLocalSlot
+
+    /// The loads the graph knows the result of.
+    SmallPtrSet<LoadInst*, 16> exactLoads;
+
+    /** How far back `readsExactly` looks for the store a load reads. */
+    static const unsigned MAX_STORES_BACK = 64;
+
+    vector<LoadInst*> nonNullLoads;
+    vector<pair<CallBase*, unsigned>> nonNullArgs;
+    DenseMap<Argument*, uint64_t> derefParams; // parameter => dereferenced bytes
+    Value *nonNullReturn = NULL;
+
+public:
+    Annotator(Function &function, Visitor &visitor, const PointsTo *pointsTo = NULL)
+        : function(function), visitor(visitor), pointsTo(pointsTo),
+          layout(function.getParent()->getDataLayout()),
+          exact(isStraightLine(function)) {}
+
+    /// Record the facts that hold right after `I` has been visited.
+    void observe(Instruction &I) {
+        if (!exact) return;
+
+        if (LoadInst *load = dyn_cast<LoadInst>(&I)) {
+            noteDeref(load->getPointerOperand(), load->getType());
+            if (load->getType()->isPointerTy() && readsExactly(load)) {
+                exactLoads.insert(load);
+                if (visitor.statusOf(load) == graph::NON_NIL) nonNullLoads.push_back(load);
+            }
+        }
+        else if (StoreInst *store = dyn_cast<StoreInst>(&I)) {
+            noteDeref(store->getPointerOperand(), store->getValueOperand()->getType());
+            Value *object = getUnderlyingObject(store->getPointerOperand());
+            if (isLocalSlot(object)) slotStores[object].push_back(store);
+            else if (!comesFrom(object)) mergedStores.push_back(store);
+            else sharedStores.push_back(store);
+        }
+        else if (isa<AtomicRMWInst>(&I) || isa<AtomicCmpXchgInst>(&I)) {
+            // Writes memory the graph doesn't follow.
+            exact = false;
+        }
+        else if (ReturnInst *ret = dyn_cast<ReturnInst>(&I)) {
+            Value *value = ret->getReturnValue();
+            if (value != NULL && value->getType()->isPointerTy() && isExact(value)
+                    && visitor.statusOf(value) == graph::NON_NIL) {
+                nonNullReturn = value;
+            }
+        }
+        else if (CallBase *call = dyn_cast<CallBase>(&I)) {
+            if (isa<DbgInfoIntrinsic>(call) || call->isLifetimeStartOrEnd()) return;
+
+            for (unsigned i = 0; i < call->arg_size(); ++i) {
+                Value *arg = call->getArgOperand(i);
+                if (arg->getType()->isPointerTy() && isExact(arg) && visitor.statusOf(arg) == graph::NON_NIL) {
+                    nonNullArgs.push_back(std::make_pair(call, i));
+                }
+            }
+
+            // The callee may change memory behind the graph's back, or not
+            // return at all (exit, longjmp). Stop collecting facts here.
+            exact = false;
+        }
+    }
+
+    /// Attach the recorded facts to the IR. Returns the number of attributes
+    /// and metadata nodes that were added.
+    unsigned apply() {
+        unsigned added = 0;
+        LLVMContext &ctx = function.getContext();
+
+        for (LoadInst *load : nonNullLoads) {
+            if (load->getMetadata(LLVMContext::MD_nonnull) == NULL) {
+                load->setMetadata(LLVMContext::MD_nonnull, MDNode::get(ctx, None));
+                ++added;
+            }
+        }
+
+        for (auto p : derefParams) {
+            unsigned argNo = p.first->getArgNo();
+            if (!function.hasParamAttribute(argNo, Attribute::NonNull)) {
+                function.addParamAttr(argNo, Attribute::NonNull);
+                ++added;
+            }
+            if (function.getParamDereferenceableBytes(argNo) < p.second) {
+                function.addDereferenceableParamAttr(argNo, p.second);
+                ++added;
+            }
+        }
+
+        if (nonNullReturn != NULL) {
+            if (!function.hasRetAttribute(Attribute::NonNull)) {
+                function.addRetAttr(Attribute::NonNull);
+                ++added;
+            }
+            uint64_t bytes = dereferenceableBytes(nonNullReturn, false);
+            if (function.getAttributes().getRetDereferenceableBytes() < bytes) {
+                function.addRetAttr(Attribute::getWithDereferenceableBytes(ctx, bytes));
+                ++added;
+            }
+        }
+
+        for (auto p : nonNullArgs) {
+            CallBase *call = p.first;
+            if (!call->paramHasAttr(p.second, Attribute::NonNull)) {
+                call->addParamAttr(p.second, Attribute::NonNull);
+                ++added;
+            }
+            uint64_t bytes = dereferenceableBytes(call->getArgOperand(p.second), true);
+            if (call->getParamDereferenceableBytes(p.second) < bytes) {
+                call->addDereferenceableParamAttr(p.second, bytes);
+                ++added;
+            }
+        }
+
+        return added;
+    }
+
+private:
+    /// `ptr` is dereferenced for `accessType`. If it is one of our
+    /// parameters, the parameter must be non-null and dereferenceable.
+    void noteDeref(Value *ptr, Type *accessType) {
+        Value *base = ptr->stripPointerCasts();
+        Node *node = isExact(base) ? visitor.nodeOf(base) : NULL;
+
+        for (Argument &arg : function.args()) {
+            if (!arg.getType()->isPointerTy()) continue;
+            if (&arg != base && (node == NULL || visitor.nodeOf(&arg) != node)) continue;
+
+            uint64_t bytes = layout.getTypeStoreSize(accessType);
+            if (derefParams[&arg] < bytes) derefParams[&arg] = bytes;
+        }
+    }
+
+    /// Does the graph know which pointer `value` is? Only if it isn't read
+    /// from memory, or read by a load the graph knows the result of.
+    bool isExact(Value *value) {
+        if (!value->getType()->isPointerTy()) return false;
+        Value *base = getUnderlyingObject(value);
+        if (LoadInst *load = dyn_cast<LoadInst>(base)) return exactLoads.count(load) != 0;
+        return isa<Argument>(base) || isa<AllocaInst>(base) || isa<Constant>(base);
+    }
+
+    /// Does the graph know what `load` reads? The last store visited
+    /// before it that may write the loaded location must write exactly
+    /// it, with a pointer the graph knows, or there must be none. A local
+    /// slot is only written through pointers computed from it, but
+    /// anything else may be written by any store that isn't to a slot.
+    bool readsExactly(LoadInst *load) {
+        Value *address = load->getPointerOperand();
+        if (!isExact(address)) return false;
+
+        uint64_t size = layout.getTypeStoreSize(load->getType());
+        for (StoreInst *store : mergedStores) {
+            if (overlapOf(store, address, size) != DISJOINT) return false;
+        }
+        Value *object = getUnderlyingObject(address);
+        return lastStoreIsExact(isLocalSlot(object) ? slotStores[object] : sharedStores, address, size);
+    }
+
+    bool lastStoreIsExact(const vector<StoreInst*> &stores, Value *address, uint64_t size) {
+        unsigned looked = 0;
+        for (auto it = stores.rbegin(); it != stores.rend(); ++it) {
+            if (++looked > MAX_STORES_BACK) return false;
+            Overlap overlap = overlapOf(*it, address, size);
+            if (overlap == DISJOINT) continue;
+            return overlap == SAME && isExact((*it)->getValueOperand());
+        }
+        return true;
+    }
+
+    enum Overlap { DISJOINT, SAME, MAYBE };
+
+    Overlap overlapOf(StoreInst *store, Value *address, uint64_t size) {
+        uint64_t written = layout.getTypeStoreSize(store->getValueOperand()->getType());
+        return overlapOf(store->getPointerOperand(), written, address, size);
+    }
+
+    /// How the `aSize` bytes at `a` and the `bSize` bytes at `b` overlap.
+    Overlap overlapOf(Value *a, uint64_t aSize, Value *b, uint64_t bSize) {
+        APInt aOffset(layout.getIndexTypeSizeInBits(a->getType()), 0);
+        APInt bOffset(layout.getIndexTypeSizeInBits(b->getType()), 0);
+        Value *aBase = a->stripAndAccumulateConstantOffsets(layout, aOffset, true);
+        Value *bBase = b->stripAndAccumulateConstantOffsets(layout, bOffset, true);
+        if (aBase == bBase) {
+            int64_t aStart = aOffset.getSExtValue(), bStart = bOffset.getSExtValue();
+            if (aStart == bStart && aSize == bSize) return SAME;
+            if (aStart + (int64_t) aSize <= bStart || bStart + (int64_t) bSize <= aStart) return DISJOINT;
+            return MAYBE;
+        }
+
+        Value *aObject = getUnderlyingObject(a), *bObject = getUnderlyingObject(b);
+        if (aObject != bObject) {
+            if (isIdentifiedObject(aObject) && isIdentifiedObject(bObject)) return DISJOINT;
+            if ((isLocalSlot(aObject) && comesFrom(bObject)) || (isLocalSlot(bObject) && comesFrom(aObject))) {
+                return DISJOINT;
+            }
+        }
+        if (pointsTo != NULL && !pointsTo->mayAlias(a, b)) return DISJOINT;
+        return MAYBE;
+    }
+
+    /// An alloca whose address is only used in this function, through
+    /// pointers computed from it.
+    bool isLocalSlot(Value *object) {
+        if (!isa<AllocaInst>(object)) return false;
+        auto it = localSlots.find(object);
+        if (it == localSlots.end()) {
+            it = localSlots.insert(std::make_pair(object, !PointerMayBeCaptured(object, true, true))).first;
+        }
+        return it->second;
+    }
+
+    /// Is `object` where a pointer comes from, rather than a merge of
+    /// pointers (phi, select) that may be a local slot too?
+    static bool comesFrom(Value *object) {
+        return isa<Argument>(object) || isa<GlobalValue>(object) || isa<AllocaInst>(object)
+            || isa<LoadInst>(object) || isa<CallBase>(object);
+    }
+
+    /// The number of bytes known to be dereferenceable at `value`, if it is
+    /// the address of a global variable, or of an alloca and `inFrame`
+    /// (the value is only used while this function runs), or 0 otherwise.
+    uint64_t dereferenceableBytes(Value *value, bool inFrame) {
+        Value *base = value->stripPointerCasts();
+
+        if (GlobalVariable *global = dyn_cast<GlobalVariable>(base)) {
+            if (global->hasExternalWeakLinkage() || !global->getValueType()->isSized()) return 0;
+            return layout.getTypeAllocSize(global->getValueType());
+        }
+        if (AllocaInst *alloca = dyn_cast<AllocaInst>(base)) {
+            if (!inFrame || !alloca->isStaticAlloca()) return 0;
+            return layout.getTypeAllocSize(alloca->getAllocatedType())
+                * cast<ConstantInt>(alloca->getArraySize())->getZExtValue();
+        }
+        return 0;
+    }
+
+    /// Is the function a single chain of blocks, each falling through to
+    /// the next one, and ending in the last block? Only then does the
+    /// layout order the Visitor uses match the execution order.
+    static bool isStraightLine(Function &function) {
+        for (BasicBlock &BB : function) {
+            Instruction *term = BB.getTerminator();
+            BasicBlock *next = BB.getNextNode();
+
+            if (isa<ReturnInst>(term) || isa<UnreachableInst>(term)) {
+                if (next != NULL) return false;
+                continue;
+            }
+
+            BranchInst *br = dyn_cast<BranchInst>(term);
+            if (br == NULL || br->isConditional() || br->getSuccessor(0) != next
+                    || next->getSinglePredecessor() != &BB) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+#endif // ANNOTATOR_H
@@ -0,0 +1,166 @@
+#ifndef BACKGROUND_ANALYSIS_H
+#define BACKGROUND_ANALYSIS_H 1
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <llvm/IR/Function.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "AnalysisBudget.h"
+#include "ErrorCode.h"
+#include "FlowAnalysis.h"
+#include "LoweredFunction.h"
+
+using std::string;
+using std::vector;
+using namespace llvm;
+
+/// Runs the flow engine on a thread of its own, so that the compiler
+/// doesn't wait for it.
+///
+/// `submit` is all that happens on the compiler's thread: it copies what
+/// the flow engine reads of the function into a FunctionSnapshot, with the
+/// line and, for test output, the text of what a report can be about.
+/// Lowering and solving happen on the worker, from the snapshot only; the
+/// IR pointers in it are compared, never read. The compiler is free to
+/// optimize the function, or delete it, in the meantime.
+///
+/// `join` waits for the worker and writes the output of every function in
+/// the order they were submitted, as `analyzeFunction` would have.
+///
+/// Context sensitivity isn't supported, as it analyses callees from the IR.
+class BackgroundAnalysis {
+    struct Job {
+        string name;
+        std::unique_ptr<FunctionSnapshot> snapshot;
+        string output;
+        bool overBudget = false;
+    };
+
+public:
+    BackgroundAnalysis(const AnalysisBudget &budget, bool testOutput)
+        : budget(budget), testOutput(testOutput) {}
+
+    ~BackgroundAnalysis() {
+        stop();
+    }
+
+    /// Take a snapshot of `function` and queue it for the worker.
+    void submit(Function &function) {
+        Job *job = new Job();
+        job->name = function.getName().str();
+        job->snapshot.reset(new FunctionSnapshot(function, true, testOutput));
+
+        std::unique_lock<std::mutex> lock(mutex);
+        jobs.emplace_back(job);
+        queue.push_back(job);
+        if (!worker.joinable()) worker = std::thread([this] { run(); });
+        wake.notify_one();
+    }
+
+    /// Queue the output of a function that isn't analysed (see Triage).
+    void skip() {
+        Job *job = new Job();
+        job->output = "\n\n";
+
+        std::unique_lock<std::mutex> lock(mutex);
+        jobs.emplace_back(job);
+    }
+
+    /// Wait for every function submitted so far, and write their output to
+    /// `os`. Returns the number of functions that ran out of budget.
+    unsigned join(raw_ostream &os) {
+        stop();
+
+        unsigned overBudget = 0;
+        for (auto &job : jobs) {
+            os << job->output;
+            if (job->overBudget) ++overBudget;
+        }
+        jobs.clear();
+        return overBudget;
+    }
+
+private:
+    AnalysisBudget budget;
+    bool testOutput;
+
+    /// Every job in submission order, and those the worker hasn't started
+    /// yet (guarded by `mutex`).
+    vector<std::unique_ptr<Job>> jobs;
+    std::deque<Job*> queue;
+    bool stopping = false;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::thread worker;
+
+    void stop() {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            stopping = true;
+            wake.notify_one();
+        }
+        if (worker.joinable()) worker.join();
+        stopping = false;
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            wake.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (queue.empty()) return; // stopping, and nothing left
+
+            Job *job = queue.front();
+            queue.pop_front();
+            lock.unlock();
+            solve(*job);
+            lock.lock();
+        }
+    }
+
+    /// Lower and solve the snapshot of `job`, and write its output in the
+    /// format of analyzeFunction.
+    void solve(Job &job) {
+        const FunctionSnapshot &snapshot = *job.snapshot;
+        FlowAnalysis flow(snapshot);
+        BudgetTracker tracker(budget);
+        flow.solve(&tracker);
+
+        raw_string_ostream os(job.output);
+        os << "\n";
+        if (tracker.exceededLimit() == NULL) {
+            auto text = snapshot.texts.begin();
+            for (unsigned i = 0; i < snapshot.insts.size(); ++i) {
+                const FunctionSnapshot::Inst &inst = snapshot.insts[i];
+                while (text != snapshot.texts.end() && text->first < i) ++text;
+
+                ErrorCode code = flow.result(inst.inst);
+                if (code == NULL_DEREF && inst.line != 0) {
+                    os << "Null dereference happening at line " << inst.line << "\n";
+                }
+                if (testOutput && code != OK && text != snapshot.texts.end() && text->first == i) {
+                    os << "TEST[" << i + 1 << "]:" << errorCodeName(code) << text->second << "\n";
+                }
+            }
+        } else {
+            job.overBudget = true;
+            os << "BUDGET[" << job.name << "]: " << tracker.exceededLimit()
+               << " reached after " << tracker.stepsTaken() << " steps and "
+               << tracker.elapsedMillis() << " ms, the rest is DONT_KNOW\n";
+        }
+        os << "\n";
+        os.flush();
+
+        // Free the snapshot on this thread too.
+        job.snapshot.reset();
+    }
+};
+
+#endif // BACKGROUND_ANALYSIS_H
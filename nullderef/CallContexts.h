@@ -0,0 +1,93 @@
+#ifndef CALL_CONTEXTS_H
+#define CALL_CONTEXTS_H 1
+
+#include <cstdint>
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/IR/Function.h>
+
+#include "PointerGraph.h"
+
+using namespace llvm;
+
+/// What a call to a function with a body does, in one calling context.
+struct CallEffect {
+    /** Join of the statuses the callee returns, as graph::LeafNodeType bits. */
+    unsigned returned = graph::DONT_KNOW;
+
+    /** Number of NULL dereferences in the callee, in this context. */
+    unsigned nullDerefs = 0;
+};
+
+/// The memo table of k-limited context-sensitive analysis.
+///
+/// A callee is analysed once per calling context: the abstract nullness
+/// (NIL, NON_NIL or DONT_KNOW) of each of its pointer parameters, and how
+/// many calls deep below the analysed function it is. Every call site with
+/// the same context reuses the same CallEffect, so the cost grows with the
+/// number of distinct contexts, not with the number of call sites. Calls
+/// more than `maxDepth` levels deep are not analysed; their result is
+/// DONT_KNOW, as without context sensitivity.
+///
+/// The table lives as long as the module; the engines fill it (see
+/// FlowAnalysis::callEffect).
+class CallContexts {
+public:
+    /// Pointer parameters beyond this many are always DONT_KNOW.
+    static const unsigned MAX_PARAMS = 28;
+
+    typedef std::pair<Function*, uint64_t> Key;
+
+    CallContexts(unsigned maxDepth) : depthLimit(maxDepth < 255 ? maxDepth : 255) {}
+
+    unsigned maxDepth() const { return depthLimit; }
+
+    /// The key of `callee` analysed `depth` calls deep, with the statuses
+    /// `params` for its pointer parameters in order. Two bits per
+    /// parameter, the depth in the top byte.
+    static Key key(Function *callee, ArrayRef<unsigned> params, unsigned depth) {
+        uint64_t packed = (uint64_t) depth << 56;
+        for (unsigned i = 0; i < params.size() && i < MAX_PARAMS; ++i) {
+            packed |= (uint64_t) (params[i] & graph::DONT_KNOW) << (2 * i);
+        }
+        return Key(callee, packed);
+    }
+
+    /// The status of parameter `i` in a key made by `key`.
+    static graph::LeafNodeType paramStatus(const Key &key, unsigned i) {
+        if (i >= MAX_PARAMS) return graph::DONT_KNOW;
+        return (graph::LeafNodeType) ((key.second >> (2 * i)) & graph::DONT_KNOW);
+    }
+
+    static unsigned depthOf(const Key &key) { return key.second >> 56; }
+
+    /// The effect memoized for `key`, or NULL if it hasn't been computed.
+    const CallEffect *find(const Key &key) {
+        ++lookups;
+        auto it = table.find(key);
+        return it == table.end() ? NULL : &it->second;
+    }
+
+    const CallEffect &insert(const Key &key, const CallEffect &effect) {
+        return table[key] = effect;
+    }
+
+    /// Number of distinct contexts analysed so far.
+    unsigned contexts() const { return table.size(); }
+
+    /// Number of times an effect was looked up in the table.
+    unsigned queries() const { return lookups; }
+
+    void clear() {
+        table.clear();
+        lookups = 0;
+    }
+
+private:
+    unsigned depthLimit;
+    DenseMap<Key, CallEffect> table;
+    unsigned lookups = 0;
+};
+
+#endif // CALL_CONTEXTS_H
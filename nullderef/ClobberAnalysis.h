@@ -0,0 +1,275 @@
+#ifndef CLOBBER_ANALYSIS_H
+#define CLOBBER_ANALYSIS_H 1
+
+#include <memory>
+#include <string>
+#include <sstream>
+#include <vector>
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/Triple.h>
+#include <llvm/Analysis/AliasAnalysis.h>
+#include <llvm/Analysis/AssumptionCache.h>
+#include <llvm/Analysis/BasicAliasAnalysis.h>
+#include <llvm/Analysis/MemoryLocation.h>
+#include <llvm/Analysis/MemorySSA.h>
+#include <llvm/Analysis/TargetLibraryInfo.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "AnalysisBudget.h"
+#include "HeapModel.h"
+#include "PointerWalk.h"
+
+using std::string;
+using std::vector;
+using namespace llvm;
+
+/// An engine that resolves every load through MemorySSA instead of
+/// replaying the stores.
+///
+/// The Visitor learns what a load reads by simulating every store before
+/// it in layout order. Here, MemorySSA (with basic alias analysis) links
+/// each load to the store that clobbers it, or to a MemoryPhi where the
+/// paths that store to it meet. The status of a pointer is computed on
+/// demand by following those def-use links only:
+///
+///  - a load reads the status of the value stored by its clobbering
+///    store, if that store must write the same location;
+///  - at a MemoryPhi, the statuses on the incoming paths are joined, so
+///    stores on both sides of an `if` are both taken into account;
+///  - GEPs with constant indices and casts keep the status of their
+///    operand, phis and selects join theirs;
+///  - anything else (calls, partial overlaps, memset/memcpy) is DONT_KNOW.
+///
+/// Stores that no queried load depends on are never looked at. Statuses
+/// are memoized per value and per (MemoryPhi, location).
+///
+/// Inside a pass, the alias analysis and MemorySSA come from the pass
+/// manager (AAResultsWrapperPass, MemorySSAWrapperPass), which may have
+/// them already. Tools without one let the analysis build its own, with
+/// basic alias analysis only.
+///
+/// A dereference is UNDEFINED_DEREF if a `free` of the same object
+/// dominates it. Unlike the flow engine, branches on `p == NULL` don't
+/// refine anything.
+class ClobberAnalysis : public PointerWalk<ClobberAnalysis> {
+    friend class PointerWalk<ClobberAnalysis>;
+
+public:
+    /// With the alias analysis and MemorySSA of the pass manager: both
+    /// must be for `function`, and outlive the analysis.
+    ClobberAnalysis(Function &function, AAResults &aliases, MemorySSA &memorySSA,
+                    const PointsTo *pointsTo = NULL, BudgetTracker *tracker = NULL)
+            : PointerWalk(function, pointsTo), tracker(tracker), aliases(&aliases),
+              memorySSA(&memorySSA), dominators(&memorySSA.getDomTree()), walker(memorySSA.getWalker()) {}
+
+    /// Building the alias analysis and MemorySSA for `function` itself.
+    ClobberAnalysis(Function &function, const PointsTo *pointsTo = NULL, BudgetTracker *tracker = NULL)
+            : PointerWalk(function, pointsTo), tracker(tracker), own(new OwnMemorySSA(function)),
+              aliases(&own->aliases), memorySSA(own->memorySSA.get()), dominators(&own->dominators),
+              walker(memorySSA->getWalker()) {}
+
+    string dump() {
+        std::stringbuf buf;
+        std::ostream os(&buf);
+
+        os << "\nRESOLVED LOADS:\n";
+        for (BasicBlock &BB : function) {
+            for (Instruction &I : BB) {
+                LoadInst *load = dyn_cast<LoadInst>(&I);
+                if (load == NULL || !statuses.count(load)) continue;
+
+                MemoryAccess *clobber = walker->getClobberingMemoryAccess(load);
+                os << " - " << dumpValue(load) << " <- " << dumpAccess(clobber)
+                   << " => " << dumpStatus(statuses.lookup(load)) << "\n";
+            }
+        }
+        return buf.str();
+    }
+
+private:
+    BudgetTracker *tracker;
+
+    /// Everything MemorySSA needs, for this function only, when there is
+    /// no pass manager to ask.
+    struct OwnMemorySSA {
+        TargetLibraryInfoImpl libraryInfoImpl;
+        TargetLibraryInfo libraryInfo;
+        AssumptionCache assumptions;
+        DominatorTree dominators;
+        BasicAAResult basicAA;
+        AAResults aliases;
+        std::unique_ptr<MemorySSA> memorySSA;
+
+        OwnMemorySSA(Function &function)
+                : libraryInfoImpl(Triple(function.getParent()->getTargetTriple())),
+                  libraryInfo(libraryInfoImpl), assumptions(function), dominators(function),
+                  basicAA(function.getParent()->getDataLayout(), function, libraryInfo, assumptions, &dominators),
+                  aliases(libraryInfo) {
+            aliases.addAAResult(basicAA);
+            memorySSA.reset(new MemorySSA(function, &aliases, &dominators));
+        }
+    };
+    std::unique_ptr<OwnMemorySSA> own;
+
+    AAResults *aliases;
+    MemorySSA *memorySSA;
+    DominatorTree *dominators;
+    MemorySSAWalker *walker;
+
+    /// Status of every value looked at so far, as graph::LeafNodeType bits.
+    DenseMap<Value*, unsigned> statuses;
+
+    /// Status of a location (by its pointer) at a MemoryPhi.
+    DenseMap<std::pair<MemoryPhi*, Value*>, unsigned> phiStatuses;
+
+    /// What loads read, as far as followed.
+    DenseMap<LoadInst*, Value*> loadedValues;
+
+    /// The calls to free, found on the first dereference check.
+    vector<CallBase*> frees;
+    bool collectedFrees = false;
+
+    unsigned status(Value *value) {
+        auto it = statuses.find(value);
+        if (it != statuses.end()) return it->second;
+
+        unsigned fixed = fixedStatus(value);
+        if (isa<Argument>(value)) return statuses[value] = fixed;
+        if (fixed != 0) return fixed;
+        if (tracker != NULL && !tracker->step(statuses.size())) return graph::DONT_KNOW;
+
+        // Phis can depend on themselves through a loop: until we know
+        // better, assume anything.
+        statuses[value] = graph::DONT_KNOW;
+        unsigned s = compute(value);
+        statuses[value] = s;
+        return s;
+    }
+
+    /// What a load from a valid address reads.
+    unsigned contents(LoadInst *load) {
+        MemoryAccess *access = memorySSA->getMemoryAccess(load);
+        if (access == NULL) return graph::DONT_KNOW;
+        return read(walker->getClobberingMemoryAccess(access), MemoryLocation::get(load));
+    }
+
+    /// The status of the pointer stored at `location`, given that
+    /// `clobber` is the last access that may have written it.
+    unsigned read(MemoryAccess *clobber, const MemoryLocation &location) {
+        clobber = skipElsewhere(clobber, location);
+        if (memorySSA->isLiveOnEntryDef(clobber)) return initialContents(location.Ptr);
+
+        if (MemoryPhi *phi = dyn_cast<MemoryPhi>(clobber)) {
+            auto key = std::make_pair(phi, const_cast<Value*>(location.Ptr));
+            auto it = phiStatuses.find(key);
+            if (it != phiStatuses.end()) return it->second;
+
+            phiStatuses[key] = graph::DONT_KNOW; // loops, see status()
+            unsigned s = 0;
+            for (unsigned i = 0; i < phi->getNumIncomingValues(); ++i) {
+                MemoryAccess *incoming = phi->getIncomingValue(i);
+                s |= read(walker->getClobberingMemoryAccess(incoming, location), location);
+            }
+            phiStatuses[key] = s;
+            return s;
+        }
+
+        Value *value = storedAt(clobber, location);
+        if (value == NULL || !value->getType()->isPointerTy()) return graph::DONT_KNOW;
+        unsigned s = status(value);
+        return s == 0 ? graph::DONT_KNOW : s;
+    }
+
+    /// The value a load reads, if a single store writes it.
+    Value *loadedValue(LoadInst *load) {
+        auto it = loadedValues.find(load);
+        if (it != loadedValues.end()) return it->second;
+
+        loadedValues[load] = NULL; // loops, see status()
+        MemoryAccess *access = memorySSA->getMemoryAccess(load);
+        if (access == NULL) return NULL;
+
+        MemoryLocation location = MemoryLocation::get(load);
+        Value *value = storedAt(skipElsewhere(walker->getClobberingMemoryAccess(access), location), location);
+        loadedValues[load] = value;
+        return value;
+    }
+
+    /// The value `clobber` stores at `location`, or NULL if it isn't a
+    /// store of exactly that location.
+    Value *storedAt(MemoryAccess *clobber, const MemoryLocation &location) {
+        MemoryDef *def = dyn_cast<MemoryDef>(clobber);
+        if (def == NULL || memorySSA->isLiveOnEntryDef(def)) return NULL;
+
+        StoreInst *store = dyn_cast<StoreInst>(def->getMemoryInst());
+        if (store == NULL) return NULL;
+
+        MemoryLocation written = MemoryLocation::get(store);
+        if (written.Size != location.Size) return NULL;
+        if (placeOf(written.Ptr) != placeOf(location.Ptr) && !aliases->isMustAlias(written, location)) return NULL;
+        return store->getValueOperand();
+    }
+
+    /// Alias analysis can't tell apart two fields reached through pointers
+    /// that were loaded from memory, as is all code at -O0. Starting from
+    /// `clobber`, skip the stores we can show write somewhere else, by
+    /// following those loads to the stored pointers (see placeOf).
+    MemoryAccess *skipElsewhere(MemoryAccess *clobber, const MemoryLocation &location) {
+        while (MemoryDef *def = dyn_cast<MemoryDef>(clobber)) {
+            if (memorySSA->isLiveOnEntryDef(def)) break;
+
+            StoreInst *store = dyn_cast<StoreInst>(def->getMemoryInst());
+            if (store == NULL || !disjoint(MemoryLocation::get(store), location)) break;
+            clobber = walker->getClobberingMemoryAccess(def->getDefiningAccess(), location);
+        }
+        return clobber;
+    }
+
+    /// Do `a` and `b` certainly not overlap?
+    bool disjoint(const MemoryLocation &a, const MemoryLocation &b) {
+        return PointerWalk::disjoint(placeOf(a.Ptr), sizeOf(a), placeOf(b.Ptr), sizeOf(b));
+    }
+
+    static uint64_t sizeOf(const MemoryLocation &location) {
+        return location.Size.hasValue() ? location.Size.getValue() : 0;
+    }
+
+    /// Has the object `ptr` points into been freed on every path to `at`?
+    bool freedBefore(Value *ptr, Instruction *at) {
+        if (!collectedFrees) {
+            collectedFrees = true;
+            for (BasicBlock &BB : function) {
+                for (Instruction &I : BB) {
+                    CallBase *call = dyn_cast<CallBase>(&I);
+                    if (call != NULL && heapCallKind(*call) == RELEASES) frees.push_back(call);
+                }
+            }
+        }
+
+        Value *object = NULL;
+        for (CallBase *call : frees) {
+            if (call == at || !dominators->dominates(call, at)) continue;
+            if (object == NULL) object = placeOf(ptr).first;
+            if (placeOf(call->getArgOperand(0)).first == object) return true;
+        }
+        return false;
+    }
+
+    string dumpAccess(MemoryAccess *access) {
+        if (memorySSA->isLiveOnEntryDef(access)) return "entry";
+        if (MemoryPhi *phi = dyn_cast<MemoryPhi>(access)) return "phi in " + dumpValue(phi->getBlock());
+
+        string s;
+        raw_string_ostream rso(s);
+        cast<MemoryDef>(access)->getMemoryInst()->print(rso);
+        return rso.str();
+    }
+};
+
+#endif // CLOBBER_ANALYSIS_H
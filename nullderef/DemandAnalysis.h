@@ -0,0 +1,408 @@
+#ifndef DEMAND_ANALYSIS_H
+#define DEMAND_ANALYSIS_H 1
+
+#include <string>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Analysis/CaptureTracking.h>
+#include <llvm/Analysis/MemoryLocation.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/DebugInfoMetadata.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "AnalysisBudget.h"
+#include "HeapModel.h"
+#include "PointerWalk.h"
+
+using std::string;
+using std::vector;
+using namespace llvm;
+
+/// The source lines to check, as inclusive ranges.
+struct QueryLines {
+    vector<std::pair<unsigned, unsigned>> ranges;
+
+    /// Parse `12,40-45`. Returns false if `text` isn't a list of lines and ranges.
+    static bool parse(StringRef text, QueryLines &out) {
+        out.ranges.clear();
+        SmallVector<StringRef, 8> items;
+        text.split(items, ',', -1, false);
+        for (StringRef item : items) {
+            std::pair<StringRef, StringRef> bounds = item.trim().split('-');
+            unsigned first, last;
+            if (bounds.first.getAsInteger(10, first)) return false;
+            if (bounds.second.empty()) last = first;
+            else if (bounds.second.getAsInteger(10, last) || last < first) return false;
+            out.ranges.push_back(std::make_pair(first, last));
+        }
+        return !out.ranges.empty();
+    }
+
+    /// Is `I` on one of the lines? Instructions without a line never are.
+    bool contains(const Instruction &I) const {
+        const DebugLoc &location = I.getDebugLoc();
+        if (!location) return false;
+        unsigned line = location.getLine();
+        for (const auto &range : ranges) {
+            if (range.first <= line && line <= range.second) return true;
+        }
+        return false;
+    }
+};
+
+/// An engine that answers one dereference at a time, walking backwards
+/// from it only as far as the answer needs.
+///
+/// The status of the dereferenced pointer follows its definition: GEPs
+/// with constant indices and casts keep the status of their operand,
+/// phis and selects join theirs. A load looks at the instructions before
+/// it, block by block against the edges of the CFG, for the last one
+/// that may write the location it reads:
+///
+///  - a store of exactly that location gives it the status of the value
+///    stored;
+///  - a store, memset or memcpy we can't show writes elsewhere, or a call
+///    that may write it (anything but a local whose address never
+///    escapes), gives DONT_KNOW;
+///  - at a block with several predecessors, the contents at the end of
+///    each of them are joined;
+///  - at the entry of the function, the location has what the points-to
+///    analysis says (DONT_KNOW for locals).
+///
+/// Nothing is precomputed for the whole function: a query costs the
+/// instructions between the dereference and the stores it depends on.
+/// Statuses are memoized per value and per (block, location), so later
+/// queries stop where earlier ones have been. Around a loop, an answer
+/// depends on itself: it starts from nothing and is computed again until
+/// it doesn't change, and what was computed from it meanwhile is only
+/// kept once it is final (see `solve`). Like the MemorySSA engine,
+/// branches on `p == NULL` don't refine anything.
+///
+/// A dereference is UNDEFINED_DEREF if the object was freed on every
+/// path to it.
+class DemandAnalysis : public PointerWalk<DemandAnalysis> {
+    friend class PointerWalk<DemandAnalysis>;
+
+public:
+    DemandAnalysis(Function &function, const PointsTo *pointsTo = NULL, BudgetTracker *tracker = NULL)
+        : PointerWalk(function, pointsTo), tracker(tracker) {}
+
+    string dump() {
+        std::stringbuf buf;
+        std::ostream os(&buf);
+
+        os << "\nANSWERED LOADS:\n";
+        for (BasicBlock &BB : function) {
+            for (Instruction &I : BB) {
+                auto it = answers.find(valueKey(&I));
+                if (!isa<LoadInst>(I) || it == answers.end()) continue;
+                os << " - " << dumpValue(&I) << " => " << dumpStatus(it->second.status) << "\n";
+            }
+        }
+        os << "\nMEMOIZED: " << answers.size() << " values and locations at block entries, "
+           << scanned << " instructions scanned\n";
+        return buf.str();
+    }
+
+private:
+    /// What a load reads, or a store writes.
+    struct Location {
+        Place place;
+        uint64_t size;  // 0 if unknown
+    };
+
+    enum Write { ELSEWHERE, EXACTLY, MAYBE };
+
+    /// What an answer is about: a value, or a place when a block is entered.
+    typedef std::pair<const void*, Place> Key;
+
+    static Key valueKey(const Value *value) { return Key(value, Place(NULL, 0)); }
+
+    static const unsigned FINAL = ~0u;
+
+    struct Answer {
+        unsigned status;     // graph::LeafNodeType bits, 0 if nothing yet
+        unsigned dependsOn;  // the oldest frame it was computed from, or FINAL
+    };
+
+    /// An answer being computed, and the answers computed from it.
+    struct Frame {
+        unsigned low;        // the oldest frame this one read
+        vector<Key> tagged;
+    };
+
+    BudgetTracker *tracker;
+
+    /// Status of every value and every (block, place) looked at so far.
+    DenseMap<Key, Answer> answers;
+    vector<Frame> frames;
+
+    /// Whether an object was freed on every path to a block, and the
+    /// frees of each block looked at.
+    DenseMap<std::pair<BasicBlock*, Value*>, bool> freedAtEntry;
+    DenseMap<BasicBlock*, vector<CallBase*>> frees;
+
+    /// What loads read, as far as followed.
+    DenseMap<LoadInst*, Value*> loadedValues;
+
+    /// Locals whose address may escape to a callee.
+    DenseMap<const Value*, bool> captured;
+
+    /// Instructions looked at by the backward walks, for the dump.
+    size_t scanned = 0;
+
+    bool outOfBudget() {
+        return tracker != NULL && !tracker->step(answers.size());
+    }
+
+    /// The answer for `key`, memoized, or `compute()` of it. A `compute`
+    /// that asks for an answer still being computed (through a loop) gets
+    /// what that answer is so far, starting from nothing. An answer that
+    /// read itself is computed again until it doesn't change. One that
+    /// read an older answer still being computed is only kept until that
+    /// one is computed again, or becomes final along with it.
+    template <typename Compute>
+    unsigned solve(const Key &key, Compute compute) {
+        auto it = answers.find(key);
+        if (it != answers.end()) {
+            dependOn(it->second.dependsOn);
+            return it->second.status;
+        }
+        if (outOfBudget()) return graph::DONT_KNOW;
+
+        unsigned frame = frames.size();
+        frames.push_back(Frame());
+        answers[key] = Answer{0, frame};
+        unsigned s;
+        for (;;) {
+            frames[frame].low = frame;
+            s = compute();
+            Answer &answer = answers[key];
+            if (frames[frame].low < frame || s == answer.status) break;
+
+            answer.status = s;
+            for (const Key &k : frames[frame].tagged) answers.erase(k);
+            frames[frame].tagged.clear();
+        }
+
+        Frame done = std::move(frames.back());
+        frames.pop_back();
+        unsigned dependsOn = done.low < frame ? done.low : FINAL;
+        answers[key] = Answer{s, dependsOn};
+        for (const Key &k : done.tagged) answers[k].dependsOn = dependsOn;
+        if (dependsOn != FINAL) {
+            vector<Key> &tagged = frames[dependsOn].tagged;
+            tagged.insert(tagged.end(), done.tagged.begin(), done.tagged.end());
+            tagged.push_back(key);
+            dependOn(dependsOn);
+        }
+        return s;
+    }
+
+    void dependOn(unsigned frame) {
+        if (frame != FINAL && !frames.empty()) frames.back().low = std::min(frames.back().low, frame);
+    }
+
+    unsigned status(Value *value) {
+        unsigned fixed = fixedStatus(value);
+        if (fixed != 0) return fixed;
+        return solve(valueKey(value), [&] { return compute(value); });
+    }
+
+    /// What a load from a valid address reads.
+    unsigned contents(LoadInst *load) {
+        return contentsBefore(load->getIterator(), load->getParent(), locationOf(load));
+    }
+
+    /// The status of the pointer at `location` just before `at` in `block`.
+    unsigned contentsBefore(BasicBlock::iterator at, BasicBlock *block, const Location &location) {
+        while (at != block->begin()) {
+            --at;
+            ++scanned;
+
+            // An earlier load of the same location, already answered, read
+            // what we are looking for.
+            LoadInst *load = dyn_cast<LoadInst>(&*at);
+            if (load != NULL && load->getType()->isPointerTy()) {
+                auto answer = answers.find(valueKey(load));
+                if (answer != answers.end() && sameLocation(locationOf(load), location)) {
+                    dependOn(answer->second.dependsOn);
+                    return answer->second.status;
+                }
+            }
+
+            switch (writes(*at, location)) {
+            case ELSEWHERE:
+                continue;
+            case EXACTLY: {
+                Value *stored = cast<StoreInst>(*at).getValueOperand();
+                return stored->getType()->isPointerTy() ? status(stored) : graph::DONT_KNOW;
+            }
+            case MAYBE:
+                return graph::DONT_KNOW;
+            }
+        }
+        return contentsAtEntry(block, location);
+    }
+
+    /// The contents of `location` when `block` is entered: joined over its
+    /// predecessors, or what it holds when the function is entered.
+    unsigned contentsAtEntry(BasicBlock *block, const Location &location) {
+        if (pred_empty(block)) return initialContents(location.place.first);
+        return solve(Key(block, location.place), [&] {
+            unsigned s = 0;
+            for (BasicBlock *pred : predecessors(block)) s |= contentsBefore(pred->end(), pred, location);
+            return s;
+        });
+    }
+
+    /// Does `I` write `location`?
+    Write writes(Instruction &I, const Location &location) {
+        if (StoreInst *store = dyn_cast<StoreInst>(&I)) {
+            Location written = locationOf(store);
+            if (sameLocation(written, location)) return EXACTLY;
+            return disjoint(written, location) ? ELSEWHERE : MAYBE;
+        }
+        if (!I.mayWriteToMemory() || I.isLifetimeStartOrEnd()) return ELSEWHERE;
+
+        if (MemIntrinsic *mem = dyn_cast<MemIntrinsic>(&I)) {
+            Location written = locationOf(mem->getDest(), 0);
+            if (ConstantInt *length = dyn_cast<ConstantInt>(mem->getLength())) written.size = length->getZExtValue();
+            return disjoint(written, location) ? ELSEWHERE : MAYBE;
+        }
+        if (CallBase *call = dyn_cast<CallBase>(&I)) {
+            // free() releases the object, it doesn't change the pointers in it.
+            if (heapCallKind(*call) == RELEASES) return ELSEWHERE;
+            Value *object = location.place.first;
+            return escapes(object) || takesAddressOf(*call, object) ? MAYBE : ELSEWHERE;
+        }
+        return MAYBE;
+    }
+
+    /// Is an argument of `call` a pointer into `object`, that the callee
+    /// may write through? Not capturing a pointer, e.g. an out-parameter
+    /// marked nocapture, doesn't mean not writing through it.
+    bool takesAddressOf(CallBase &call, Value *object) {
+        for (unsigned i = 0; i < call.arg_size(); ++i) {
+            Value *arg = call.getArgOperand(i);
+            if (!arg->getType()->isPointerTy() || call.onlyReadsMemory(i)) continue;
+            if (getUnderlyingObject(arg) == object || placeOf(arg).first == object) return true;
+        }
+        return false;
+    }
+
+    /// Can a callee write into `object`?
+    bool escapes(Value *object) {
+        if (!isa<AllocaInst>(object)) return true;
+        auto it = captured.find(object);
+        if (it != captured.end()) return it->second;
+        return captured[object] = PointerMayBeCaptured(object, true, true);
+    }
+
+    Location locationOf(Instruction *access) {
+        MemoryLocation location = MemoryLocation::get(access);
+        uint64_t size = location.Size.hasValue() ? location.Size.getValue() : 0;
+        return locationOf(location.Ptr, size);
+    }
+
+    Location locationOf(const Value *pointer, uint64_t size) {
+        Location location;
+        location.place = placeOf(pointer);
+        location.size = size;
+        return location;
+    }
+
+    /// The value a load reads, if the store it reads is the only one on
+    /// the way back along single predecessors.
+    Value *loadedValue(LoadInst *load) {
+        auto it = loadedValues.find(load);
+        if (it != loadedValues.end()) return it->second;
+
+        loadedValues[load] = NULL; // loops: no single store until shown otherwise
+        Location location = locationOf(load);
+        BasicBlock *block = load->getParent();
+        BasicBlock::iterator at = load->getIterator();
+        SmallPtrSet<BasicBlock*, 8> visited;
+        Value *value = NULL;
+        while (value == NULL && visited.insert(block).second && !outOfBudget()) {
+            bool stop = false;
+            while (!stop && at != block->begin()) {
+                --at;
+                ++scanned;
+                Write write = writes(*at, location);
+                if (write == EXACTLY) value = cast<StoreInst>(*at).getValueOperand();
+                stop = write != ELSEWHERE;
+            }
+            if (stop) break;
+
+            block = block->getSinglePredecessor();
+            if (block == NULL) break;
+            at = block->end();
+        }
+        loadedValues[load] = value;
+        return value;
+    }
+
+    static bool sameLocation(const Location &a, const Location &b) {
+        return a.place == b.place && a.size == b.size && a.size != 0;
+    }
+
+    /// Do `a` and `b` certainly not overlap?
+    static bool disjoint(const Location &a, const Location &b) {
+        return PointerWalk::disjoint(a.place, a.size, b.place, b.size);
+    }
+
+    /// Has the object `ptr` points into been freed on every path to `at`?
+    bool freedBefore(Value *ptr, Instruction *at) {
+        return freedBefore(at, at->getParent(), placeOf(ptr).first);
+    }
+
+    /// `at` is NULL for the end of `block`.
+    bool freedBefore(Instruction *at, BasicBlock *block, Value *object) {
+        for (CallBase *call : freesIn(block)) {
+            if (at != NULL && !call->comesBefore(at)) break;
+            if (placeOf(call->getArgOperand(0)).first == object) return true;
+        }
+
+        auto key = std::make_pair(block, object);
+        auto it = freedAtEntry.find(key);
+        if (it != freedAtEntry.end()) return it->second;
+        if (pred_empty(block) || outOfBudget()) return freedAtEntry[key] = false;
+
+        freedAtEntry[key] = false; // loops: not freed until shown otherwise
+        bool freed = true;
+        for (BasicBlock *pred : predecessors(block)) {
+            if (!freedBefore(NULL, pred, object)) {
+                freed = false;
+                break;
+            }
+        }
+        return freedAtEntry[key] = freed;
+    }
+
+    /// The calls that release an object in `block`, in order. Every
+    /// dereference looks for them, so each block is only scanned once.
+    const vector<CallBase*> &freesIn(BasicBlock *block) {
+        auto it = frees.find(block);
+        if (it != frees.end()) return it->second;
+
+        vector<CallBase*> &calls = frees[block];
+        for (Instruction &I : *block) {
+            CallBase *call = dyn_cast<CallBase>(&I);
+            if (call != NULL && heapCallKind(*call) == RELEASES) calls.push_back(call);
+        }
+        return calls;
+    }
+};
+
+#endif // DEMAND_ANALYSIS_H
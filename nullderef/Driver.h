@@ -0,0 +1,270 @@
+#ifndef DRIVER_H
+#define DRIVER_H 1
+
+#include <memory>
+#include <vector>
+
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "ErrorCode.h"
+#include "NullDereference.h"
+#include "Visitor.h"
+#include "Annotator.h"
+#include "FlowAnalysis.h"
+#include "ClobberAnalysis.h"
+#include "DemandAnalysis.h"
+#include "AnalysisBudget.h"
+#include "Summary.h"
+#include "PerfCounters.h"
+#include "Triage.h"
+#include "LastUses.h"
+
+using std::vector;
+using namespace llvm;
+
+/// How to analyse a function.
+struct AnalysisOptions {
+    Engine engine = GraphEngine;
+    bool testOutput = false;
+    bool debugOutput = false;
+    bool annotate = false;
+    bool summarize = false;
+    AnalysisBudget budget;
+
+    /** If set, analyse calls per calling context, memoized in this table. */
+    CallContexts *contexts = NULL;
+
+    /** The module's globals, shared by the graphs of all functions. */
+    const GlobalGraph *globals = NULL;
+
+    /** If set, measure the visit loop, the graph teardown and the dump with it. */
+    PerfCounters *counters = NULL;
+
+    /** If set, visit with this Visitor, reset first, instead of a new one:
+        its graph keeps its memory from one function to the next. */
+    Visitor *workspace = NULL;
+
+    /** If set, every dereference error found is appended to it. */
+    vector<Diagnostic> *diagnostics = NULL;
+
+    /** If set, the demand engine only checks the instructions on these lines. */
+    const QueryLines *queryLines = NULL;
+
+    /** The graph engine forgets values after their last use in functions
+        of at least this many instructions, and reclaims the nodes nothing
+        reaches once the graph has this many (0: after every instruction). */
+    unsigned releaseMinInstructions = LastUses::MIN_INSTRUCTIONS;
+    size_t collectMinNodes = Graph::MIN_COLLECTION;
+
+    /** If set, run the tier-0 scan first: skip TRIVIALLY_SAFE functions
+        and analyse LOCAL ones without contexts. */
+    Triage *triage = NULL;
+
+    /** If both are set, the memory SSA engine walks these instead of
+        building its own: the pass manager's, for the function analysed. */
+    AAResults *aliases = NULL;
+    MemorySSA *memorySSA = NULL;
+};
+
+/// What the analysis of one function found, besides the output it printed.
+struct FunctionResult {
+    /** Number of dereference errors found. */
+    unsigned errors = 0;
+
+    /** Attributes and metadata nodes added to the IR (with `annotate`). */
+    unsigned annotationsAdded = 0;
+
+    /** The budget ran out before the end of the function. */
+    bool overBudget = false;
+
+    /** What the tier-0 scan found (with `triage`). */
+    Tier tier = DEEP;
+
+    /** The summary of the function and its calls (with `summarize`). */
+    FunctionSummary summary;
+    vector<CallSummary> calls;
+
+    /** What the visit loop, graph teardown and dump cost (with `counters`). */
+    PerfSample visitCost, teardownCost, dumpCost;
+};
+
+/// Analyse `function` and write the diagnostics to `os`, the way the
+/// nullderef pass reports them. This is the body of the pass, shared with
+/// tools that drive the analysis themselves, such as nullderef-server.
+/// `pointsTo` is the module-wide points-to analysis, or NULL.
+inline FunctionResult analyzeFunction(Function &function, const AnalysisOptions &options,
+                               const PointsTo *pointsTo, raw_ostream &os) {
+    FunctionResult out;
+    size_t instNumber = 0;
+    PerfCounters *counters = options.counters;
+
+    Engine engine = options.engine;
+    CallContexts *contexts = options.contexts;
+    if (options.triage) {
+        out.tier = options.triage->classify(function);
+        // Annotations, summaries and dumps need the facts of every function.
+        bool everyFunction = options.annotate || options.summarize || options.debugOutput;
+        if (out.tier == TRIVIALLY_SAFE && !everyFunction) {
+            os << "\n\n";
+            return out;
+        }
+        if (out.tier != DEEP) contexts = NULL;
+    }
+
+    // The workspace's graph is torn down by resetting it, which keeps its
+    // memory; a Visitor of our own is on the heap, so that destroying it
+    // can be measured too (see -perf's teardown below).
+    std::unique_ptr<Visitor> visitorPtr;
+    if (options.workspace) {
+        options.workspace->reset(pointsTo, contexts, options.globals);
+    } else {
+        visitorPtr.reset(new Visitor(pointsTo, contexts, options.globals));
+    }
+    Visitor &visitor = options.workspace ? *options.workspace : *visitorPtr;
+
+    // The Annotator reads the Visitor's graph, which only the graph engine builds.
+    bool annotate = options.annotate && engine == GraphEngine;
+    Annotator annotator(function, visitor, pointsTo);
+    BudgetTracker tracker(options.budget);
+    visitor.setBudget(&tracker);
+
+    std::unique_ptr<SummaryBuilder> summary;
+    if (options.summarize) summary.reset(new SummaryBuilder(function));
+
+    if (counters) counters->start();
+
+    std::unique_ptr<FlowAnalysis> flow;
+    if (engine == FlowEngine) {
+        flow.reset(new FlowAnalysis(function, contexts));
+        flow->solve(&tracker);
+    }
+
+    // Resolves loads on demand, from the results asked for below.
+    std::unique_ptr<ClobberAnalysis> clobbers;
+    if (engine == MemorySSAEngine) {
+        if (options.aliases && options.memorySSA) {
+            clobbers.reset(new ClobberAnalysis(function, *options.aliases, *options.memorySSA, pointsTo, &tracker));
+        } else {
+            clobbers.reset(new ClobberAnalysis(function, pointsTo, &tracker));
+        }
+    }
+
+    // Answers each dereference asked for below, and nothing else.
+    std::unique_ptr<DemandAnalysis> demand;
+    if (engine == DemandEngine) {
+        demand.reset(new DemandAnalysis(function, pointsTo, &tracker));
+    }
+
+    // In a long function, the graph engine forgets values after their
+    // last use. The dump shows the whole graph, so keep it all then.
+    std::unique_ptr<LastUses> lastUses;
+    if (!flow && !clobbers && !demand && !options.debugOutput
+            && function.getInstructionCount() >= options.releaseMinInstructions) {
+        lastUses.reset(new LastUses(function));
+    }
+    unsigned position = 0;
+
+    os << "\n";
+
+    for (BasicBlock &BB : function) {
+        if (tracker.exceededLimit() != NULL) break;
+
+        for (Instruction &I : BB) {
+            ErrorCode result;
+
+            // The graph engine spends one step per instruction. Once the
+            // budget is used up, the rest of the function stays DONT_KNOW.
+            if (!flow && !clobbers && !demand && !tracker.step(visitor.graphSize())) break;
+
+            if (flow) result = flow->result(I);
+            else if (clobbers) result = clobbers->result(I);
+            else if (demand) result = !options.queryLines || options.queryLines->contains(I) ? demand->result(I) : OK;
+            else result = visitor.visit(I);
+            if ((result & DEREF) == DEREF) {
+                ++out.errors;
+                if (options.diagnostics) options.diagnostics->push_back({result, &I});
+            }
+
+            if (annotate) annotator.observe(I);
+            if (summary) {
+                summary->observe(I, [&](Value *v) {
+                    if (flow) return flow->valueStatus(v);
+                    if (demand) return demand->valueStatus(v);
+                    return clobbers ? clobbers->valueStatus(v) : visitor.statusOf(v);
+                });
+            }
+
+            // Print user oriented output
+            printUserOutput(result, &I, os);
+
+            // Print testing output
+            if (options.testOutput) {
+                printTestOutput(result, &I, ++instNumber, os);
+            }
+
+            // If there was an unknown error, report it and stop the loop
+            if ((result & ERROR) == ERROR) {
+                printError(visitor.lastError().c_str(), &I, os);
+                break;
+            }
+
+            if (lastUses) visitor.release(lastUses->dyingAt(position), options.collectMinNodes);
+            ++position;
+        }
+    }
+
+    if (counters) out.visitCost = counters->stop();
+    visitor.setBudget(NULL);
+
+    if (options.debugOutput) {
+        if (counters) counters->start();
+        os.changeColor(llvm::raw_ostream::YELLOW);
+        if (flow) os << flow->dump();
+        else if (clobbers) os << clobbers->dump();
+        else if (demand) os << demand->dump();
+        else os << visitor.dump();
+        os.resetColor();
+        if (counters) out.dumpCost = counters->stop();
+    }
+
+    if (tracker.exceededLimit() != NULL) {
+        out.overBudget = true;
+        os << "BUDGET[" << function.getName() << "]: " << tracker.exceededLimit()
+           << " reached after " << tracker.stepsTaken() << " steps and "
+           << tracker.elapsedMillis() << " ms, the rest is DONT_KNOW\n";
+    }
+
+    os << "\n";
+
+    if (summary) {
+        out.summary = summary->functionSummary();
+        out.calls = summary->callSummaries();
+    }
+
+    if (annotate) out.annotationsAdded = annotator.apply();
+
+    if (counters) {
+        counters->start();
+        if (options.workspace) options.workspace->reset();
+        visitorPtr.reset();
+        flow.reset();
+        clobbers.reset();
+        demand.reset();
+        out.teardownCost = counters->stop();
+
+        os << "PERF[" << function.getName() << "] visit: ";
+        out.visitCost.print(os);
+        os << "\nPERF[" << function.getName() << "] teardown: ";
+        out.teardownCost.print(os);
+        if (options.debugOutput) {
+            os << "\nPERF[" << function.getName() << "] dump: ";
+            out.dumpCost.print(os);
+        }
+        os << "\n";
+    }
+    return out;
+}
+
+#endif // DRIVER_H
@@ -4,29 +4,11 @@
 #include <string>
 #include "llvm/IR/DebugInfo.h"
 
-using namespace llvm;
-
-enum ErrorCode {
-    /** All is well. */
-    OK = 0,
-
-    /** An invalid value has been dereferenced. */
-    DEREF = 16,
-
-    /** A null value has been dereferenced. */
-    NULL_DEREF = DEREF | 1,
+#include "NullDereference.h" // ErrorCode itself, part of the library's API
 
-    /** An undefined value has been dereferenced. */
-    UNDEFINED_DEREF = DEREF | 2,
-
-    /** Something went wrong, but we aren't sure exactly what went wrong. */
-    ERROR = 32,
-
-    /** We expected a key/value pair in our map, but we couldn't it. */
-    MISSED_DEFINITION = ERROR | 1
-};
+using namespace llvm;
 
-std::string errorCodeName(ErrorCode code) {
+inline std::string errorCodeName(ErrorCode code) {
     switch (code) {
     case OK:                return "OK";
     case DEREF:             return "DEREF";
@@ -38,34 +20,34 @@ std::string errorCodeName(ErrorCode code) {
     }
 }
 
-void printUserOutput(ErrorCode code, Instruction* inst) {
+inline void printUserOutput(ErrorCode code, Instruction* inst, raw_ostream &os = errs()) {
     if (code == NULL_DEREF) {
         if (DILocation *Loc = inst->getDebugLoc()) {
-            errs() << "Null dereference happening at line " << Loc->getLine();
-            errs() << '\n';
+            os << "Null dereference happening at line " << Loc->getLine();
+            os << '\n';
         }
     }
 }
 
-void printTestOutput(ErrorCode code, Instruction* inst, size_t instNumber) {
+inline void printTestOutput(ErrorCode code, Instruction* inst, size_t instNumber, raw_ostream &os = errs()) {
     if (code != OK) {
-        errs() << "TEST[" << instNumber << "]:" << errorCodeName(code);
-        inst->print(errs());
-        errs() << "\n";
+        os << "TEST[" << instNumber << "]:" << errorCodeName(code);
+        inst->print(os);
+        os << "\n";
     }
 }
 
-void printError(const char* msg) {
-    errs().changeColor(raw_ostream::RED);
-    errs() << "ERROR: " << msg << "\n";
-    errs().resetColor();
+inline void printError(const char* msg, raw_ostream &os = errs()) {
+    os.changeColor(raw_ostream::RED);
+    os << "ERROR: " << msg << "\n";
+    os.resetColor();
 }
 
-void printError(const char* msg, Instruction *I) {
-    printError(msg);
-    errs() << "    while dealing with ";
-    I->print(errs());
-    errs() << '\n';
+inline void printError(const char* msg, Instruction *I, raw_ostream &os = errs()) {
+    printError(msg, os);
+    os << "    while dealing with ";
+    I->print(os);
+    os << '\n';
 }
 
 #endif // ERROR_CODE_H
@@ -0,0 +1,406 @@
+#ifndef FLOW_ANALYSIS_H
+#define FLOW_ANALYSIS_H 1
+
+#include <string>
+#include <sstream>
+#include <vector>
+
+#include <llvm/ADT/BitVector.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+
+#include "AnalysisBudget.h"
+#include "CallContexts.h"
+#include "ErrorCode.h"
+#include "HeapModel.h"
+#include "LoweredFunction.h"
+#include "NullnessState.h"
+
+using std::string;
+using std::vector;
+using namespace llvm;
+
+/// A flow-sensitive alternative to the Visitor.
+///
+/// The Visitor walks the blocks once in layout order, so it can't tell
+/// the two sides of an `if` apart, and it never looks at a loop twice.
+/// This class instead runs a classic forward dataflow analysis to a
+/// fixpoint over the CFG. The state at every block entry is a
+/// NullnessState over the function's "slots": pointer typed allocas whose
+/// address never escapes, so that every access to them is a direct load
+/// or store. Merges at CFG joins are bitwise ORs of those states.
+///
+/// Conditional branches on `p == NULL` / `p != NULL` refine the state of
+/// the slot `p` was loaded from on each outgoing edge, and edges that
+/// contradict the state (e.g. `p != NULL` when p is NIL) are not taken.
+///
+/// Slots start out UNDEFINED, and `free(p)` makes the slot `p` was loaded
+/// from dangle, so that loading the pointer again yields UNDEFINED. That
+/// is a state of its own, not the absence of one: it survives merges and
+/// null checks (see NullnessState).
+///
+/// SSA values don't need a per-point state: they are defined once, so we
+/// keep a single status for each of them (the join over all the times its
+/// definition was evaluated).
+///
+/// The function is lowered once to a LoweredFunction, and the fixpoint
+/// iterations and the report replay run over its arrays only.
+///
+/// Given a CallContexts table, calls to functions with a body are
+/// context-sensitive: the callee is analysed (by another FlowAnalysis)
+/// with the nullness of the arguments at the call, and the call gets the
+/// status the callee returns. Passing NULL to a callee that dereferences
+/// it is a NULL_DEREF at the call.
+class FlowAnalysis {
+    /// The function, lowered to the pointer operations we care about.
+    LoweredFunction code;
+
+    vector<NullnessState> in;   // state at the entry of each block
+    BitVector reached;          // has any edge into the block been taken?
+    BitVector pending;          // blocks waiting to be (re)visited
+
+    /// Status of every value id, as graph::LeafNodeType bits. Zero means
+    /// that the definition hasn't been evaluated yet.
+    vector<unsigned> status;
+
+    DenseMap<Instruction*, ErrorCode> errors;
+
+    /// Context sensitivity: the memo table (or NULL), how many calls deep
+    /// this function is analysed, and the join of what it returns.
+    CallContexts *contexts;
+    unsigned depth;
+    unsigned returned = 0;
+
+    /// The budget of `solve`, which the callees analysed for contexts
+    /// spend too.
+    BudgetTracker *tracker = NULL;
+
+public:
+    FlowAnalysis(Function &function, CallContexts *contexts = NULL, unsigned depth = 0)
+            : code(function), contexts(contexts), depth(depth) {
+        init();
+    }
+
+    /// Without context sensitivity, from a snapshot of the function: this
+    /// doesn't read the IR.
+    FlowAnalysis(const FunctionSnapshot &snapshot) : code(snapshot), contexts(NULL), depth(0) {
+        init();
+    }
+
+    /// Run the analysis to a fixpoint and collect dereference errors. Every
+    /// block visit is a step of `tracker`, without nodes: the states don't
+    /// grow while solving (see AnalysisBudget), and so is every block visit
+    /// in the callees analysed per context. If the budget runs out, we
+    /// stop and report nothing, i.e. everything is DONT_KNOW; then false is
+    /// returned.
+    bool solve(BudgetTracker *tracker = NULL) {
+        this->tracker = tracker;
+        if (code.blocks.empty()) return true;
+
+        reached.set(0);
+        pending.set(0);
+
+        // Always continue with the earliest block in reverse post-order,
+        // so that loops are finished before the code after them.
+        for (int b = pending.find_first(); b != -1; b = pending.find_first()) {
+            if (tracker != NULL && !tracker->step()) {
+                pending.reset();
+                return false;
+            }
+            pending.reset(b);
+
+            const LoweredFunction::Block &block = code.blocks[b];
+            NullnessState state = in[b];
+            for (unsigned op = block.opBegin; op < block.opEnd; ++op) {
+                transfer(code.ops[op], state, false);
+            }
+            propagate(block, state);
+        }
+
+        // All states are stable now; replay each block once to report.
+        for (unsigned b = 0; b < code.blocks.size(); ++b) {
+            if (!reached.test(b)) continue;
+
+            const LoweredFunction::Block &block = code.blocks[b];
+            NullnessState state = in[b];
+            for (unsigned op = block.opBegin; op < block.opEnd; ++op) {
+                transfer(code.ops[op], state, true);
+            }
+        }
+        return true;
+    }
+
+    /// The error found at `I`, if any.
+    ErrorCode result(Instruction &I) const {
+        return result(&I);
+    }
+
+    /// The same, for an instruction that is only compared, never read: it
+    /// may be gone from the IR by now (see BackgroundAnalysis).
+    ErrorCode result(const Instruction *I) const {
+        auto it = errors.find(const_cast<Instruction*>(I));
+        return it == errors.end() ? OK : it->second;
+    }
+
+    /// The status of the SSA value `value` on every path that reaches it.
+    /// A value that dangles on some of them only is DONT_KNOW.
+    graph::LeafNodeType valueStatus(Value *value) const {
+        unsigned id = code.idOf(value);
+        unsigned s = id == LoweredFunction::NONE ? LoweredFunction::fixedStatus(value) : status[id];
+        if (s == 0 || ((s & graph::UNDEFINED) != 0 && s != graph::UNDEFINED)) return graph::DONT_KNOW;
+        return (graph::LeafNodeType) s;
+    }
+
+    /// What `call` does when its arguments have the statuses `args` (one
+    /// per argument; those of non-pointers are ignored), if the caller is
+    /// analysed `depth` calls deep. Each context is analysed once, see
+    /// CallContexts, with the steps left in the caller's `tracker`.
+    static CallEffect callEffect(CallBase &call, ArrayRef<unsigned> args,
+                                 CallContexts *contexts, unsigned depth, BudgetTracker *tracker = NULL) {
+        Function *callee = LoweredFunction::definedCallee(call);
+        if (contexts == NULL || callee == NULL || depth >= contexts->maxDepth()) return CallEffect();
+
+        SmallVector<unsigned, 8> params;
+        for (Argument &param : callee->args()) {
+            if (!param.getType()->isPointerTy()) continue;
+            unsigned s = param.getArgNo() < args.size() ? args[param.getArgNo()] : graph::DONT_KNOW;
+            params.push_back(s == graph::NIL || s == graph::NON_NIL ? s : graph::DONT_KNOW);
+        }
+        return contextEffect(*callee, params, *contexts, depth + 1, tracker);
+    }
+
+    string dump() {
+        std::stringbuf buf;
+        std::ostream os(&buf);
+
+        os << "\nTRACKED SLOTS:\n";
+        for (AllocaInst *slot : code.slots) {
+            os << " - " << dumpValue(slot) << "\n";
+        }
+
+        os << "\nSTATE AT BLOCK ENTRIES:\n";
+        for (unsigned b = 0; b < code.blocks.size(); ++b) {
+            os << " - " << dumpValue(code.blocks[b].block) << (reached.test(b) ? "" : " (never reached)") << "\n";
+            for (unsigned s = 0; s < code.numSlots(); ++s) {
+                os << "     " << dumpValue(code.slots[s]) << " => " << dumpStatus(in[b].get(s)) << "\n";
+            }
+        }
+
+        return buf.str();
+    }
+
+private:
+    /// The effect of `callee`, analysed `depth` calls deep with `params`
+    /// for its pointer parameters. Only the NULL dereferences that the
+    /// context-free analysis of the callee doesn't find are counted: those
+    /// are reported in the callee itself.
+    ///
+    /// If `tracker` runs out meanwhile, the effect is unknown, and isn't
+    /// remembered: with a new budget, the context can be analysed again.
+    static CallEffect contextEffect(Function &callee, ArrayRef<unsigned> params,
+                                    CallContexts &contexts, unsigned depth, BudgetTracker *tracker) {
+        CallContexts::Key key = CallContexts::key(&callee, params, depth);
+        if (const CallEffect *known = contexts.find(key)) return *known;
+        if (tracker != NULL && tracker->exceededLimit() != NULL) return CallEffect();
+
+        FlowAnalysis analysis(callee, &contexts, depth);
+        bool passesNull = false;
+        unsigned p = 0;
+        for (Argument &param : callee.args()) {
+            if (!param.getType()->isPointerTy()) continue;
+            unsigned id = analysis.code.idOf(&param);
+            graph::LeafNodeType s = CallContexts::paramStatus(key, p++);
+            if (id != LoweredFunction::NONE) analysis.status[id] = s;
+            passesNull |= s == graph::NIL;
+        }
+        if (!analysis.solve(tracker)) return CallEffect();
+
+        CallEffect effect;
+        if (analysis.returned != 0) effect.returned = analysis.returned;
+        for (auto &error : analysis.errors) {
+            if (error.second == NULL_DEREF) ++effect.nullDerefs;
+        }
+        if (passesNull && effect.nullDerefs > 0) {
+            SmallVector<unsigned, 8> unknown(params.size(), graph::DONT_KNOW);
+            unsigned baseline = contextEffect(callee, unknown, contexts, depth, tracker).nullDerefs;
+            if (tracker != NULL && tracker->exceededLimit() != NULL) return CallEffect();
+            effect.nullDerefs = effect.nullDerefs > baseline ? effect.nullDerefs - baseline : 0;
+        } else {
+            effect.nullDerefs = 0;
+        }
+        return contexts.insert(key, effect);
+    }
+
+    /// Join `s` into the status of value `id`. If it changed, the blocks
+    /// using the value have to be looked at again.
+    void update(unsigned id, unsigned s) {
+        unsigned &old = status[id];
+        if ((old | s) == old) return;
+        old |= s;
+
+        for (unsigned u = code.usersBegin[id]; u < code.usersBegin[id + 1]; ++u) {
+            unsigned b = code.users[u];
+            if (reached.test(b)) pending.set(b);
+        }
+    }
+
+    /// Apply the effect of `op` to `state`. If `report` is set, record
+    /// the dereference errors found at it.
+    void transfer(const PtrOp &op, NullnessState &state, bool report) {
+        switch (op.opcode) {
+        case OP_STORE_SLOT:
+            state.set(op.a, status[op.b]);
+            break;
+
+        case OP_LOAD_SLOT:
+            update(op.result, state.get(op.a));
+            break;
+
+        case OP_LOAD: {
+            if (report) checkDeref(op.inst, op.a);
+            unsigned ptr = status[op.b];
+            if (ptr != 0 && (ptr & graph::NON_NIL) == 0) {
+                if (op.result != LoweredFunction::NONE) update(op.result, graph::UNDEFINED); // result of an invalid dereference
+            } else if (op.result != LoweredFunction::NONE) {
+                update(op.result, graph::DONT_KNOW);
+            }
+            break;
+        }
+
+        case OP_STORE:
+            if (report) checkDeref(op.inst, op.a);
+            break;
+
+        case OP_CHECK:
+            if (report) {
+                checkDeref(op.inst, op.a);
+                if (op.b != LoweredFunction::NONE) checkDeref(op.inst, op.b);
+            }
+            break;
+
+        case OP_COPY:
+            update(op.result, status[op.a]);
+            break;
+
+        case OP_UNKNOWN:
+            update(op.result, graph::DONT_KNOW);
+            break;
+
+        case OP_JOIN: {
+            unsigned s = 0;
+            for (unsigned i = op.a; i < op.a + op.b; ++i) s |= status[code.joined[i]];
+            update(op.result, s);
+            break;
+        }
+
+        case OP_FREE:
+            if (report && status[op.a] == graph::UNDEFINED) errors[op.inst] = UNDEFINED_DEREF;
+            if (op.b != LoweredFunction::NONE) state.markFreed(op.b);
+            break;
+
+        case OP_CALL:
+            transferCall(op, report);
+            break;
+
+        case OP_RETURN:
+            if (report) returned |= status[op.a];
+            break;
+        }
+    }
+
+    void transferCall(const PtrOp &op, bool report) {
+        if (contexts == NULL) {
+            if (op.result != LoweredFunction::NONE) update(op.result, graph::DONT_KNOW);
+            return;
+        }
+
+        SmallVector<unsigned, 8> args;
+        for (unsigned i = op.a; i < op.a + op.b; ++i) {
+            unsigned id = code.joined[i];
+            unsigned s = id == LoweredFunction::NONE ? graph::DONT_KNOW : status[id];
+            if (s == 0) return; // wait until the argument has been evaluated
+            args.push_back(s);
+        }
+
+        CallEffect effect = callEffect(*cast<CallBase>(op.inst), args, contexts, depth, tracker);
+        if (op.result != LoweredFunction::NONE) update(op.result, effect.returned);
+        if (report && effect.nullDerefs > 0) errors[op.inst] = NULL_DEREF;
+    }
+
+    void init() {
+        unsigned numBlocks = code.blocks.size();
+        in.assign(numBlocks, NullnessState(code.numSlots()));
+        if (numBlocks > 0) in[0].setUninitialised();
+        reached.resize(numBlocks);
+        pending.resize(numBlocks);
+        status = code.initialStatus;
+    }
+
+    /// Report a dereference of `ptr` if it can't be valid on any path:
+    /// it is NULL or dangling, and NULL on at least one of them.
+    void checkDeref(Instruction *I, unsigned ptr) {
+        if (errors.count(I)) return;
+
+        unsigned s = status[ptr];
+        if (s == graph::UNDEFINED) errors[I] = UNDEFINED_DEREF;
+        else if ((s & graph::NIL) != 0 && (s & graph::NON_NIL) == 0) errors[I] = NULL_DEREF;
+    }
+
+    /// Push the state at the end of `block` into its successors. Branches
+    /// on `p == NULL` / `p != NULL` refine the slot holding p on each edge,
+    /// and edges the state rules out aren't taken.
+    void propagate(const LoweredFunction::Block &block, const NullnessState &state) {
+        if (block.tested == LoweredFunction::NONE) {
+            for (unsigned e = block.succBegin; e < block.succEnd; ++e) flowInto(code.edges[e], state);
+            return;
+        }
+
+        graph::LeafNodeType onFirst = block.onFirst;
+        graph::LeafNodeType onSecond = onFirst == graph::NIL ? graph::NON_NIL : graph::NIL;
+        unsigned tested = status[block.tested];
+
+        for (unsigned i = 0; i < 2; ++i) {
+            graph::LeafNodeType type = i == 0 ? onFirst : onSecond;
+
+            // the value itself already rules this edge out
+            if ((tested == graph::NIL || tested == graph::NON_NIL) && tested != (unsigned) type) continue;
+
+            NullnessState edge = state;
+            if (block.testedSlot != LoweredFunction::NONE && !edge.refine(block.testedSlot, type)) continue;
+            flowInto(code.edges[block.succBegin + i], edge);
+        }
+    }
+
+    void flowInto(unsigned b, const NullnessState &state) {
+        bool changed = in[b].join(state);
+        if (changed || !reached.test(b)) {
+            reached.set(b);
+            pending.set(b);
+        }
+    }
+
+    static string dumpValue(Value *value) {
+        if (value->hasName()) return "%" + value->getName().str();
+
+        string s;
+        raw_string_ostream rso(s);
+        value->printAsOperand(rso, false);
+        return rso.str();
+    }
+
+    static const char *dumpStatus(unsigned type) {
+        switch (type) {
+        case 0: return "-";
+        case graph::NIL: return "NIL";
+        case graph::NON_NIL: return "NON_NIL";
+        case graph::DONT_KNOW: return "DONT_KNOW";
+        case graph::UNDEFINED: return "UNDEFINED";
+        default: return "MAYBE_UNDEFINED";
+        }
+    }
+};
+
+#endif // FLOW_ANALYSIS_H
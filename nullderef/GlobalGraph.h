@@ -0,0 +1,172 @@
+#ifndef GLOBAL_GRAPH_H
+#define GLOBAL_GRAPH_H 1
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/Module.h>
+
+#include "PointerGraph.h"
+#include "PointsTo.h"
+
+using graph::Graph;
+using graph::Node;
+
+using namespace llvm;
+
+/// The pointer graph of a module's global variables, built once per
+/// module. Every Visitor starts from it as the read-only base of its own
+/// graph (see graph::Graph), instead of discovering the globals again in
+/// every function.
+///
+/// A global gets a node that references the nullness of what it holds:
+/// what the points-to analysis says about it, or, for `constant` globals,
+/// exactly what their initialiser holds. The pointer fields of a constant
+/// struct or array also get offset nodes, so `table.ops[2]` is known
+/// without looking at a single store, and so do the structs and arrays
+/// nested in it, with offset nodes of their own. Mutable globals aren't
+/// read from their initialiser: other functions may have changed them.
+class GlobalGraph {
+    /// How deep structs and arrays nested in a constant get offset nodes.
+    static const unsigned MAX_NESTING = 8;
+
+    Graph globals;
+
+public:
+    GlobalGraph(Module &module, const PointsTo *pointsTo) {
+        for (GlobalVariable &global : module.globals()) add(global, pointsTo);
+        globals.freeze();
+    }
+
+    const Graph &graph() const { return globals; }
+
+    /// The nullness of the pointer constant `c`.
+    static graph::LeafNodeType constantStatus(const Constant *c) {
+        if (c->isNullValue()) return graph::NIL;
+        if (isa<UndefValue>(c)) return graph::DONT_KNOW;
+        if (const GlobalValue *global = dyn_cast<GlobalValue>(c->stripPointerCasts())) {
+            return global->hasExternalWeakLinkage() ? graph::DONT_KNOW : graph::NON_NIL;
+        }
+        return graph::NON_NIL;
+    }
+
+    /// The initialiser of `global`, if it can never change.
+    static const Constant *fixedInitializer(const GlobalVariable &global) {
+        if (!global.isConstant() || !global.hasDefinitiveInitializer()) return NULL;
+        return global.getInitializer();
+    }
+
+    /// The nullness of the pointer fields of a constant struct or array,
+    /// in layout order, those of the structs and arrays nested in it
+    /// included (DONT_KNOW for the other fields).
+    static void fieldStatuses(const Constant *aggregate, SmallVectorImpl<graph::LeafNodeType> &fields,
+                              unsigned depth = 0) {
+        Type *type = aggregate->getType();
+        if (!type->isStructTy() && !type->isArrayTy()) return;
+
+        unsigned count = type->isStructTy() ? type->getStructNumElements() : type->getArrayNumElements();
+        for (unsigned i = 0; i < count; ++i) {
+            const Constant *field = aggregate->getAggregateElement(i);
+            if (field != NULL && isNested(field->getType()) && depth < MAX_NESTING) {
+                fieldStatuses(field, fields, depth + 1);
+                continue;
+            }
+            bool pointer = field != NULL && field->getType()->isPointerTy();
+            fields.push_back(pointer ? constantStatus(field) : graph::DONT_KNOW);
+        }
+    }
+
+    /// Does an object of `type` hold pointers, in fields of fields too?
+    static bool holdsPointers(Type *type) {
+        if (type->isPointerTy()) return true;
+        if (type->isStructTy()) {
+            for (Type *element : type->subtypes()) {
+                if (holdsPointers(element)) return true;
+            }
+        }
+        return type->isArrayTy() && holdsPointers(type->getArrayElementType());
+    }
+
+private:
+    void add(GlobalVariable &global, const PointsTo *pointsTo) {
+        const Constant *initializer = fixedInitializer(global);
+        if (global.hasExternalWeakLinkage()) return;
+        if (pointsTo == NULL && initializer == NULL) return; // nothing known, as before
+
+        // What the global holds: the same as Visitor::seedFromPointsTo.
+        graph::LeafNodeType held = pointsTo ? pointsTo->pointeeNullness(&global) : graph::DONT_KNOW;
+        if (initializer != NULL && initializer->getType()->isPointerTy()) held = constantStatus(initializer);
+
+        Node *node;
+        if (held == graph::NIL || held == graph::NON_NIL) {
+            Node *leaf = globals.insertNode(Node::newLeafNode(held));
+            node = globals.insertNode(&global, Node::newRefNode(leaf));
+        } else {
+            node = globals.insertNode(&global, Node::newLeafNode(graph::NON_NIL));
+        }
+        if (initializer == NULL) return;
+
+        addFields(node, initializer, 0);
+
+        // Code reaches the fields through constant expressions, which no
+        // Visitor ever visits: make them entry points too.
+        for (User *user : global.users()) {
+            ConstantExpr *expr = dyn_cast<ConstantExpr>(user);
+            if (expr == NULL) continue;
+
+            if (expr->getOpcode() == Instruction::BitCast) {
+                globals.insertNode(expr, node);
+            } else if (expr->getOpcode() == Instruction::GetElementPtr) {
+                if (Node *field = fieldAt(node, expr)) globals.insertNode(expr, field);
+            }
+        }
+    }
+
+    /// Give `node`, the address of an object initialised to `aggregate`,
+    /// the offset nodes the Visitor looks up: the field of
+    /// `getelementptr %g, 0, i` is offset i of the node of %g, and a field
+    /// of a nested struct or array is an offset of that field's node.
+    void addFields(Node *node, const Constant *aggregate, unsigned depth) {
+        Type *type = aggregate->getType();
+        if (!type->isStructTy() && !type->isArrayTy()) return;
+
+        unsigned count = type->isStructTy() ? type->getStructNumElements() : type->getArrayNumElements();
+        for (unsigned i = 0; i < count; ++i) {
+            const Constant *field = aggregate->getAggregateElement(i);
+            if (field == NULL) continue;
+
+            if (field->getType()->isPointerTy()) {
+                graph::LeafNodeType status = constantStatus(field);
+                if (status != graph::NIL && status != graph::NON_NIL) continue;
+
+                Node *leaf = globals.insertNode(Node::newLeafNode(status));
+                globals.insertOffsetNode(node, i, globals.insertNode(Node::newRefNode(leaf)));
+            } else if (isNested(field->getType()) && depth < MAX_NESTING) {
+                Node *inner = globals.insertNode(Node::newLeafNode(graph::NON_NIL));
+                globals.insertOffsetNode(node, i, inner);
+                addFields(inner, field, depth + 1);
+            }
+        }
+    }
+
+    /// The offset node `getelementptr %g, 0, i, j, ...` (constant indices
+    /// only) leads to from `node`, the node of %g, or NULL.
+    Node *fieldAt(Node *node, ConstantExpr *gep) {
+        ConstantInt *first = dyn_cast<ConstantInt>(gep->getOperand(1));
+        if (first == NULL || !first->isZero()) return NULL;
+
+        for (unsigned i = 2; i < gep->getNumOperands() && node != NULL; ++i) {
+            ConstantInt *index = dyn_cast<ConstantInt>(gep->getOperand(i));
+            if (index == NULL) return NULL;
+            node = globals.findOffset(node, index->getSExtValue());
+        }
+        return node;
+    }
+
+    /// A struct or array with pointers in it.
+    static bool isNested(Type *type) {
+        return (type->isStructTy() || type->isArrayTy()) && holdsPointers(type);
+    }
+};
+
+#endif // GLOBAL_GRAPH_H
@@ -0,0 +1,296 @@
+#ifndef GRAPH_TRACE_H
+#define GRAPH_TRACE_H 1
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+namespace graph {
+
+class Node; // forward declaration
+
+/// The graph operations a trace records, with their operands. Graphs,
+/// nodes and values are numbered in the order the trace first sees them
+/// (per thread), from 1; 0 is NULL. Nodes 1 and 2 are the shared NIL and
+/// UNDEFINED leaves. A "node" operand is a node's contents: its status
+/// times 2 for a leaf, or the id of the node it references times 2 plus 1.
+enum TraceOp : uint8_t {
+    /** Graph::reset and construction: the graph's previous id (0 if it is
+     *  new), base graph; the graph gets the next id */
+    TRACE_RESET,
+
+    /** Graph::freeze: graph */
+    TRACE_FREEZE,
+
+    /** Graph::insertNode(Node): graph, node => result */
+    TRACE_INSERT,
+
+    /** Graph::insertNode(Value*, Node): graph, value, node => result */
+    TRACE_INSERT_ENTRY,
+
+    /** Graph::insertNode(Value*, Node*): graph, value, node id */
+    TRACE_SET_ENTRY,
+
+    /** Graph::getMutableNode: graph, value => result */
+    TRACE_MUTABLE,
+
+    /** Node::transformToRefNode: node id, referenced node id */
+    TRACE_TRANSFORM,
+
+    /** Graph::getOffset: graph, value, offset => result (0 if it failed) */
+    TRACE_OFFSET,
+
+    /** Graph::insertOffsetNode: graph, base node id, offset, node id */
+    TRACE_INSERT_OFFSET,
+
+    /** Graph::release: graph, value */
+    TRACE_RELEASE,
+
+    /** Graph::collect: graph */
+    TRACE_COLLECT,
+
+    /** Graph::setOffset: graph, base node id, offset, node => result */
+    TRACE_SET_OFFSET,
+
+    NUM_TRACE_OPS
+};
+
+/// Number of operands of `op`, after the op byte.
+inline unsigned traceOpOperands(TraceOp op) {
+    switch (op) {
+    case TRACE_FREEZE: case TRACE_COLLECT: return 1;
+    case TRACE_RESET: case TRACE_TRANSFORM: case TRACE_RELEASE: return 2;
+    case TRACE_INSERT: case TRACE_SET_ENTRY: case TRACE_MUTABLE: return 3;
+    case TRACE_INSERT_ENTRY: case TRACE_OFFSET: case TRACE_INSERT_OFFSET: return 4;
+    case TRACE_SET_OFFSET: return 5;
+    default: return 0;
+    }
+}
+
+inline const char *traceOpName(TraceOp op) {
+    switch (op) {
+    case TRACE_RESET: return "reset";
+    case TRACE_FREEZE: return "freeze";
+    case TRACE_INSERT: return "insert";
+    case TRACE_INSERT_ENTRY: return "insert-entry";
+    case TRACE_SET_ENTRY: return "set-entry";
+    case TRACE_MUTABLE: return "mutable";
+    case TRACE_TRANSFORM: return "transform";
+    case TRACE_OFFSET: return "offset";
+    case TRACE_INSERT_OFFSET: return "insert-offset";
+    case TRACE_RELEASE: return "release";
+    case TRACE_COLLECT: return "collect";
+    case TRACE_SET_OFFSET: return "set-offset";
+    default: return "???";
+    }
+}
+
+/// The file every thread's trace goes to: a magic string, then chunks of
+/// events, each a varint thread number, a varint length and the events
+/// (an op byte and varint operands, zigzag-encoded where signed).
+class TraceFile {
+public:
+    static StringRef magic() { return StringRef("NDTRACE\1", 8); }
+
+    TraceFile(StringRef path, std::error_code &ec) : os(path, ec, sys::fs::OF_None) {
+        if (!ec) os << magic();
+    }
+
+    /// Append a chunk of events of `thread`.
+    void write(unsigned thread, const uint8_t *events, size_t length) {
+        uint8_t header[20];
+        size_t size = encodeVarint(header, thread);
+        size += encodeVarint(header + size, length);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        os.write((const char*) header, size);
+        os.write((const char*) events, length);
+    }
+
+    unsigned newThread() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return ++threads;
+    }
+
+    static size_t encodeVarint(uint8_t *out, uint64_t value) {
+        size_t size = 0;
+        do {
+            uint8_t byte = value & 0x7f;
+            value >>= 7;
+            out[size++] = byte | (value != 0 ? 0x80 : 0);
+        } while (value != 0);
+        return size;
+    }
+
+private:
+    raw_fd_ostream os;
+    std::mutex mutex;
+    unsigned threads = 0;
+};
+
+/// Records the graph operations of one thread, while it is the thread's
+/// active trace. Events go to a fixed buffer, which is written to the
+/// file as a chunk when it fills up and when the trace stops: recording
+/// an operation is a few hash lookups and bytes, and no system call.
+///
+/// The graph calls the `record` functions when `active()` isn't NULL;
+/// nothing else is recorded.
+class Trace {
+    static const size_t BUFFER_BYTES = 1 << 16;
+    static const size_t MAX_EVENT_BYTES = 64;
+
+public:
+    /// Trace the graph operations of this thread into `file`, until `stop`.
+    /// `nil` and `undefined` are the shared leaves (see sharedLeaf).
+    static void start(TraceFile &file, const Node *nil, const Node *undefined) {
+        stop();
+        active() = new Trace(file, nil, undefined);
+    }
+
+    /// Write what is left of this thread's trace, and stop recording.
+    static void stop() {
+        Trace *&trace = active();
+        if (trace == NULL) return;
+        trace->flush();
+        delete trace;
+        trace = NULL;
+    }
+
+    /// The trace of this thread, or NULL if it isn't recording.
+    static Trace *&active() {
+        static thread_local Trace *trace = NULL;
+        return trace;
+    }
+
+    /// `node` was just allocated, possibly where another one was before.
+    void allocated(const Node *node) {
+        nodeIds[node] = ++lastNode;
+    }
+
+    /// `graph` was just constructed or reset, on top of `base`.
+    void recordReset(const void *graph, const void *base) {
+        uint64_t &id = graphIds[graph];
+        uint64_t previous = id;
+        id = ++lastGraph;
+        emit(TRACE_RESET, previous, graphId(base));
+    }
+
+    void recordFreeze(const void *graph) {
+        emit(TRACE_FREEZE, graphId(graph));
+    }
+
+    void recordInsert(const void *graph, uint64_t node, const Node *result) {
+        emit(TRACE_INSERT, graphId(graph), node, nodeId(result));
+    }
+
+    void recordInsertEntry(const void *graph, const void *value, uint64_t node, const Node *result) {
+        emit(TRACE_INSERT_ENTRY, graphId(graph), valueId(value), node, nodeId(result));
+    }
+
+    void recordSetEntry(const void *graph, const void *value, const Node *node) {
+        emit(TRACE_SET_ENTRY, graphId(graph), valueId(value), nodeId(node));
+    }
+
+    void recordMutable(const void *graph, const void *value, const Node *result) {
+        emit(TRACE_MUTABLE, graphId(graph), valueId(value), nodeId(result));
+    }
+
+    void recordTransform(const Node *node, const Node *referenced) {
+        emit(TRACE_TRANSFORM, nodeId(node), nodeId(referenced));
+    }
+
+    void recordOffset(const void *graph, const void *value, int64_t offset, const Node *result) {
+        emit(TRACE_OFFSET, graphId(graph), valueId(value), zigzag(offset), nodeId(result));
+    }
+
+    void recordInsertOffset(const void *graph, const Node *base, int64_t offset, const Node *node) {
+        emit(TRACE_INSERT_OFFSET, graphId(graph), nodeId(base), zigzag(offset), nodeId(node));
+    }
+
+    void recordRelease(const void *graph, const void *value) {
+        emit(TRACE_RELEASE, graphId(graph), valueId(value));
+    }
+
+    void recordCollect(const void *graph) {
+        emit(TRACE_COLLECT, graphId(graph));
+    }
+
+    void recordSetOffset(const void *graph, const Node *base, int64_t offset, uint64_t node, const Node *result) {
+        emit(TRACE_SET_OFFSET, graphId(graph), nodeId(base), zigzag(offset), node, nodeId(result));
+    }
+
+    /// The "node" operand for a leaf of `status`, or a reference to `referenced`.
+    static uint64_t leafOperand(unsigned status) { return status << 1; }
+    uint64_t refOperand(const Node *referenced) { return nodeId(referenced) << 1 | 1; }
+
+    static uint64_t zigzag(int64_t value) {
+        return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+    }
+
+private:
+    TraceFile &file;
+    unsigned thread;
+
+    std::unique_ptr<uint8_t[]> buffer;
+    size_t used = 0;
+
+    DenseMap<const void*, uint64_t> graphIds, valueIds;
+    DenseMap<const Node*, uint64_t> nodeIds;
+    uint64_t lastGraph = 0, lastValue = 0, lastNode = 2;
+
+    Trace(TraceFile &file, const Node *nil, const Node *undefined)
+            : file(file), thread(file.newThread()), buffer(new uint8_t[BUFFER_BYTES]) {
+        nodeIds[nil] = 1;
+        nodeIds[undefined] = 2;
+    }
+
+    uint64_t graphId(const void *graph) {
+        if (graph == NULL) return 0;
+        uint64_t &id = graphIds[graph];
+        if (id == 0) id = ++lastGraph;
+        return id;
+    }
+
+    uint64_t valueId(const void *value) {
+        if (value == NULL) return 0;
+        uint64_t &id = valueIds[value];
+        if (id == 0) id = ++lastValue;
+        return id;
+    }
+
+    /// A node allocated before the trace started gets an id here; a replay
+    /// doesn't know it.
+    uint64_t nodeId(const Node *node) {
+        if (node == NULL) return 0;
+        uint64_t &id = nodeIds[node];
+        if (id == 0) id = ++lastNode;
+        return id;
+    }
+
+    template <typename... Operands>
+    void emit(TraceOp op, Operands... operands) {
+        if (used + MAX_EVENT_BYTES > BUFFER_BYTES) flush();
+        buffer[used++] = op;
+        for (uint64_t operand : {(uint64_t) operands...}) {
+            used += TraceFile::encodeVarint(buffer.get() + used, operand);
+        }
+    }
+
+    void flush() {
+        if (used == 0) return;
+        file.write(thread, buffer.get(), used);
+        used = 0;
+    }
+};
+
+} // namespace graph
+
+#endif // GRAPH_TRACE_H
@@ -0,0 +1,35 @@
+#ifndef HEAP_MODEL_H
+#define HEAP_MODEL_H 1
+
+#include <llvm/IR/Function.h>
+#include <llvm/IR/InstrTypes.h>
+
+using namespace llvm;
+
+/// What a call does to the heap, as far as our analyses care.
+enum HeapCallKind {
+    /** Not an allocation function. */
+    NOT_HEAP_CALL,
+
+    /** Returns a new object, or NULL when it fails (malloc, calloc, realloc). */
+    ALLOCATES_MAYBE_NULL,
+
+    /** Returns a new object and never NULL (C++ operator new). */
+    ALLOCATES_NON_NIL,
+
+    /** Releases the object its first argument points to (free, delete). */
+    RELEASES
+};
+
+inline HeapCallKind heapCallKind(const CallBase &call) {
+    const Function *callee = call.getCalledFunction();
+    if (callee == NULL || !callee->isDeclaration()) return NOT_HEAP_CALL;
+
+    StringRef name = callee->getName();
+    if (name == "malloc" || name == "calloc" || name == "realloc") return ALLOCATES_MAYBE_NULL;
+    if (name == "_Znwm" || name == "_Znam" || name == "_Znwj" || name == "_Znaj") return ALLOCATES_NON_NIL;
+    if ((name == "free" || name == "_ZdlPv" || name == "_ZdaPv") && call.arg_size() >= 1) return RELEASES;
+    return NOT_HEAP_CALL;
+}
+
+#endif // HEAP_MODEL_H
@@ -0,0 +1,89 @@
+#ifndef LAST_USES_H
+#define LAST_USES_H 1
+
+#include <algorithm>
+#include <vector>
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+
+using std::vector;
+using namespace llvm;
+
+/// Where, visiting a function in layout order, each instruction is looked
+/// up for the last time: at its last user, or at itself if all its users
+/// come first. From then on the graph engine can forget it (see
+/// Visitor::release).
+///
+/// Some lookups see through pointer casts (the source of a memcpy, the
+/// pointer freed), so a value lives as long as the casts of it do.
+class LastUses {
+public:
+    /// Smaller functions aren't worth the bookkeeping: their graph is
+    /// small anyway.
+    static const unsigned MIN_INSTRUCTIONS = 1024;
+
+    LastUses(Function &function) {
+        for (Instruction &I : instructions(function)) {
+            positions[&I] = order.size();
+            order.push_back(&I);
+        }
+
+        // Counting sort of the instructions by the position they die at.
+        diesAt.assign(order.size(), (unsigned) NONE);
+        begin.assign(order.size() + 1, 0);
+        for (unsigned i = 0; i < order.size(); ++i) ++begin[lastUse(i) + 1];
+        for (unsigned i = 0; i < order.size(); ++i) begin[i + 1] += begin[i];
+
+        dying.resize(order.size());
+        vector<unsigned> next(begin.begin(), begin.end() - 1);
+        for (unsigned i = 0; i < order.size(); ++i) dying[next[diesAt[i]]++] = order[i];
+
+        positions.clear();
+        order.clear();
+        diesAt.clear();
+    }
+
+    /// The instructions last looked up by the instruction at `position`
+    /// (0-based, in layout order).
+    ArrayRef<Instruction*> dyingAt(unsigned position) const {
+        return makeArrayRef(dying).slice(begin[position], begin[position + 1] - begin[position]);
+    }
+
+private:
+    static const unsigned NONE = ~0u;
+
+    vector<unsigned> begin;
+    vector<Instruction*> dying;
+
+    /// Only while computing.
+    DenseMap<const Instruction*, unsigned> positions;
+    vector<Instruction*> order;
+    vector<unsigned> diesAt;
+
+    unsigned lastUse(unsigned i) {
+        if (diesAt[i] != NONE) return diesAt[i];
+
+        unsigned last = i;
+        for (User *user : order[i]->users()) {
+            auto it = positions.find(dyn_cast<Instruction>(user));
+            if (it == positions.end()) continue;
+
+            last = std::max(last, it->second);
+            if (isPointerCast(user)) last = std::max(last, lastUse(it->second));
+        }
+        return diesAt[i] = last;
+    }
+
+    /// The casts Value::stripPointerCasts sees through.
+    static bool isPointerCast(User *user) {
+        if (isa<BitCastInst>(user) || isa<AddrSpaceCastInst>(user)) return true;
+        GetElementPtrInst *gep = dyn_cast<GetElementPtrInst>(user);
+        return gep != NULL && gep->hasAllZeroIndices();
+    }
+};
+
+#endif // LAST_USES_H
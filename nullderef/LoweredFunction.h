@@ -0,0 +1,648 @@
+#ifndef LOWERED_FUNCTION_H
+#define LOWERED_FUNCTION_H 1
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DebugInfoMetadata.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "HeapModel.h"
+#include "PointerGraph.h"
+
+using std::vector;
+using namespace llvm;
+
+/// The pointer operations of a function that matter to the analyses.
+enum PtrOpcode : uint8_t {
+    /** slot `a` := status of value `b` */
+    OP_STORE_SLOT,
+
+    /** value `result` := slot `a` */
+    OP_LOAD_SLOT,
+
+    /** Dereference of value `a` (address with casts stripped) by a load of
+        `b`. If `result` isn't NONE, it gets the status of the loaded value. */
+    OP_LOAD,
+
+    /** Dereference of value `a` by a store. */
+    OP_STORE,
+
+    /** Dereference of value `a`, and of `b` unless it is NONE (memcpy & co). */
+    OP_CHECK,
+
+    /** value `result` := status of value `a` (casts, GEPs with constant indices) */
+    OP_COPY,
+
+    /** value `result` := DONT_KNOW (GEPs with unknown indices) */
+    OP_UNKNOWN,
+
+    /** value `result` := join of the values joined[a .. a+b) (phi, select) */
+    OP_JOIN,
+
+    /** free(value `a`); slot `b` holds that pointer, unless it is NONE. */
+    OP_FREE,
+
+    /** Call to a function with a body. The ids of its arguments are
+        joined[a .. a+b), NONE for those that aren't pointers. `result`
+        gets the status the callee returns, unless it is NONE. */
+    OP_CALL,
+
+    /** Return of the pointer value `a`. */
+    OP_RETURN
+};
+
+struct PtrOp {
+    PtrOpcode opcode;
+    unsigned result;
+    unsigned a, b;
+    Instruction *inst;
+};
+
+/// What lowering a function reads of its IR, copied into flat arrays in
+/// one walk over the instructions: no hashing, no lookups. The IR values
+/// it records are only compared from then on, never read, so the function
+/// may change or go away once the snapshot is taken (see
+/// BackgroundAnalysis). LoweredFunction does the rest from the snapshot.
+struct FunctionSnapshot {
+    enum Kind : uint8_t {
+        OTHER,   // no operands recorded
+        SLOT,    // trackable alloca of the entry block (see isTrackable)
+        STORE,   // value, address, address with casts stripped
+        LOAD,    // address, address with casts stripped
+        GEP,     // base pointer
+        CAST,    // operand
+        JOIN,    // incoming values of a pointer phi or select
+        MEM,     // destination, [source], with casts stripped
+        CALL,    // arguments of a call to a function with a body (NULL for non-pointers)
+        FREE,    // released pointer, with casts stripped
+        RETURN   // returned pointer
+    };
+
+    enum Flags : uint8_t {
+        POINTER = 1,           // the result is a pointer
+        CONSTANT_INDICES = 2,  // GEP with constant indices only
+        TRANSFER = 4           // MEM with a source (memcpy & co)
+    };
+
+    struct Operand {
+        Value *value;
+        uint8_t status; // fixedStatus(value)
+    };
+
+    struct Inst {
+        Instruction *inst;
+        Kind kind;
+        uint8_t flags;
+        uint8_t status;             // fixedStatus(inst)
+        unsigned begin, end;        // into `operands`
+        unsigned line;              // with `lines`, 0 without debug info
+    };
+
+    struct Block {
+        BasicBlock *block;
+        unsigned begin, end;                 // into `insts`
+        unsigned succBegin, succEnd;         // into `successors`
+        unsigned taken = ~0u;                // for a branch on a constant: the successor taken
+
+        /// For `br (p == NULL)` and `br (p != NULL)`: p, and its status on the first successor.
+        Operand tested = Operand{NULL, 0};
+        graph::LeafNodeType onFirst = graph::DONT_KNOW;
+    };
+
+    /// Every instruction in layout order, and every block.
+    vector<Inst> insts;
+    vector<Operand> operands;
+    vector<Block> blocks;
+    vector<BasicBlock*> successors;
+
+    /// With `text`: (index in `insts`, printed instruction) of those a
+    /// report can be about.
+    vector<std::pair<unsigned, std::string>> texts;
+
+    FunctionSnapshot(Function &function, bool lines = false, bool text = false) {
+        BasicBlock *entry = &function.getEntryBlock();
+        for (BasicBlock &BB : function) {
+            Block block;
+            block.block = &BB;
+            block.begin = insts.size();
+            for (Instruction &I : BB) take(I, &BB == entry, lines, text);
+            block.end = insts.size();
+            takeTerminator(block);
+            blocks.push_back(block);
+        }
+    }
+
+    /// The status of `value` before any analysis, as graph::LeafNodeType
+    /// bits; 0 for values the analysis computes.
+    static unsigned fixedStatus(Value *value) {
+        if (isa<UndefValue>(value)) return graph::DONT_KNOW;
+        if (Constant *c = dyn_cast<Constant>(value)) {
+            // An extern_weak global is NULL when nothing defines it.
+            GlobalValue *global = dyn_cast<GlobalValue>(c->stripPointerCasts());
+            if (global != NULL && global->hasExternalWeakLinkage()) return graph::DONT_KNOW;
+            return c->isNullValue() ? graph::NIL : graph::NON_NIL;
+        }
+        if (isa<AllocaInst>(value)) return graph::NON_NIL;
+        if (CallBase *call = dyn_cast<CallBase>(value)) {
+            if (heapCallKind(*call) == ALLOCATES_NON_NIL) return graph::NON_NIL;
+            if (definedCallee(*call) != NULL) return 0;
+        }
+        if (isa<LoadInst>(value) || isa<GetElementPtrInst>(value) || isa<BitCastInst>(value)
+                || isa<AddrSpaceCastInst>(value) || isa<PHINode>(value) || isa<SelectInst>(value)) {
+            return 0;
+        }
+        return graph::DONT_KNOW;
+    }
+
+    /// The function `call` calls, if it has a body we can analyse.
+    static Function *definedCallee(const CallBase &call) {
+        Function *callee = call.getCalledFunction();
+        return callee != NULL && !callee->isDeclaration() ? callee : NULL;
+    }
+
+private:
+    /// Pointer-typed allocas that are only ever loaded from or stored to
+    /// directly.
+    static bool isTrackable(AllocaInst *alloca) {
+        if (!alloca->getAllocatedType()->isPointerTy() || alloca->isArrayAllocation()) return false;
+
+        for (User *user : alloca->users()) {
+            if (isa<LoadInst>(user)) continue;
+
+            StoreInst *store = dyn_cast<StoreInst>(user);
+            if (store != NULL && store->getPointerOperand() == alloca
+                    && store->getValueOperand() != alloca) {
+                continue;
+            }
+            return false;
+        }
+        return true;
+    }
+
+    void add(Value *value) {
+        operands.push_back(Operand{value, (uint8_t) (value != NULL ? fixedStatus(value) : 0)});
+    }
+
+    void take(Instruction &I, bool inEntry, bool lines, bool text) {
+        Inst rec{&I, OTHER, 0, (uint8_t) fixedStatus(&I), (unsigned) operands.size(), 0, 0};
+        if (I.getType()->isPointerTy()) rec.flags |= POINTER;
+
+        if (StoreInst *store = dyn_cast<StoreInst>(&I)) {
+            rec.kind = STORE;
+            add(store->getValueOperand());
+            add(store->getPointerOperand());
+            add(store->getPointerOperand()->stripPointerCasts());
+        }
+        else if (LoadInst *load = dyn_cast<LoadInst>(&I)) {
+            rec.kind = LOAD;
+            add(load->getPointerOperand());
+            add(load->getPointerOperand()->stripPointerCasts());
+        }
+        else if (GetElementPtrInst *gep = dyn_cast<GetElementPtrInst>(&I)) {
+            rec.kind = GEP;
+            if (gep->hasAllConstantIndices()) rec.flags |= CONSTANT_INDICES;
+            add(gep->getPointerOperand());
+        }
+        else if (isa<BitCastInst>(&I) || isa<AddrSpaceCastInst>(&I)) {
+            rec.kind = CAST;
+            add(I.getOperand(0));
+        }
+        else if (PHINode *phi = dyn_cast<PHINode>(&I)) {
+            if (phi->getType()->isPointerTy()) {
+                rec.kind = JOIN;
+                for (Value *incoming : phi->incoming_values()) add(incoming);
+            }
+        }
+        else if (SelectInst *select = dyn_cast<SelectInst>(&I)) {
+            if (select->getType()->isPointerTy()) {
+                rec.kind = JOIN;
+                add(select->getTrueValue());
+                add(select->getFalseValue());
+            }
+        }
+        else if (MemIntrinsic *mem = dyn_cast<MemIntrinsic>(&I)) {
+            rec.kind = MEM;
+            add(mem->getDest()->stripPointerCasts());
+            if (MemTransferInst *transfer = dyn_cast<MemTransferInst>(mem)) {
+                rec.flags |= TRANSFER;
+                add(transfer->getSource()->stripPointerCasts());
+            }
+        }
+        else if (CallBase *call = dyn_cast<CallBase>(&I)) {
+            if (Function *callee = definedCallee(*call)) {
+                rec.kind = CALL;
+                unsigned count = std::min((unsigned) call->arg_size(), (unsigned) callee->arg_size());
+                for (unsigned i = 0; i < count; ++i) {
+                    Value *arg = call->getArgOperand(i);
+                    add(arg->getType()->isPointerTy() ? arg : NULL);
+                }
+            } else if (heapCallKind(*call) == RELEASES) {
+                rec.kind = FREE;
+                add(call->getArgOperand(0)->stripPointerCasts());
+            }
+        }
+        else if (ReturnInst *ret = dyn_cast<ReturnInst>(&I)) {
+            Value *value = ret->getReturnValue();
+            if (value != NULL && value->getType()->isPointerTy()) {
+                rec.kind = RETURN;
+                add(value);
+            }
+        }
+        else if (AllocaInst *alloca = dyn_cast<AllocaInst>(&I)) {
+            if (inEntry && isTrackable(alloca)) rec.kind = SLOT;
+        }
+
+        rec.end = operands.size();
+        if (lines) {
+            if (DILocation *loc = I.getDebugLoc()) rec.line = loc->getLine();
+        }
+        if (text && (rec.kind == STORE || rec.kind == LOAD || rec.kind == MEM
+                     || rec.kind == CALL || rec.kind == FREE)) {
+            std::string printed;
+            raw_string_ostream rso(printed);
+            I.print(rso);
+            texts.push_back(std::make_pair((unsigned) insts.size(), rso.str()));
+        }
+        insts.push_back(rec);
+    }
+
+    void takeTerminator(Block &block) {
+        Instruction *term = block.block->getTerminator();
+        block.succBegin = successors.size();
+        for (BasicBlock *succ : llvm::successors(block.block)) successors.push_back(succ);
+        block.succEnd = successors.size();
+
+        BranchInst *br = dyn_cast<BranchInst>(term);
+        if (br == NULL || !br->isConditional()) return;
+        if (ConstantInt *c = dyn_cast<ConstantInt>(br->getCondition())) {
+            block.taken = c->isZero() ? 1 : 0;
+            return;
+        }
+
+        // Look for `p == NULL` or `p != NULL`, possibly negated.
+        Value *cond = br->getCondition();
+        bool negated = false;
+        BinaryOperator *bin = dyn_cast<BinaryOperator>(cond);
+        if (bin != NULL && bin->getOpcode() == Instruction::Xor) {
+            ConstantInt *rhs = dyn_cast<ConstantInt>(bin->getOperand(1));
+            if (rhs != NULL && rhs->isOne()) {
+                cond = bin->getOperand(0);
+                negated = true;
+            }
+        }
+
+        ICmpInst *cmp = dyn_cast<ICmpInst>(cond);
+        Value *tested = NULL;
+        if (cmp != NULL && cmp->isEquality()) {
+            if (isa<ConstantPointerNull>(cmp->getOperand(1))) tested = cmp->getOperand(0);
+            else if (isa<ConstantPointerNull>(cmp->getOperand(0))) tested = cmp->getOperand(1);
+        }
+        if (tested == NULL) return;
+
+        bool trueIsNil = (cmp->getPredicate() == ICmpInst::ICMP_EQ) != negated;
+        block.tested = Operand{tested, (uint8_t) fixedStatus(tested)};
+        block.onFirst = trueIsNil ? graph::NIL : graph::NON_NIL;
+    }
+};
+
+/// A function lowered, once, to what the flow engine needs of it: a
+/// contiguous array of PtrOps per block, with dense ids for the values
+/// and slots they use, and the edges between the blocks. Iterating over
+/// it to a fixpoint doesn't touch the IR again: no linked lists, no
+/// visitor dispatch over all kinds of instructions, no hash lookups.
+///
+/// It is built from a FunctionSnapshot, and doesn't read the IR either:
+/// the values, slots, blocks and instructions it refers to are only
+/// compared.
+///
+/// Values get ids in the order they are first used. Constants, globals,
+/// allocas, arguments and the results of calls to declarations have a
+/// fixed status (`initialStatus`); the results of loads, casts, GEPs,
+/// phis, selects and calls to functions with a body are computed by the
+/// analysis and start at 0, i.e. not evaluated yet.
+class LoweredFunction {
+public:
+    static const unsigned NONE = ~0u;
+
+    struct Block {
+        BasicBlock *block;
+        unsigned opBegin, opEnd;
+        unsigned succBegin, succEnd;   // into `edges`
+
+        /// For `br (p == NULL)` and `br (p != NULL)`: the value tested, the
+        /// slot holding it (or NONE) and the status on the first successor.
+        unsigned tested = NONE;
+        unsigned testedSlot = NONE;
+        graph::LeafNodeType onFirst = graph::DONT_KNOW;
+    };
+
+    /// Slots: pointer-typed allocas of the entry block that are only ever
+    /// loaded from or stored to directly.
+    vector<AllocaInst*> slots;
+
+    /// Blocks in reverse post-order; unreachable blocks are left out.
+    vector<Block> blocks;
+    vector<unsigned> edges;
+
+    vector<PtrOp> ops;
+    vector<unsigned> joined;
+
+    /// Per value id: the value, its status before the analysis, and the
+    /// blocks whose operations read it while iterating (usersBegin[id] ..
+    /// usersBegin[id+1] in `users`).
+    vector<Value*> values;
+    vector<unsigned> initialStatus;
+    vector<unsigned> usersBegin;
+    vector<unsigned> users;
+
+    LoweredFunction(Function &function) {
+        FunctionSnapshot snapshot(function);
+        lowerFrom(snapshot);
+    }
+
+    LoweredFunction(const FunctionSnapshot &snapshot) {
+        lowerFrom(snapshot);
+    }
+
+    unsigned numSlots() const { return slots.size(); }
+
+    /// The id of `value`, or NONE if no operation uses it.
+    unsigned idOf(Value *value) const {
+        auto it = valueIds.find(value);
+        return it == valueIds.end() ? NONE : it->second;
+    }
+
+    /// The id of `BB` in `blocks`, or NONE if it is unreachable.
+    unsigned blockOf(BasicBlock *BB) const {
+        auto it = blockIds.find(BB);
+        return it == blockIds.end() ? NONE : it->second;
+    }
+
+    /// See FunctionSnapshot::definedCallee.
+    static Function *definedCallee(const CallBase &call) {
+        return FunctionSnapshot::definedCallee(call);
+    }
+
+    /// See FunctionSnapshot::fixedStatus.
+    static unsigned fixedStatus(Value *value) {
+        return FunctionSnapshot::fixedStatus(value);
+    }
+
+private:
+    typedef FunctionSnapshot::Operand Operand;
+
+    /// Only while lowering: the snapshot doesn't outlive the constructor.
+    const FunctionSnapshot *snapshot = NULL;
+    DenseMap<const Value*, unsigned> positions; // instruction => index in snapshot->insts
+    unsigned blockBegin;                         // of the block being lowered, in snapshot->insts
+
+    DenseMap<Value*, unsigned> slotIds;
+    DenseMap<BasicBlock*, unsigned> blockIds;
+    DenseMap<Value*, unsigned> valueIds;
+
+    /// While lowering: the block being lowered, and (value, block) for
+    /// every computed value the fixpoint reads.
+    unsigned current;
+    vector<std::pair<unsigned, unsigned>> reads;
+
+    /// Build everything above from `source`.
+    void lowerFrom(const FunctionSnapshot &source) {
+        snapshot = &source;
+        for (unsigned i = 0; i < snapshot->insts.size(); ++i) {
+            positions[snapshot->insts[i].inst] = i;
+        }
+
+        const FunctionSnapshot::Block &entry = snapshot->blocks[0];
+        for (unsigned i = entry.begin; i < entry.end; ++i) {
+            if (snapshot->insts[i].kind != FunctionSnapshot::SLOT) continue;
+            slotIds[snapshot->insts[i].inst] = slots.size();
+            slots.push_back(static_cast<AllocaInst*>(snapshot->insts[i].inst));
+        }
+
+        vector<unsigned> order = reversePostOrder();
+        for (unsigned s : order) {
+            blockIds[snapshot->blocks[s].block] = blocks.size();
+            blocks.push_back(Block());
+            blocks.back().block = snapshot->blocks[s].block;
+        }
+
+        for (current = 0; current < blocks.size(); ++current) {
+            const FunctionSnapshot::Block &from = snapshot->blocks[order[current]];
+            Block &block = blocks[current];
+            blockBegin = from.begin;
+            block.opBegin = ops.size();
+            for (unsigned i = from.begin; i < from.end; ++i) lower(i);
+            block.opEnd = ops.size();
+            lowerTerminator(block, from);
+        }
+
+        indexUsers();
+
+        positions.clear();
+        snapshot = NULL;
+    }
+
+    /// The blocks of the snapshot reachable from the entry, in reverse
+    /// post-order, the same as ReversePostOrderTraversal would give.
+    vector<unsigned> reversePostOrder() const {
+        DenseMap<BasicBlock*, unsigned> index;
+        for (unsigned b = 0; b < snapshot->blocks.size(); ++b) index[snapshot->blocks[b].block] = b;
+
+        vector<unsigned> order;
+        vector<bool> visited(snapshot->blocks.size());
+        vector<std::pair<unsigned, unsigned>> stack; // block, next successor
+        visited[0] = true;
+        stack.push_back(std::make_pair(0, snapshot->blocks[0].succBegin));
+        while (!stack.empty()) {
+            unsigned b = stack.back().first;
+            unsigned next = stack.back().second;
+            if (next == snapshot->blocks[b].succEnd) {
+                order.push_back(b);
+                stack.pop_back();
+                continue;
+            }
+            ++stack.back().second;
+            unsigned succ = index[snapshot->successors[next]];
+            if (!visited[succ]) {
+                visited[succ] = true;
+                stack.push_back(std::make_pair(succ, snapshot->blocks[succ].succBegin));
+            }
+        }
+        std::reverse(order.begin(), order.end());
+        return order;
+    }
+
+    unsigned slotOf(Value *value) const {
+        auto it = slotIds.find(value);
+        return it == slotIds.end() ? NONE : it->second;
+    }
+
+    unsigned id(Value *value, unsigned status) {
+        auto it = valueIds.find(value);
+        if (it != valueIds.end()) return it->second;
+
+        unsigned id = values.size();
+        valueIds[value] = id;
+        values.push_back(value);
+        initialStatus.push_back(status);
+        return id;
+    }
+
+    unsigned id(const Operand &op) {
+        return id(op.value, op.status);
+    }
+
+    /// The id of the result of instruction `i`.
+    unsigned result(unsigned i) {
+        return id(snapshot->insts[i].inst, snapshot->insts[i].status);
+    }
+
+    /// The id of `op`, which the fixpoint reads in the current block.
+    unsigned use(const Operand &op) {
+        unsigned v = id(op);
+        if (initialStatus[v] == 0) reads.push_back(std::make_pair(v, current));
+        return v;
+    }
+
+    void emit(PtrOpcode opcode, unsigned i, unsigned result, unsigned a, unsigned b = NONE) {
+        ops.push_back(PtrOp{opcode, result, a, b, snapshot->insts[i].inst});
+    }
+
+    void lower(unsigned i) {
+        const FunctionSnapshot::Inst &rec = snapshot->insts[i];
+        const Operand *op = snapshot->operands.data() + rec.begin;
+        unsigned count = rec.end - rec.begin;
+
+        switch (rec.kind) {
+        case FunctionSnapshot::STORE: {
+            unsigned slot = slotOf(op[1].value);
+            if (slot != NONE) emit(OP_STORE_SLOT, i, NONE, slot, use(op[0]));
+            else emit(OP_STORE, i, NONE, id(op[2]));
+            break;
+        }
+
+        case FunctionSnapshot::LOAD: {
+            unsigned slot = slotOf(op[0].value);
+            if (slot != NONE) emit(OP_LOAD_SLOT, i, result(i), slot);
+            else if (rec.flags & FunctionSnapshot::POINTER) emit(OP_LOAD, i, result(i), id(op[1]), use(op[0]));
+            else emit(OP_LOAD, i, NONE, id(op[1]), id(op[0]));
+            break;
+        }
+
+        case FunctionSnapshot::GEP:
+            // Same as the Visitor: a field of X has the status of X, unless
+            // we can't tell which field it is.
+            if (rec.flags & FunctionSnapshot::CONSTANT_INDICES) emit(OP_COPY, i, result(i), use(op[0]));
+            else emit(OP_UNKNOWN, i, result(i), NONE);
+            break;
+
+        case FunctionSnapshot::CAST:
+            emit(OP_COPY, i, result(i), use(op[0]));
+            break;
+
+        case FunctionSnapshot::JOIN: {
+            unsigned begin = joined.size();
+            for (unsigned k = 0; k < count; ++k) joined.push_back(use(op[k]));
+            emit(OP_JOIN, i, result(i), begin, count);
+            break;
+        }
+
+        case FunctionSnapshot::MEM:
+            emit(OP_CHECK, i, NONE, id(op[0]), (rec.flags & FunctionSnapshot::TRANSFER) ? id(op[1]) : NONE);
+            break;
+
+        case FunctionSnapshot::CALL: {
+            unsigned begin = joined.size();
+            bool pointers = rec.flags & FunctionSnapshot::POINTER;
+            for (unsigned k = 0; k < count; ++k) {
+                joined.push_back(op[k].value != NULL ? use(op[k]) : NONE);
+                pointers |= op[k].value != NULL;
+            }
+            if (!pointers) {
+                joined.resize(begin);
+                break;
+            }
+            emit(OP_CALL, i, (rec.flags & FunctionSnapshot::POINTER) ? result(i) : NONE, begin, count);
+            break;
+        }
+
+        case FunctionSnapshot::FREE:
+            emit(OP_FREE, i, NONE, id(op[0]), slotHolding(op[0], i));
+            break;
+
+        case FunctionSnapshot::RETURN:
+            emit(OP_RETURN, i, NONE, id(op[0]));
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    void lowerTerminator(Block &block, const FunctionSnapshot::Block &from) {
+        block.succBegin = edges.size();
+        if (from.taken != NONE) {
+            edges.push_back(blockOf(snapshot->successors[from.succBegin + from.taken]));
+            block.succEnd = edges.size();
+            return;
+        }
+
+        if (from.tested.value != NULL) {
+            block.tested = use(from.tested);
+            block.testedSlot = slotHolding(from.tested, from.end - 1);
+            block.onFirst = from.onFirst;
+        }
+
+        for (unsigned e = from.succBegin; e < from.succEnd; ++e) {
+            edges.push_back(blockOf(snapshot->successors[e]));
+        }
+        block.succEnd = edges.size();
+    }
+
+    /// If `value` was loaded from a slot earlier in the block being
+    /// lowered, before instruction `at`, and the slot isn't overwritten in
+    /// between, then the slot still holds `value` at `at`. Returns that
+    /// slot, or NONE.
+    unsigned slotHolding(const Operand &value, unsigned at) const {
+        auto it = positions.find(value.value);
+        if (it == positions.end()) return NONE;
+
+        unsigned load = it->second;
+        const FunctionSnapshot::Inst &rec = snapshot->insts[load];
+        if (rec.kind != FunctionSnapshot::LOAD || load < blockBegin || load >= at) return NONE;
+
+        unsigned slot = slotOf(snapshot->operands[rec.begin].value);
+        if (slot == NONE) return NONE;
+
+        for (unsigned i = load + 1; i < at; ++i) {
+            const FunctionSnapshot::Inst &between = snapshot->insts[i];
+            if (between.kind == FunctionSnapshot::STORE
+                    && snapshot->operands[between.begin + 1].value == slots[slot]) {
+                return NONE;
+            }
+        }
+        return slot;
+    }
+
+    /// Turn `reads` into the `users` lists, with a counting sort.
+    void indexUsers() {
+        usersBegin.assign(values.size() + 1, 0);
+        for (auto &r : reads) ++usersBegin[r.first + 1];
+        for (unsigned v = 0; v < values.size(); ++v) usersBegin[v + 1] += usersBegin[v];
+
+        users.resize(reads.size());
+        vector<unsigned> next(usersBegin.begin(), usersBegin.end() - 1);
+        for (auto &r : reads) users[next[r.first]++] = r.second;
+        reads.clear();
+    }
+};
+
+#endif // LOWERED_FUNCTION_H
@@ -0,0 +1,76 @@
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "NullDereference.h"
+#include "Driver.h"
+
+using namespace llvm;
+
+/// Everything an AnalysisContext keeps from one function to the next.
+struct AnalysisContext::State {
+    AnalysisConfig config;
+
+    /// The module the analyses below are about, NULL after a reset.
+    Module *module = NULL;
+    std::unique_ptr<PointsTo> pointsTo;
+    std::unique_ptr<GlobalGraph> globals;
+    std::unique_ptr<CallContexts> contexts;
+    std::unique_ptr<Triage> triage;
+
+    Visitor workspace;
+    std::vector<Diagnostic> diagnostics;
+
+    State(const AnalysisConfig &config) : config(config) {}
+
+    void enter(Module &next) {
+        workspace.reset();
+        triage.reset();
+        globals.reset();
+        pointsTo.reset();
+        if (contexts) contexts->clear();
+
+        module = &next;
+        if (config.pointsTo) pointsTo.reset(new PointsTo(next, config.wholeProgram));
+        globals.reset(new GlobalGraph(next, pointsTo.get()));
+        if (config.contextDepth > 0 && !contexts) contexts.reset(new CallContexts(config.contextDepth));
+        if (config.tiered) triage.reset(new Triage(pointsTo.get(), contexts != NULL));
+    }
+};
+
+AnalysisContext::AnalysisContext(const AnalysisConfig &config) : state(new State(config)) {}
+
+AnalysisContext::~AnalysisContext() = default;
+
+const std::vector<Diagnostic> &AnalysisContext::analyze(Function &function) {
+    State &s = *state;
+    s.diagnostics.clear();
+    if (function.getParent() != s.module) s.enter(*function.getParent());
+
+    AnalysisOptions options;
+    options.engine = s.config.engine;
+    options.budget = s.config.budget;
+    options.contexts = s.contexts.get();
+    options.globals = s.globals.get();
+    options.workspace = &s.workspace;
+    options.diagnostics = &s.diagnostics;
+    options.triage = s.triage.get();
+
+    // The diagnostics are the output; what the pass would print is dropped.
+    analyzeFunction(function, options, s.pointsTo.get(), nulls());
+    return s.diagnostics;
+}
+
+void AnalysisContext::reset() {
+    State &s = *state;
+    s.workspace.reset();
+    s.triage.reset();
+    s.globals.reset();
+    s.pointsTo.reset();
+    if (s.contexts) s.contexts->clear();
+    s.diagnostics.clear();
+    s.module = NULL;
+}
+
+size_t AnalysisContext::capacity() const {
+    return state->workspace.graphCapacity();
+}
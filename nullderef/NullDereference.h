@@ -0,0 +1,123 @@
+#ifndef NULL_DEREFERENCE_H
+#define NULL_DEREFERENCE_H 1
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace llvm {
+class Function;
+class Instruction;
+}
+
+// The API of the NullDereference library, for tools that run the analysis
+// themselves rather than loading the pass into opt. Only this header is
+// part of the API; the analyses behind it (Driver.h and what it includes)
+// may change from one version to the next. It includes no LLVM header and
+// nothing of the analyses: the types they share with it are defined here.
+
+enum Engine { GraphEngine, FlowEngine, MemorySSAEngine, DemandEngine };
+
+enum ErrorCode {
+    /** All is well. */
+    OK = 0,
+
+    /** An invalid value has been dereferenced. */
+    DEREF = 16,
+
+    /** A null value has been dereferenced. */
+    NULL_DEREF = DEREF | 1,
+
+    /** An undefined value has been dereferenced. */
+    UNDEFINED_DEREF = DEREF | 2,
+
+    /** Something went wrong, but we aren't sure exactly what went wrong. */
+    ERROR = 32,
+
+    /** We expected a key/value pair in our map, but we couldn't it. */
+    MISSED_DEFINITION = ERROR | 1
+};
+
+/// Limits on the work spent on a single function. Zero means unlimited.
+struct AnalysisBudget {
+    /** Maximum number of nodes in the pointer graph, or of answers kept
+        by the mssa and demand engines. The flow engine has neither: its
+        states have a bit per slot and block, known before it starts, and
+        it ignores this limit. */
+    size_t maxNodes = 0;
+
+    /** Maximum number of steps: visited instructions for the graph
+        engine, visited blocks (fixpoint iterations) for the flow engine. */
+    size_t maxSteps = 0;
+
+    /** Maximum wall-clock time, in milliseconds. */
+    unsigned maxMillis = 0;
+
+    bool unlimited() const {
+        return maxNodes == 0 && maxSteps == 0 && maxMillis == 0;
+    }
+};
+
+/// A dereference the analysis found to be wrong.
+struct Diagnostic {
+    /** NULL_DEREF or UNDEFINED_DEREF. */
+    ErrorCode code;
+
+    /** The instruction that dereferences the pointer. */
+    llvm::Instruction *instruction;
+};
+
+/// How an AnalysisContext analyses functions.
+struct AnalysisConfig {
+    Engine engine = GraphEngine;
+
+    /** Run the module-wide points-to analysis for arguments and globals. */
+    bool pointsTo = true;
+
+    /** The modules are whole programs: the points-to analysis may assume
+        that their external functions and globals are only used by them. */
+    bool wholeProgram = false;
+
+    /** Analyse callees per calling context, up to this many calls deep. */
+    unsigned contextDepth = 0;
+
+    /** Skip the functions the tier-0 scan finds trivially safe (see Triage.h). */
+    bool tiered = false;
+
+    AnalysisBudget budget;
+};
+
+/// Analyses functions one after the other, keeping what it allocated for
+/// the previous function (the nodes and maps of the pointer graph, the
+/// list of diagnostics) for the next one, so that a long-running tool
+/// stops allocating once it has seen its largest function. The module-wide
+/// analyses are computed on the first function of each module.
+///
+/// A context isn't thread-safe: give each thread its own. Contexts of
+/// different threads must not analyse modules of the same LLVMContext, as
+/// tracking values registers handles in it.
+class AnalysisContext {
+public:
+    explicit AnalysisContext(const AnalysisConfig &config = AnalysisConfig());
+    ~AnalysisContext();
+
+    AnalysisContext(const AnalysisContext&) = delete;
+    AnalysisContext &operator=(const AnalysisContext&) = delete;
+
+    /// Analyse `function`. The diagnostics are valid until the next call
+    /// to `analyze` or `reset`.
+    const std::vector<Diagnostic> &analyze(llvm::Function &function);
+
+    /// Forget the module analysed so far, keeping the memory for the next
+    /// one. Call it before the module is destroyed.
+    void reset();
+
+    /// Number of graph nodes the context holds without allocating.
+    size_t capacity() const;
+
+private:
+    struct State;
+    std::unique_ptr<State> state;
+};
+
+#endif // NULL_DEREFERENCE_H
@@ -6,19 +6,67 @@
 #include <llvm/IR/InstIterator.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/IR/LegacyPassManager.h>
+#include <llvm/Analysis/AliasAnalysis.h>
+#include <llvm/Analysis/MemorySSA.h>
 #include <llvm/Transforms/IPO/PassManagerBuilder.h>
 
 #include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+
+#include <memory>
 
 #include "ErrorCode.h"
 //#include "ConditionalAnalyzer.h"
 
-#include "Visitor.h"
+#include "Driver.h"
+#include "NullnessInfo.h"
+#include "BackgroundAnalysis.h"
+#include "ShardedAnalysis.h"
 
 using namespace llvm;
 static cl::opt<bool> testOutputEnabled("t", cl::desc("Enable output information for testing purposes"));
 static cl::opt<bool> debugOutputEnabled("d", cl::desc("Enable output information for debugging purposes"));
 
+static cl::opt<Engine> engine("engine", cl::desc("Analysis engine to use"), cl::init(GraphEngine),
+    cl::values(clEnumValN(GraphEngine, "graph", "Single walk over the pointer graph (default)"),
+               clEnumValN(FlowEngine, "flow", "Flow-sensitive dataflow analysis over bit-vector states"),
+               clEnumValN(MemorySSAEngine, "mssa", "Resolve each load through MemorySSA to the stores it reads"),
+               clEnumValN(DemandEngine, "demand", "Walk back from each dereference only as far as its answer needs")));
+
+static cl::opt<std::string> queryLinesText("query-lines", cl::value_desc("lines"),
+    cl::desc("With -engine=demand, only check the dereferences on these source lines (e.g. 12,40-45)"));
+static cl::opt<bool> pointsToEnabled("points-to", cl::init(true),
+    cl::desc("Use a module-wide points-to analysis for arguments and globals (default: on)"));
+static cl::opt<bool> wholeProgram("whole-program",
+    cl::desc("The module is the whole program (e.g. after LTO): its external functions and globals are only used by it"));
+static cl::opt<unsigned> maxNodes("max-nodes", cl::init(0),
+    cl::desc("Give up on a function once its pointer graph has this many nodes (0: no limit; not with -engine=flow)"));
+static cl::opt<unsigned> maxSteps("max-steps", cl::init(0),
+    cl::desc("Give up on a function after this many visited instructions or blocks (0: no limit)"));
+static cl::opt<unsigned> maxMillis("max-ms", cl::init(0),
+    cl::desc("Give up on a function after this many milliseconds (0: no limit)"));
+static cl::opt<bool> annotateEnabled("annotate", cl::desc("Attach nonnull/dereferenceable attributes and !nonnull metadata proven by the analysis"));
+static cl::opt<bool> perfEnabled("perf",
+    cl::desc("Report hardware counters (or time only, if unavailable) for each function"));
+static cl::opt<unsigned> contextDepth("context-depth", cl::init(0),
+    cl::desc("Analyse callees per nullness of their pointer arguments, up to this many calls deep (0: off)"));
+static cl::opt<bool> tieredEnabled("tiered",
+    cl::desc("Scan each function first: skip the trivially safe ones, run -engine only where it can matter"));
+static cl::opt<bool> backgroundEnabled("background",
+    cl::desc("Run the flow engine on a background thread and print its diagnostics at the end of the module"));
+static cl::opt<unsigned> shardCount("shards", cl::init(0),
+    cl::desc("Analyse the functions in this many forked workers, retrying the ones a worker dies on (0: off)"));
+static cl::opt<unsigned> shardMemory("shard-memory", cl::init(0), cl::value_desc("MB"),
+    cl::desc("With -shards, kill a worker with more than this many MB of its own (0: no limit)"));
+static cl::opt<std::string> summaryIndex("summary-index", cl::value_desc("file"),
+    cl::desc("Write the nullness summaries of this module to <file>, for nullderef-link"));
+static cl::opt<unsigned> releaseMinInstructions("release-min-instructions", cl::init((unsigned) LastUses::MIN_INSTRUCTIONS),
+    cl::Hidden, cl::desc("Forget values after their last use in functions of at least this many instructions"));
+static cl::opt<unsigned> collectMinNodes("collect-min-nodes", cl::init((unsigned) Graph::MIN_COLLECTION), cl::Hidden,
+    cl::desc("Reclaim the graph nodes nothing reaches once there are this many (0: after every instruction)"));
+static cl::opt<std::string> tracePath("trace", cl::value_desc("file"),
+    cl::desc("Record the pointer graph operations to <file>, for nullderef-replay"));
+
 /*
  * An LLVM pass that statically detects null dereferences.
  *
@@ -31,55 +79,317 @@ static cl::opt<bool> debugOutputEnabled("d", cl::desc("Enable output information
 
 namespace {
 
+/// A module whose -background worker may still be running, and what the
+/// pass prints after the worker's diagnostics.
+struct PendingModule {
+    std::unique_ptr<BackgroundAnalysis> background;
+    std::string name;
+    bool budgeted = false;
+    bool tiered = false;
+    unsigned tierCounts[3];
+
+    /// Wait for the worker, then print its diagnostics and the end of the
+    /// module's output.
+    void finish(raw_ostream &os) {
+        unsigned functionsOverBudget = background->join(os);
+        background.reset();
+        if (budgeted) {
+            os << "Functions over budget in " << name << ": " << functionsOverBudget << "\n";
+        }
+        if (tiered) {
+            os << "Tiers in " << name << ": " << tierCounts[TRIVIALLY_SAFE] << " trivially safe, "
+               << tierCounts[LOCAL] << " local, " << tierCounts[DEEP] << " deep\n";
+        }
+    }
+};
+
+/// Left by the pass for BackgroundJoin, when it runs from clang.
+static std::unique_ptr<PendingModule> pendingModule;
+
 struct NullDereferenceDetection : public FunctionPass {
     static char ID;
-    NullDereferenceDetection() : FunctionPass(ID) {}
 
-    bool runOnFunction(Function &function) override {
-        size_t instNumber = 0;
-        Visitor visitor;
+    /// With `joinLater`, a -background worker is left running at the end
+    /// of the module, for BackgroundJoin to wait for.
+    NullDereferenceDetection(bool joinLater = false) : FunctionPass(ID), joinLater(joinLater) {}
+
+    bool joinLater;
+
+    /// Number of attributes and metadata nodes added to the current module.
+    unsigned annotationsAdded = 0;
+
+    /// Module-wide points-to analysis, computed once per module.
+    std::unique_ptr<PointsTo> pointsTo;
+
+    /// The globals of the module, the shared base of every function's graph.
+    std::unique_ptr<GlobalGraph> globals;
+
+    /// How to analyse each function, from the command line options.
+    AnalysisOptions options;
+
+    /// Visits every function, in the graph memory left by the previous one.
+    Visitor workspace;
+
+    /// Number of functions that ran out of budget.
+    unsigned functionsOverBudget = 0;
+
+    /// Hardware counters for -perf, and what all functions cost together.
+    std::unique_ptr<PerfCounters> counters;
+    PerfSample visitTotal, teardownTotal, dumpTotal;
 
-        errs() << "\n";
+    /// Callee results per calling context, if -context-depth is given.
+    std::unique_ptr<CallContexts> contexts;
 
-        for (BasicBlock &BB : function) { // [1]
-            for (Instruction &I : BB) { // [1], little lower
-                ErrorCode result;
+    /// The worker of -background, if it can be used.
+    std::unique_ptr<BackgroundAnalysis> background;
 
-                try { result = visitor.visit(I); }
-                catch (const char *msg) {
-                    printError(msg, &I);
-                    throw msg; // For stack trace
-                }
+    /// The supervisor of -shards, if it can be used.
+    std::unique_ptr<ShardedAnalysis> sharded;
 
-                // Print user oriented output
-                printUserOutput(result, &I);
+    /// The tier-0 scan, and how many functions ended up in each tier, with -tiered.
+    std::unique_ptr<Triage> triage;
+    unsigned tierCounts[3];
 
-                // Print testing output
-                if (testOutputEnabled) {
-                    printTestOutput(result, &I, ++instNumber);
-                }
+    /// The lines of -query-lines, if given.
+    QueryLines queryLines;
 
-                // If there was an unknown error, stop the loop
-                if ((result & ERROR) == ERROR) break;
+    /// Summaries of the functions analysed so far, if -summary-index is given.
+    ModuleSummary moduleSummary;
+
+    /// Where the graph operations go, if -trace is given.
+    std::unique_ptr<graph::TraceFile> traceFile;
+
+    bool doInitialization(Module &module) override {
+        annotationsAdded = 0;
+        functionsOverBudget = 0;
+        options.engine = engine;
+        options.testOutput = testOutputEnabled;
+        options.debugOutput = debugOutputEnabled;
+        options.annotate = annotateEnabled;
+        if (annotateEnabled && engine != GraphEngine) {
+            // The other engines don't build the graph the Annotator reads.
+            printError("-annotate only goes with -engine=graph; not annotating");
+            options.annotate = false;
+        }
+        options.summarize = !summaryIndex.empty();
+        options.budget.maxNodes = maxNodes;
+        options.budget.maxSteps = maxSteps;
+        options.budget.maxMillis = maxMillis;
+        options.releaseMinInstructions = releaseMinInstructions;
+        options.collectMinNodes = collectMinNodes;
+        options.counters = NULL;
+        options.workspace = &workspace;
+        options.queryLines = NULL;
+        if (!queryLinesText.empty()) {
+            if (engine != DemandEngine) {
+                printError("-query-lines only goes with -engine=demand; checking every line");
+            } else if (!QueryLines::parse(queryLinesText, queryLines)) {
+                printError(("cannot read the lines of -query-lines=" + queryLinesText + "; checking every line").c_str());
+            } else {
+                options.queryLines = &queryLines;
+            }
+        }
+        if (perfEnabled) {
+            counters.reset(new PerfCounters());
+            options.counters = counters.get();
+            visitTotal = teardownTotal = dumpTotal = PerfSample();
+            if (!counters->available()) {
+                errs() << "Hardware counters unavailable (" << counters->reason()
+                       << "), reporting time only\n";
+            }
+        }
+        contexts.reset(contextDepth > 0 ? new CallContexts(contextDepth) : NULL);
+        options.contexts = contexts.get();
+        moduleSummary = ModuleSummary();
+        moduleSummary.module = module.getModuleIdentifier();
+        if (!tracePath.empty()) {
+            // Before the globals, so that the trace has their graph too.
+            std::error_code ec;
+            traceFile.reset(new graph::TraceFile(tracePath, ec));
+            if (ec) {
+                printError(("cannot write " + tracePath + ": " + ec.message()).c_str());
+                traceFile.reset();
+            } else {
+                graph::startTrace(*traceFile);
+            }
+        }
+        if (pointsToEnabled) pointsTo.reset(new PointsTo(module, wholeProgram));
+        globals.reset(new GlobalGraph(module, pointsTo.get()));
+        options.globals = globals.get();
+        triage.reset(tieredEnabled ? new Triage(pointsTo.get(), contexts != NULL) : NULL);
+        options.triage = triage.get();
+        tierCounts[TRIVIALLY_SAFE] = tierCounts[LOCAL] = tierCounts[DEEP] = 0;
+
+        background.reset();
+        if (backgroundEnabled) {
+            // Everything else needs the IR, or facts, while it is there.
+            if (engine != FlowEngine || contexts || options.annotate || debugOutputEnabled
+                    || perfEnabled || !summaryIndex.empty()) {
+                printError("-background only runs -engine=flow, without -context-depth, -annotate, "
+                           "-d, -perf or -summary-index; analysing in the foreground");
+            } else {
+                background.reset(new BackgroundAnalysis(options.budget, testOutputEnabled));
             }
         }
 
-        if (debugOutputEnabled) {
-            try {
-                errs().changeColor(llvm::raw_ostream::YELLOW);
-                errs() << visitor.dump();
-                errs().resetColor();
-            } catch (const char *msg) { printError(msg); }
+        sharded.reset();
+        if (shardCount > 0) {
+            // Workers only send text back: they can't change the IR, or
+            // share what the compiler keeps.
+            if (background || options.annotate || perfEnabled || !summaryIndex.empty() || traceFile) {
+                printError("-shards doesn't go with -background, -annotate, -perf, -summary-index "
+                           "or -trace; analysing in this process");
+            } else {
+                sharded.reset(new ShardedAnalysis(shardCount, shardMemory));
+            }
         }
+        return false;
+    }
 
-        errs() << "\n";
+    void getAnalysisUsage(AnalysisUsage &usage) const override {
+        // The memory SSA engine walks the pass manager's MemorySSA.
+        if (engine == MemorySSAEngine) {
+            usage.addRequired<AAResultsWrapperPass>();
+            usage.addRequired<MemorySSAWrapperPass>();
+        }
+    }
+
+    bool runOnFunction(Function &function) override {
+        if (sharded) {
+            sharded->add(function, options, pointsTo.get());
+            return false;
+        }
+        if (background) {
+            Tier tier = triage ? triage->classify(function) : DEEP;
+            ++tierCounts[tier];
+            // LOCAL functions get the flow engine too: it needs no IR later.
+            if (tier == TRIVIALLY_SAFE) background->skip();
+            else background->submit(function);
+            return false;
+        }
+
+        AnalysisOptions functionOptions = options;
+        if (engine == MemorySSAEngine && !function.isDeclaration()) {
+            functionOptions.aliases = &getAnalysis<AAResultsWrapperPass>().getAAResults();
+            functionOptions.memorySSA = &getAnalysis<MemorySSAWrapperPass>().getMSSA();
+        }
+        FunctionResult result = analyzeFunction(function, functionOptions, pointsTo.get(), errs());
+
+        if (result.overBudget) ++functionsOverBudget;
+        ++tierCounts[result.tier];
+        visitTotal += result.visitCost;
+        teardownTotal += result.teardownCost;
+        dumpTotal += result.dumpCost;
+        if (options.summarize) {
+            if (!function.hasLocalLinkage()) moduleSummary.functions.push_back(result.summary);
+            for (const CallSummary &call : result.calls) moduleSummary.calls.push_back(call);
+        }
+        annotationsAdded += result.annotationsAdded;
 
         // return true if the function was modified, false otherwise [4]
+        return result.annotationsAdded > 0;
+    }
+
+    bool doFinalization(Module &module) override {
+        if (sharded) {
+            functionsOverBudget += sharded->run(errs(), tierCounts);
+            errs() << "Shards in " << module.getModuleIdentifier() << ": " << sharded->workersDied()
+                   << " workers died (" << sharded->workersOverMemory() << " over the memory limit), "
+                   << sharded->functionsGivenUp() << " functions not analysed\n";
+            sharded.reset();
+        }
+        if (annotateEnabled) {
+            errs() << "Annotations added to " << module.getModuleIdentifier()
+                   << ": " << annotationsAdded << "\n";
+        }
+        // The lines that count functions come after the worker's output.
+        bool inBackground = background != NULL;
+        if (inBackground) {
+            std::unique_ptr<PendingModule> pending(new PendingModule());
+            pending->background = std::move(background);
+            pending->name = module.getModuleIdentifier();
+            pending->budgeted = !options.budget.unlimited();
+            pending->tiered = triage != NULL;
+            std::copy(tierCounts, tierCounts + 3, pending->tierCounts);
+            if (joinLater) {
+                if (pendingModule) pendingModule->finish(errs());
+                pendingModule = std::move(pending);
+            } else {
+                pending->finish(errs());
+            }
+        } else if (!options.budget.unlimited()) {
+            errs() << "Functions over budget in " << module.getModuleIdentifier()
+                   << ": " << functionsOverBudget << "\n";
+        }
+        if (contexts) {
+            errs() << "Calling contexts in " << module.getModuleIdentifier() << ": "
+                   << contexts->contexts() << " analysed, " << contexts->queries() << " lookups\n";
+            contexts.reset();
+            options.contexts = NULL;
+        }
+        if (triage) {
+            if (!inBackground) {
+                errs() << "Tiers in " << module.getModuleIdentifier() << ": "
+                       << tierCounts[TRIVIALLY_SAFE] << " trivially safe, " << tierCounts[LOCAL] << " local, "
+                       << tierCounts[DEEP] << " deep\n";
+            }
+            options.triage = NULL;
+            triage.reset();
+        }
+        if (counters) {
+            errs() << "PERF[" << module.getModuleIdentifier() << "] visit: ";
+            visitTotal.print(errs());
+            errs() << "\nPERF[" << module.getModuleIdentifier() << "] teardown: ";
+            teardownTotal.print(errs());
+            if (debugOutputEnabled) {
+                errs() << "\nPERF[" << module.getModuleIdentifier() << "] dump: ";
+                dumpTotal.print(errs());
+            }
+            errs() << "\n";
+            counters.reset();
+        }
+        if (!summaryIndex.empty()) {
+            std::error_code ec;
+            raw_fd_ostream os(summaryIndex, ec, sys::fs::OF_Text);
+            if (ec) {
+                printError(("cannot write " + summaryIndex + ": " + ec.message()).c_str());
+            } else {
+                writeSummary(moduleSummary, os);
+            }
+        }
+        workspace.reset();
+        if (traceFile) {
+            graph::Trace::stop();
+            traceFile.reset();
+        }
+        options.globals = NULL;
+        globals.reset();
+        pointsTo.reset();
         return false;
     }
 
 };
 
+/// Waits for the -background worker the pass left running. clang runs the
+/// pass with the early function passes, whose doFinalization comes before
+/// the rest of the pipeline even starts: joining there would make the
+/// compiler wait for the worker instead of optimizing meanwhile. This pass
+/// runs at the end of the pipeline instead.
+struct BackgroundJoin : public ModulePass {
+    static char ID;
+    BackgroundJoin() : ModulePass(ID) {}
+
+    StringRef getPassName() const override { return "Null Dereference Background Join"; }
+
+    bool runOnModule(Module &) override {
+        if (pendingModule) {
+            pendingModule->finish(errs());
+            pendingModule.reset();
+        }
+        return false;
+    }
+};
+
 }
 
 // Enable the pass for opt [5]
@@ -88,13 +398,37 @@ static RegisterPass<NullDereferenceDetection> X("nullderef", "Null Dereference C
                              false /* Only looks at CFG */,
                              false /* Analysis Pass */);
 
+// The nullness facts as an analysis other passes can query. It reads the
+// loads, stores and compares too, so a pass that only keeps the CFG
+// doesn't keep it.
+char NullnessInfoWrapperPass::ID = 0;
+static RegisterPass<NullnessInfoWrapperPass> Y("nullness-info", "Nullness Information",
+                             false /* Only looks at CFG */,
+                             true /* Analysis Pass */);
+
 // Automatically enable the pass for clang.
 // http://adriansampson.net/blog/clangpass.html
 static void registerSkeletonPass(const PassManagerBuilder &,
                                  legacy::PassManagerBase &PM) {
-    PM.add(new NullDereferenceDetection());
+    PM.add(new NullDereferenceDetection(true /* joinLater */));
+}
+
+// Waits for the -background worker at the end of clang's pipeline.
+char BackgroundJoin::ID = 0;
+
+static void registerJoinPass(const PassManagerBuilder &,
+                             legacy::PassManagerBase &PM) {
+    PM.add(new BackgroundJoin());
 }
 
 static RegisterStandardPasses
 RegisterMyPass(PassManagerBuilder::EP_EarlyAsPossible,
                registerSkeletonPass);
+
+static RegisterStandardPasses
+RegisterJoinPass(PassManagerBuilder::EP_OptimizerLast,
+                 registerJoinPass);
+
+static RegisterStandardPasses
+RegisterJoinPassO0(PassManagerBuilder::EP_EnabledOnOptLevel0,
+                   registerJoinPass);
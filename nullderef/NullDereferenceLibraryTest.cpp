@@ -0,0 +1,77 @@
+#include <memory>
+#include <string>
+
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instruction.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "NullDereference.h"
+
+using namespace llvm;
+
+static cl::list<std::string> inputFiles(cl::Positional, cl::OneOrMore, cl::desc("<module>..."));
+
+/*
+ * Uses the NullDereference library the way a tool would: through
+ * NullDereference.h only, with one AnalysisContext for several modules and
+ * a reset after each of them. Every module is analysed twice, the second
+ * time after all the others. The diagnostics of the first round are
+ * printed; the second round must find the same ones, without the context
+ * holding more nodes than after the first.
+ */
+
+/// Analyse every function of the module in `path`, append a line per
+/// diagnostic to `out`, and reset the context before the module goes away.
+static bool analyzeFile(AnalysisContext &context, const std::string &path, std::string &out) {
+    LLVMContext llvmContext;
+    SMDiagnostic error;
+    std::unique_ptr<Module> module = parseIRFile(path, error, llvmContext);
+    if (!module) {
+        error.print("nullderef-library-test", errs());
+        return false;
+    }
+
+    raw_string_ostream os(out);
+    for (Function &function : *module) {
+        if (function.isDeclaration()) continue;
+        for (const Diagnostic &d : context.analyze(function)) {
+            os << path << ": " << function.getName() << ": "
+               << (d.code == NULL_DEREF ? "NULL_DEREF" : "UNDEFINED_DEREF");
+            d.instruction->print(os);
+            os << "\n";
+        }
+    }
+    context.reset();
+    return true;
+}
+
+int main(int argc, char **argv) {
+    cl::ParseCommandLineOptions(argc, argv, "Check of the NullDereference library\n");
+
+    AnalysisContext context;
+    std::string first, second;
+    for (const std::string &path : inputFiles) {
+        if (!analyzeFile(context, path, first)) return 2;
+    }
+    size_t capacity = context.capacity();
+    for (const std::string &path : inputFiles) {
+        if (!analyzeFile(context, path, second)) return 2;
+    }
+
+    outs() << first;
+    if (second != first) {
+        errs() << "The second round found other diagnostics:\n" << second;
+        return 1;
+    }
+    if (context.capacity() != capacity) {
+        errs() << "The capacity grew from " << capacity << " to " << context.capacity() << " nodes\n";
+        return 1;
+    }
+    outs() << "Capacity stable at " << capacity << " nodes\n";
+    return 0;
+}
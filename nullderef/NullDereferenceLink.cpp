@@ -0,0 +1,125 @@
+#include <map>
+#include <string>
+#include <vector>
+
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "Summary.h"
+
+using namespace llvm;
+
+static cl::list<std::string> indexFiles(cl::Positional, cl::OneOrMore,
+    cl::desc("<summary index files written by -summary-index>"));
+
+/*
+ * Combines the summary index files of several translation units, and
+ * reports the null dereferences that only show up across them:
+ *
+ *  - a call passes NULL for a parameter the callee always dereferences,
+ *  - a call result is dereferenced unchecked, and the callee may return NULL.
+ *
+ * Only the small index files are read, never the IR itself. A function
+ * that always passes one of its own parameters on to a parameter that is
+ * always dereferenced, dereferences it as well; this is propagated to a
+ * fixpoint before anything is reported.
+ */
+
+namespace {
+
+struct Defined {
+    FunctionSummary summary;
+    const ModuleSummary *module;
+};
+
+/// Make `derefParams` transitive over calls that always happen.
+void propagateDerefs(std::map<std::string, Defined> &defined, const vector<ModuleSummary> &modules) {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (const ModuleSummary &m : modules) {
+            for (const CallSummary &c : m.calls) {
+                auto callee = defined.find(c.callee);
+                auto caller = defined.find(c.caller);
+                if (!c.always || callee == defined.end() || caller == defined.end()) continue;
+
+                for (unsigned i = 0; i < c.forwarded.size() && i < 64; ++i) {
+                    int p = c.forwarded[i];
+                    if (p < 0 || p >= 64 || !(callee->second.summary.derefParams >> i & 1)) continue;
+
+                    uint64_t bit = uint64_t(1) << p;
+                    if ((caller->second.summary.derefParams & bit) == 0) {
+                        caller->second.summary.derefParams |= bit;
+                        changed = true;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void report(const ModuleSummary &m, const CallSummary &c, const std::string &what) {
+    errs() << m.module << ":" << c.line << ": NULL_DEREF in " << c.caller << ": " << what << "\n";
+}
+
+}
+
+int main(int argc, char **argv) {
+    cl::ParseCommandLineOptions(argc, argv, "Cross-module null dereference detection\n");
+
+    vector<ModuleSummary> modules(indexFiles.size());
+    for (unsigned i = 0; i < indexFiles.size(); ++i) {
+        ErrorOr<std::unique_ptr<MemoryBuffer>> buffer = MemoryBuffer::getFile(indexFiles[i]);
+        if (!buffer) {
+            errs() << indexFiles[i] << ": " << buffer.getError().message() << "\n";
+            return 2;
+        }
+
+        unsigned line;
+        if (!readSummary((*buffer)->getBuffer(), modules[i], line)) {
+            errs() << indexFiles[i] << ":" << line << ": malformed summary\n";
+            return 2;
+        }
+    }
+
+    std::map<std::string, Defined> defined;
+    for (const ModuleSummary &m : modules) {
+        for (const FunctionSummary &f : m.functions) {
+            if (defined.count(f.name) != 0) {
+                errs() << "warning: " << f.name << " is defined in both "
+                       << defined[f.name].module->module << " and " << m.module << "\n";
+                continue;
+            }
+            defined[f.name] = Defined{f, &m};
+        }
+    }
+
+    propagateDerefs(defined, modules);
+
+    unsigned found = 0;
+    for (const ModuleSummary &m : modules) {
+        for (const CallSummary &c : m.calls) {
+            auto callee = defined.find(c.callee);
+            if (callee == defined.end()) continue;
+            const Defined &d = callee->second;
+
+            uint64_t bad = c.nilArgs & d.summary.derefParams;
+            for (unsigned i = 0; i < 64; ++i) {
+                if (!(bad >> i & 1)) continue;
+                report(m, c, "NULL is passed as argument " + std::to_string(i + 1) + " of " + c.callee
+                       + ", which dereferences it (" + d.module->module + ")");
+                ++found;
+            }
+
+            if (c.resultDereferenced && d.summary.returnMayBeNil) {
+                report(m, c, "the result of " + c.callee + " may be NULL and is dereferenced ("
+                       + d.module->module + ")");
+                ++found;
+            }
+        }
+    }
+
+    errs() << "Cross-module null dereferences: " << found << "\n";
+    return found == 0 ? 0 : 1;
+}
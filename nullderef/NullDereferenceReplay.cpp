@@ -0,0 +1,307 @@
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "PointerGraph.h"
+
+using namespace llvm;
+using namespace graph;
+
+static cl::opt<std::string> traceFile(cl::Positional, cl::Required,
+    cl::desc("<trace file written by -trace>"));
+static cl::opt<unsigned> repeat("repeat", cl::init(1),
+    cl::desc("Replay the trace this many times, and report the fastest"));
+
+/*
+ * Re-executes the pointer graph operations recorded with -trace, without
+ * the IR or the analysis that made them, and reports what each kind of
+ * operation costs. The results of the replayed operations are checked
+ * against the recorded ones, so a change to PointerGraph.h can be timed,
+ * and checked, on the trace of a module that is slow to analyse.
+ *
+ * Values are only numbers here: entry points are kept in a DenseMap.
+ */
+
+namespace {
+
+typedef BasicGraph<DenseMap<Value*, Node*>> ReplayGraph;
+
+struct Event {
+    TraceOp op;
+    uint64_t operands[5];
+};
+
+bool decodeVarint(StringRef &bytes, uint64_t &value) {
+    value = 0;
+    for (unsigned shift = 0; shift < 64 && !bytes.empty(); shift += 7) {
+        uint8_t byte = bytes.front();
+        bytes = bytes.drop_front();
+        value |= uint64_t(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+/// Split `file` into the events of each thread. Returns false if it isn't a trace.
+bool decodeTrace(StringRef file, vector<vector<Event>> &threads) {
+    if (!file.startswith(TraceFile::magic())) return false;
+    StringRef rest = file.drop_front(TraceFile::magic().size());
+
+    while (!rest.empty()) {
+        uint64_t thread, length;
+        if (!decodeVarint(rest, thread) || !decodeVarint(rest, length)) return false;
+        if (thread == 0 || length > rest.size()) return false;
+        StringRef chunk = rest.take_front(length);
+        rest = rest.drop_front(length);
+
+        if (threads.size() < thread) threads.resize(thread);
+        vector<Event> &events = threads[thread - 1];
+        while (!chunk.empty()) {
+            Event event;
+            event.op = (TraceOp) chunk.front();
+            chunk = chunk.drop_front();
+            if (event.op >= NUM_TRACE_OPS) return false;
+            for (unsigned i = 0; i < traceOpOperands(event.op); ++i) {
+                if (!decodeVarint(chunk, event.operands[i])) return false;
+            }
+            events.push_back(event);
+        }
+    }
+    return true;
+}
+
+int64_t unzigzag(uint64_t value) {
+    return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+Value *valueOf(uint64_t id) {
+    return reinterpret_cast<Value*>(uintptr_t(id) << 4);
+}
+
+/// The graphs and nodes of one thread, while its events are replayed.
+class Replay {
+public:
+    /// Results that differ from the recorded ones.
+    unsigned mismatches = 0;
+
+    /// Node ids seen as results, the shared leaves included.
+    uint64_t nodes = 2;
+
+    /// Cost of each kind of operation, if `timed`.
+    uint64_t counts[NUM_TRACE_OPS] = {};
+    std::chrono::nanoseconds time[NUM_TRACE_OPS] = {};
+
+    Replay() {
+        nodeIds.push_back(NULL);
+        nodeIds.push_back(sharedLeaf(NIL));
+        nodeIds.push_back(sharedLeaf(UNDEFINED));
+        graphs.emplace_back(); // graph 0 is NULL
+    }
+
+    /// Replay `events`; false if they refer to something never recorded.
+    bool run(const vector<Event> &events, bool timed) {
+        for (const Event &event : events) {
+            if (!timed) {
+                if (!apply(event)) return false;
+                continue;
+            }
+            auto start = std::chrono::steady_clock::now();
+            if (!apply(event)) return false;
+            time[event.op] += std::chrono::steady_clock::now() - start;
+            ++counts[event.op];
+        }
+        return true;
+    }
+
+private:
+    vector<std::unique_ptr<ReplayGraph>> graphs;
+    vector<Node*> nodeIds;
+
+    bool graphOf(uint64_t id, ReplayGraph *&graph) {
+        if (id >= graphs.size()) return false;
+        graph = graphs[id].get();
+        return id == 0 || graph != NULL;
+    }
+
+    bool nodeOf(uint64_t id, Node *&node) {
+        if (id >= nodeIds.size()) return false;
+        node = nodeIds[id];
+        return true;
+    }
+
+    /// The contents of a "node" operand (see TraceOp).
+    bool contentsOf(uint64_t operand, Node &node) {
+        if ((operand & 1) == 0) {
+            node = Node::newLeafNode((LeafNodeType) (operand >> 1));
+            return true;
+        }
+        Node *referenced;
+        if (!nodeOf(operand >> 1, referenced)) return false;
+        node = Node::newRefNode(referenced);
+        return true;
+    }
+
+    /// Check `result` against the recorded node id: a new id is a node
+    /// allocated just now, any other must be the same node again.
+    void check(uint64_t id, Node *result) {
+        if (id == nodeIds.size()) {
+            nodeIds.push_back(result);
+            ++nodes;
+            if (result == NULL || isShared(result)) ++mismatches;
+        } else if (id > nodeIds.size() || nodeIds[id] != result) {
+            ++mismatches;
+        }
+    }
+
+    bool apply(const Event &event) {
+        const uint64_t *op = event.operands;
+        ReplayGraph *graph = NULL, *base = NULL;
+        Node *node = NULL, *other = NULL;
+        Node contents = Node::newLeafNode(NIL);
+
+        switch (event.op) {
+        case TRACE_RESET:
+            if (!graphOf(op[1], base)) return false;
+            if (op[0] == 0) {
+                graphs.emplace_back(new ReplayGraph(base));
+            } else {
+                if (!graphOf(op[0], graph) || graph == NULL) return false;
+                graphs.push_back(std::move(graphs[op[0]]));
+                graphs.back()->reset(base);
+            }
+            return true;
+        case TRACE_FREEZE:
+            if (!graphOf(op[0], graph) || graph == NULL) return false;
+            graph->freeze();
+            return true;
+        case TRACE_INSERT:
+            if (!graphOf(op[0], graph) || graph == NULL || !contentsOf(op[1], contents)) return false;
+            check(op[2], graph->insertNode(contents));
+            return true;
+        case TRACE_INSERT_ENTRY:
+            if (!graphOf(op[0], graph) || graph == NULL || !contentsOf(op[2], contents)) return false;
+            check(op[3], graph->insertNode(valueOf(op[1]), contents));
+            return true;
+        case TRACE_SET_ENTRY:
+            if (!graphOf(op[0], graph) || graph == NULL || !nodeOf(op[2], node)) return false;
+            graph->insertNode(valueOf(op[1]), node);
+            return true;
+        case TRACE_MUTABLE:
+            if (!graphOf(op[0], graph) || graph == NULL) return false;
+            check(op[2], graph->getMutableNode(valueOf(op[1])));
+            return true;
+        case TRACE_TRANSFORM:
+            if (!nodeOf(op[0], node) || node == NULL || !nodeOf(op[1], other)) return false;
+            if (Error error = node->transformToRefNode(other)) {
+                consumeError(std::move(error));
+                ++mismatches;
+            }
+            return true;
+        case TRACE_OFFSET: {
+            if (!graphOf(op[0], graph) || graph == NULL) return false;
+            Expected<Node*> result = graph->getOffset(valueOf(op[1]), unzigzag(op[2]));
+            if (result) {
+                check(op[3], *result);
+            } else {
+                consumeError(result.takeError());
+                if (op[3] != 0) ++mismatches;
+            }
+            return true;
+        }
+        case TRACE_INSERT_OFFSET:
+            if (!graphOf(op[0], graph) || graph == NULL) return false;
+            if (!nodeOf(op[1], node) || !nodeOf(op[3], other)) return false;
+            graph->insertOffsetNode(node, unzigzag(op[2]), other);
+            return true;
+        case TRACE_RELEASE:
+            if (!graphOf(op[0], graph) || graph == NULL) return false;
+            graph->release(valueOf(op[1]));
+            return true;
+        case TRACE_COLLECT:
+            if (!graphOf(op[0], graph) || graph == NULL) return false;
+            graph->collect();
+            return true;
+        case TRACE_SET_OFFSET:
+            if (!graphOf(op[0], graph) || graph == NULL) return false;
+            if (!nodeOf(op[1], node) || node == NULL || !contentsOf(op[3], contents)) return false;
+            check(op[4], graph->setOffset(node, unzigzag(op[2]), contents));
+            return true;
+        default:
+            return false;
+        }
+    }
+};
+
+double millis(std::chrono::nanoseconds time) {
+    return std::chrono::duration<double, std::milli>(time).count();
+}
+
+}
+
+int main(int argc, char **argv) {
+    cl::ParseCommandLineOptions(argc, argv, "Replay of a pointer graph trace\n");
+
+    ErrorOr<std::unique_ptr<MemoryBuffer>> buffer = MemoryBuffer::getFile(traceFile);
+    if (!buffer) {
+        errs() << traceFile << ": " << buffer.getError().message() << "\n";
+        return 2;
+    }
+
+    vector<vector<Event>> threads;
+    if (!decodeTrace((*buffer)->getBuffer(), threads)) {
+        errs() << traceFile << ": not a trace, or a truncated one\n";
+        return 2;
+    }
+    size_t events = 0;
+    for (const vector<Event> &thread : threads) events += thread.size();
+
+    // Untimed runs first: the fastest is what the operations cost together.
+    std::chrono::nanoseconds best = std::chrono::nanoseconds::max();
+    for (unsigned run = 0; run < std::max(1u, (unsigned) repeat); ++run) {
+        auto start = std::chrono::steady_clock::now();
+        for (const vector<Event> &thread : threads) {
+            Replay replay;
+            if (!replay.run(thread, false)) {
+                errs() << traceFile << ": refers to a graph or node it never recorded\n";
+                return 2;
+            }
+        }
+        best = std::min(best, std::chrono::nanoseconds(std::chrono::steady_clock::now() - start));
+    }
+
+    // Then one run timing each operation, which also checks the results.
+    uint64_t counts[NUM_TRACE_OPS] = {};
+    std::chrono::nanoseconds time[NUM_TRACE_OPS] = {};
+    unsigned mismatches = 0;
+    uint64_t nodes = 0;
+    for (const vector<Event> &thread : threads) {
+        Replay replay;
+        replay.run(thread, true);
+        mismatches += replay.mismatches;
+        nodes += replay.nodes;
+        for (unsigned op = 0; op < NUM_TRACE_OPS; ++op) {
+            counts[op] += replay.counts[op];
+            time[op] += replay.time[op];
+        }
+    }
+
+    outs() << traceFile << ": " << threads.size() << " thread(s), " << events << " operations, "
+           << nodes << " nodes, " << mismatches << " mismatches\n";
+    outs() << format("replay: %.3f ms", millis(best));
+    if (repeat > 1) outs() << " (fastest of " << repeat << ")";
+    outs() << "\n\n" << format("%-14s %12s %12s %10s\n", (const char*) "operation", (const char*) "count", (const char*) "ms", (const char*) "ns/op");
+    for (unsigned op = 0; op < NUM_TRACE_OPS; ++op) {
+        if (counts[op] == 0) continue;
+        double ms = millis(time[op]);
+        outs() << format("%-14s %12llu %12.3f %10.1f\n", traceOpName((TraceOp) op),
+                         (unsigned long long) counts[op], ms, ms * 1e6 / counts[op]);
+    }
+    return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,390 @@
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/Hashing.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "Driver.h"
+
+using namespace llvm;
+
+static cl::opt<std::string> socketPath(cl::Positional, cl::Required, cl::desc("<socket>"));
+static cl::opt<bool> testOutputEnabled("t", cl::desc("Enable output information for testing purposes"));
+static cl::opt<Engine> engine("engine", cl::desc("Analysis engine to use"), cl::init(GraphEngine),
+    cl::values(clEnumValN(GraphEngine, "graph", "Single walk over the pointer graph (default)"),
+               clEnumValN(FlowEngine, "flow", "Flow-sensitive dataflow analysis over bit-vector states"),
+               clEnumValN(MemorySSAEngine, "mssa", "Resolve each load through MemorySSA to the stores it reads"),
+               clEnumValN(DemandEngine, "demand", "Walk back from each dereference only as far as its answer needs")));
+static cl::opt<bool> pointsToEnabled("points-to", cl::init(true),
+    cl::desc("Use a module-wide points-to analysis for arguments and globals (default: on)"));
+static cl::opt<unsigned> timeoutMillis("timeout-ms", cl::init(5000),
+    cl::desc("Hang up on a client that doesn't send its request, or read the answer, within this many milliseconds"));
+
+/*
+ * A long-lived analysis server. It keeps the modules it has seen in
+ * memory, together with the diagnostics of each function, and answers
+ * requests on a Unix socket, one request per connection:
+ *
+ *     analyze <file> [function]   diagnostics of the file or one function
+ *     forget <file>               drop the file from the cache
+ *     stats                       what is in the cache
+ *     shutdown                    stop the server
+ *
+ * The answer ends with a "DONE" line, after a "STATS" line for analyze
+ * requests. Connections are served one at a time: a client that takes
+ * longer than -timeout-ms to send its request, or a request longer than
+ * MAX_REQUEST bytes, is hung up on. A file that hasn't changed on disk
+ * is answered from the cache. Otherwise it is parsed again, and only the
+ * functions whose key changed are analysed again. The key covers the IR
+ * of the function and everything the points-to analysis says about the
+ * values it uses, since that is all the analysis of a function depends
+ * on (see FunctionHasher).
+ */
+
+namespace {
+
+const size_t MAX_REQUEST = 4096;
+
+struct CachedFunction {
+    hash_code key;
+    std::string output;
+};
+
+struct CachedModule {
+    sys::TimePoint<> modified;
+    uint64_t size = 0;
+
+    // Every parse gets its own context: named struct types would be
+    // renamed when parsed again into the same one, changing every key.
+    std::unique_ptr<LLVMContext> context;
+    std::unique_ptr<Module> module;
+    StringMap<CachedFunction> functions;
+};
+
+StringMap<CachedModule> cache;
+
+/// Visits every function analysed, in the graph memory left by the
+/// previous one: the server stops allocating graphs once warmed up.
+Visitor workspace;
+
+/// Computes the key of a function: a structural hash of its IR, its
+/// names and debug locations, and of what the points-to analysis says
+/// about the values it uses. It covers what printing the function would,
+/// but printing costs more than parsing the whole module.
+class FunctionHasher {
+    const PointsTo *pointsTo;
+    DenseMap<Type*, hash_code> types;
+    DenseMap<const Value*, unsigned> locals; // argument/block/instruction => number
+
+public:
+    FunctionHasher(const PointsTo *pointsTo) : pointsTo(pointsTo) {}
+
+    hash_code key(Function &function) {
+        locals.clear();
+        unsigned n = 0;
+        for (Argument &arg : function.args()) locals[&arg] = n++;
+        for (BasicBlock &BB : function) {
+            locals[&BB] = n++;
+            for (Instruction &I : BB) locals[&I] = n++;
+        }
+
+        hash_code key = hash_combine(function.getName(), type(function.getFunctionType()));
+        for (Argument &arg : function.args()) key = hash_combine(key, arg.getName());
+        for (BasicBlock &BB : function) {
+            key = hash_combine(key, BB.getName());
+            for (Instruction &I : BB) key = hash_combine(key, instruction(I));
+        }
+        return key;
+    }
+
+private:
+    hash_code instruction(Instruction &I) {
+        hash_code h = hash_combine(I.getOpcode(), type(I.getType()), I.getName(),
+                                   I.getRawSubclassOptionalData());
+        for (Value *op : I.operands()) h = hash_combine(h, value(op));
+
+        if (LoadInst *load = dyn_cast<LoadInst>(&I)) {
+            h = hash_combine(h, load->getAlign().value(), load->isVolatile());
+        } else if (StoreInst *store = dyn_cast<StoreInst>(&I)) {
+            h = hash_combine(h, store->getAlign().value(), store->isVolatile());
+        } else if (AllocaInst *alloca = dyn_cast<AllocaInst>(&I)) {
+            h = hash_combine(h, type(alloca->getAllocatedType()), alloca->getAlign().value());
+        } else if (GetElementPtrInst *gep = dyn_cast<GetElementPtrInst>(&I)) {
+            h = hash_combine(h, type(gep->getSourceElementType()));
+        } else if (CmpInst *cmp = dyn_cast<CmpInst>(&I)) {
+            h = hash_combine(h, cmp->getPredicate());
+        } else if (CallBase *call = dyn_cast<CallBase>(&I)) {
+            h = hash_combine(h, type(call->getFunctionType()), call->getCallingConv());
+        } else if (PHINode *phi = dyn_cast<PHINode>(&I)) {
+            for (BasicBlock *from : phi->blocks()) h = hash_combine(h, locals.lookup(from));
+        }
+
+        if (DILocation *loc = I.getDebugLoc()) {
+            h = hash_combine(h, loc->getLine(), loc->getColumn());
+        }
+
+        if (pointsTo != NULL) {
+            for (Value *v : I.operand_values()) {
+                if (v->getType()->isPointerTy()) h = hash_combine(h, pointsTo->nullness(v), pointsTo->pointeeNullness(v));
+            }
+            if (I.getType()->isPointerTy()) {
+                h = hash_combine(h, pointsTo->nullness(&I), pointsTo->pointeeNullness(&I));
+            }
+        }
+        return h;
+    }
+
+    hash_code value(Value *v) {
+        auto it = locals.find(v);
+        if (it != locals.end()) return hash_combine(0, it->second);
+
+        hash_code h = hash_combine(v->getValueID(), type(v->getType()));
+        if (GlobalVariable *global = dyn_cast<GlobalVariable>(v)) return hash_combine(h, global->getName(), initializer(*global));
+        if (GlobalValue *global = dyn_cast<GlobalValue>(v)) return hash_combine(h, global->getName());
+        if (ConstantInt *c = dyn_cast<ConstantInt>(v)) return hash_combine(h, c->getValue());
+        if (ConstantFP *c = dyn_cast<ConstantFP>(v)) return hash_combine(h, c->getValueAPF());
+        if (ConstantDataSequential *c = dyn_cast<ConstantDataSequential>(v)) return hash_combine(h, c->getRawDataValues());
+        if (ConstantExpr *c = dyn_cast<ConstantExpr>(v)) h = hash_combine(h, c->getOpcode());
+
+        // Constant expressions and aggregates; metadata (only used by debug
+        // intrinsics) doesn't matter.
+        if (isa<Constant>(v)) {
+            for (Value *op : cast<User>(v)->operands()) h = hash_combine(h, value(op));
+        }
+        return h;
+    }
+
+    /// What the shared GlobalGraph knows from the initialiser of `global`.
+    hash_code initializer(GlobalVariable &global) {
+        const Constant *init = GlobalGraph::fixedInitializer(global);
+        if (init == NULL) return hash_value(0);
+
+        SmallVector<graph::LeafNodeType, 8> fields;
+        GlobalGraph::fieldStatuses(init, fields);
+        hash_code h = hash_combine_range(fields.begin(), fields.end());
+        if (init->getType()->isPointerTy()) h = hash_combine(h, GlobalGraph::constantStatus(init));
+        return h;
+    }
+
+    hash_code type(Type *t) {
+        auto it = types.find(t);
+        if (it != types.end()) return it->second;
+
+        hash_code h = hash_value(t->getTypeID());
+        StructType *st = dyn_cast<StructType>(t);
+        if (st != NULL && st->hasName()) {
+            // Named structs can be recursive; their name is enough.
+            h = hash_combine(h, st->getName());
+        } else {
+            if (IntegerType *it = dyn_cast<IntegerType>(t)) h = hash_combine(h, it->getBitWidth());
+            if (ArrayType *at = dyn_cast<ArrayType>(t)) h = hash_combine(h, at->getNumElements());
+            if (FixedVectorType *vt = dyn_cast<FixedVectorType>(t)) h = hash_combine(h, vt->getNumElements());
+            if (PointerType *pt = dyn_cast<PointerType>(t)) h = hash_combine(h, pt->getAddressSpace());
+            if (FunctionType *ft = dyn_cast<FunctionType>(t)) h = hash_combine(h, ft->isVarArg());
+            if (st != NULL) h = hash_combine(h, st->isPacked());
+            for (Type *sub : t->subtypes()) h = hash_combine(h, type(sub));
+        }
+        types[t] = h;
+        return h;
+    }
+};
+
+/// Bring the cache entry of `path` up to date, and write the diagnostics
+/// of `only` (or all functions if empty) to `os`.
+void analyze(StringRef path, StringRef only, raw_ostream &os) {
+    auto start = std::chrono::steady_clock::now();
+
+    sys::fs::file_status status;
+    if (std::error_code ec = sys::fs::status(path, status)) {
+        os << "ERROR: " << path << ": " << ec.message() << "\n";
+        return;
+    }
+
+    CachedModule &entry = cache[path];
+    unsigned analysed = 0, reused = 0;
+
+    if (entry.module == NULL || entry.modified != status.getLastModificationTime()
+            || entry.size != status.getSize()) {
+        std::unique_ptr<LLVMContext> context(new LLVMContext());
+        SMDiagnostic diagnostic;
+        std::unique_ptr<Module> module = parseIRFile(path, diagnostic, *context);
+        if (module == NULL) {
+            diagnostic.print("nullderef-server", os);
+            cache.erase(path);
+            return;
+        }
+
+        std::unique_ptr<PointsTo> pointsTo;
+        if (pointsToEnabled) pointsTo.reset(new PointsTo(*module));
+
+        GlobalGraph globals(*module, pointsTo.get());
+
+        AnalysisOptions options;
+        options.engine = engine;
+        options.testOutput = testOutputEnabled;
+        options.globals = &globals;
+        options.workspace = &workspace;
+
+        FunctionHasher hasher(pointsTo.get());
+        StringMap<CachedFunction> functions;
+        for (Function &function : *module) {
+            if (function.isDeclaration()) continue;
+
+            CachedFunction &f = functions[function.getName()];
+            f.key = hasher.key(function);
+
+            auto old = entry.functions.find(function.getName());
+            if (old != entry.functions.end() && old->second.key == f.key) {
+                f.output = std::move(old->second.output);
+                ++reused;
+            } else {
+                raw_string_ostream rso(f.output);
+                analyzeFunction(function, options, pointsTo.get(), rso);
+                rso.flush();
+                ++analysed;
+            }
+        }
+        workspace.reset(); // before `globals`, its base, goes away
+
+        // Keep the module, so that unchanged files are answered without
+        // parsing them again.
+        entry.functions = std::move(functions);
+        entry.module = std::move(module);
+        entry.context = std::move(context);
+        entry.modified = status.getLastModificationTime();
+        entry.size = status.getSize();
+    } else {
+        reused = entry.functions.size();
+    }
+
+    for (Function &function : *entry.module) {
+        if (function.isDeclaration() || (!only.empty() && function.getName() != only)) continue;
+        os << "FUNCTION " << function.getName() << "\n";
+        os << entry.functions[function.getName()].output;
+    }
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    os << "STATS analysed=" << analysed << " reused=" << reused << " ms="
+       << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() << "\n";
+}
+
+/// Handle one request; returns false if the server should stop.
+bool handle(StringRef request, raw_ostream &os) {
+    SmallVector<StringRef, 3> args;
+    request.trim().split(args, ' ', 2, false);
+
+    if (args.empty()) {
+        os << "ERROR: empty request\n";
+    } else if (args[0] == "analyze" && args.size() >= 2) {
+        analyze(args[1], args.size() == 3 ? args[2] : StringRef(), os);
+    } else if (args[0] == "forget" && args.size() == 2) {
+        cache.erase(args[1]);
+    } else if (args[0] == "stats") {
+        for (auto &m : cache) {
+            os << m.getKey() << ": " << m.getValue().functions.size() << " functions\n";
+        }
+    } else if (args[0] == "shutdown") {
+        os << "DONE\n";
+        return false;
+    } else {
+        os << "ERROR: unknown request: " << request << "\n";
+    }
+    os << "DONE\n";
+    return true;
+}
+
+}
+
+int main(int argc, char **argv) {
+    cl::ParseCommandLineOptions(argc, argv, "Null dereference analysis server\n");
+    signal(SIGPIPE, SIG_IGN); // clients may hang up before reading the answer
+
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        errs() << "socket path too long: " << socketPath << "\n";
+        return 2;
+    }
+    strcpy(address.sun_path, socketPath.c_str());
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socketPath.c_str());
+    if (server < 0 || bind(server, (sockaddr*) &address, sizeof(address)) != 0 || listen(server, 16) != 0) {
+        errs() << "cannot listen on " << socketPath << ": " << strerror(errno) << "\n";
+        return 2;
+    }
+    errs() << "Listening on " << socketPath << "\n";
+
+    bool running = true;
+    while (running) {
+        int client = accept(server, NULL, NULL);
+        if (client < 0) continue;
+
+        // A client that sends nothing, or trickles its request a byte at a
+        // time, must not block the others for good: the whole request has
+        // one deadline, and each read waits only for what is left of it.
+        timeval timeout;
+        timeout.tv_sec = timeoutMillis / 1000;
+        timeout.tv_usec = (timeoutMillis % 1000) * 1000;
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMillis);
+
+        // A request is a single line; anything after it is ignored.
+        std::string request;
+        char buffer[512];
+        bool complete = false;
+        while (!complete && request.size() < MAX_REQUEST) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            pollfd ready = { client, POLLIN, 0 };
+            if (left.count() <= 0 || poll(&ready, 1, left.count()) <= 0) break; // timed out
+
+            ssize_t n = read(client, buffer, sizeof(buffer));
+            if (n < 0) break;
+            if (n == 0) {
+                complete = !request.empty(); // the last line may lack its '\n'
+                break;
+            }
+            const char *end = (const char*) memchr(buffer, '\n', n);
+            complete = end != NULL;
+            request.append(buffer, complete ? end - buffer : n);
+        }
+        if (!complete) {
+            close(client);
+            continue;
+        }
+
+        std::string answer;
+        raw_string_ostream os(answer);
+        running = handle(request, os);
+        os.flush();
+
+        for (size_t done = 0; done < answer.size(); ) {
+            ssize_t n = write(client, answer.data() + done, answer.size() - done);
+            if (n <= 0) break;
+            done += n;
+        }
+        close(client);
+    }
+
+    close(server);
+    unlink(socketPath.c_str());
+    return 0;
+}
@@ -0,0 +1,263 @@
+#ifndef NULLNESS_INFO_H
+#define NULLNESS_INFO_H 1
+
+#include <cassert>
+#include <vector>
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/BitVector.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/DepthFirstIterator.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Pass.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "FlowAnalysis.h"
+
+using std::vector;
+using namespace llvm;
+
+/// The nullness facts of one function, in a form other passes can query
+/// in bulk: "which of these pointers are known (non-)NULL here?".
+///
+/// Everything is computed up front. Every pointer-typed argument and
+/// instruction gets a dense id. The table holds:
+///
+///  - the status of each id on every path, from the flow engine,
+///  - for each block, a bitset of the ids known to be non-NULL on entry,
+///    because a dominating edge tested them against NULL or a dominating
+///    block dereferenced them,
+///  - for each block, the ids dereferenced in it, in order, for queries
+///    in the middle of the block.
+///
+/// Queries take ids, which clients get once for the values they ask about
+/// with `idsOf` (a hash lookup per value), and then reuse at every point:
+/// a query is then a few bit tests per value.
+class NullnessInfo {
+public:
+    /// Ids of values that aren't instructions or arguments of the function.
+    enum : unsigned {
+        UNTRACKED = ~0u,      // nothing is known
+        CONSTANT_NIL = ~0u - 1,
+        CONSTANT_NON_NIL = ~0u - 2
+    };
+
+    NullnessInfo(Function &function, const DominatorTree &dominators) {
+        for (Argument &arg : function.args()) addValue(&arg);
+        for (Instruction &I : instructions(function)) addValue(&I);
+
+        FlowAnalysis flow(function);
+        flow.solve();
+        for (unsigned id = 0; id < values.size(); ++id) {
+            status[id] = knownStatus(values[id], flow);
+        }
+
+        for (BasicBlock &BB : function) {
+            blockIds[&BB] = blocks.size();
+            blocks.push_back(&BB);
+        }
+        nonNilIn.assign(blocks.size(), BitVector(values.size()));
+        derefs.resize(blocks.size());
+        for (BasicBlock &BB : function) {
+            collectDerefs(BB);
+        }
+
+        // Facts flow down the dominator tree.
+        for (auto *node : depth_first(dominators.getRootNode())) {
+            BasicBlock *BB = node->getBlock();
+            BitVector &in = nonNilIn[blockIds[BB]];
+            if (auto *idom = node->getIDom()) {
+                unsigned parent = blockIds[idom->getBlock()];
+                in = nonNilIn[parent];
+                for (const Deref &d : derefs[parent]) in.set(d.id);
+            }
+            addEdgeFact(BB, in);
+        }
+    }
+
+    /// The ids of `values`, for use with the queries below.
+    SmallVector<unsigned, 16> idsOf(ArrayRef<Value*> values) const {
+        SmallVector<unsigned, 16> result;
+        result.reserve(values.size());
+        for (Value *v : values) result.push_back(idOf(v));
+        return result;
+    }
+
+    /// Bit i is set if the value of `ids[i]` is known not to be NULL right
+    /// before `point`, an instruction of the function.
+    BitVector knownNonNull(ArrayRef<unsigned> ids, const Instruction *point) const {
+        BitVector result(ids.size());
+        auto it = blockIds.find(point->getParent());
+        assert(it != blockIds.end() && "query about an instruction of another function");
+        unsigned block = it->second;
+        const BitVector &in = nonNilIn[block];
+
+        for (unsigned i = 0; i < ids.size(); ++i) {
+            unsigned id = ids[i];
+            if (id == CONSTANT_NON_NIL) result.set(i);
+            else if (id < values.size() && (status[id] == graph::NON_NIL || in.test(id))) result.set(i);
+        }
+
+        // Dereferences earlier in the same block.
+        for (const Deref &d : derefs[block]) {
+            if (!d.at->comesBefore(point)) break;
+            for (unsigned i = 0; i < ids.size(); ++i) {
+                if (ids[i] == d.id) result.set(i);
+            }
+        }
+        return result;
+    }
+
+    /// Bit i is set if the value of `ids[i]` is known to be NULL right
+    /// before `point`, an instruction of the function.
+    BitVector knownNull(ArrayRef<unsigned> ids, const Instruction *point) const {
+        // A NULL that has been dereferenced or tested non-NULL on the way
+        // is dead code; don't claim anything there.
+        BitVector nonNull = knownNonNull(ids, point);
+        BitVector result(ids.size());
+        for (unsigned i = 0; i < ids.size(); ++i) {
+            unsigned id = ids[i];
+            if (nonNull.test(i)) continue;
+            if (id == CONSTANT_NIL || (id < values.size() && status[id] == graph::NIL)) result.set(i);
+        }
+        return result;
+    }
+
+    unsigned numValues() const { return values.size(); }
+
+    void print(raw_ostream &os) const {
+        for (unsigned b = 0; b < blocks.size(); ++b) {
+            const BitVector &in = nonNilIn[b];
+            if (in.none()) continue;
+
+            os << "non-NULL on entry of ";
+            blocks[b]->printAsOperand(os, false);
+            os << ":";
+            for (unsigned id : in.set_bits()) {
+                os << " ";
+                values[id]->printAsOperand(os, false);
+            }
+            os << "\n";
+        }
+        for (unsigned id = 0; id < values.size(); ++id) {
+            if (status[id] != graph::NIL && status[id] != graph::NON_NIL) continue;
+            os << (status[id] == graph::NIL ? "NULL: " : "non-NULL: ");
+            values[id]->printAsOperand(os, false);
+            os << "\n";
+        }
+    }
+
+private:
+    struct Deref {
+        const Instruction *at;
+        unsigned id;
+    };
+
+    vector<Value*> values;
+    DenseMap<const Value*, unsigned> ids;
+    vector<graph::LeafNodeType> status;
+    vector<BasicBlock*> blocks;
+    DenseMap<const BasicBlock*, unsigned> blockIds;
+    vector<BitVector> nonNilIn;
+    vector<vector<Deref>> derefs;
+
+    void addValue(Value *v) {
+        if (!v->getType()->isPointerTy()) return;
+        ids[v] = values.size();
+        values.push_back(v);
+        status.push_back(graph::DONT_KNOW);
+    }
+
+    unsigned idOf(const Value *v) const {
+        auto it = ids.find(v);
+        if (it != ids.end()) return it->second;
+        if (isa<ConstantPointerNull>(v)) return CONSTANT_NIL;
+        if (isa<GlobalValue>(v) && !cast<GlobalValue>(v)->hasExternalWeakLinkage()) return CONSTANT_NON_NIL;
+        return UNTRACKED;
+    }
+
+    static graph::LeafNodeType knownStatus(Value *v, const FlowAnalysis &flow) {
+        if (Argument *arg = dyn_cast<Argument>(v)) {
+            return arg->hasNonNullAttr() ? graph::NON_NIL : graph::DONT_KNOW;
+        }
+        if (isa<AllocaInst>(v)) return graph::NON_NIL;
+        if (CallBase *call = dyn_cast<CallBase>(v)) {
+            if (call->hasRetAttr(Attribute::NonNull)) return graph::NON_NIL;
+        }
+        if (LoadInst *load = dyn_cast<LoadInst>(v)) {
+            if (load->hasMetadata(LLVMContext::MD_nonnull)) return graph::NON_NIL;
+        }
+        return flow.valueStatus(v);
+    }
+
+    void collectDerefs(BasicBlock &BB) {
+        vector<Deref> &list = derefs[blockIds[&BB]];
+        for (Instruction &I : BB) {
+            Value *ptr = NULL;
+            if (LoadInst *load = dyn_cast<LoadInst>(&I)) ptr = load->getPointerOperand();
+            else if (StoreInst *store = dyn_cast<StoreInst>(&I)) ptr = store->getPointerOperand();
+            if (ptr == NULL || NullPointerIsDefined(BB.getParent(), ptr->getType()->getPointerAddressSpace())) continue;
+
+            unsigned id = idOf(ptr);
+            if (id < values.size()) list.push_back(Deref{&I, id});
+        }
+    }
+
+    /// If the only way into `BB` is an edge on which a pointer was tested
+    /// non-NULL, add that pointer to `in`.
+    void addEdgeFact(BasicBlock *BB, BitVector &in) {
+        BasicBlock *pred = BB->getSinglePredecessor();
+        if (pred == NULL) return;
+
+        BranchInst *br = dyn_cast<BranchInst>(pred->getTerminator());
+        if (br == NULL || br->isUnconditional() || br->getSuccessor(0) == br->getSuccessor(1)) return;
+
+        ICmpInst *cmp = dyn_cast<ICmpInst>(br->getCondition());
+        if (cmp == NULL || !cmp->isEquality()) return;
+
+        Value *tested = NULL;
+        if (isa<ConstantPointerNull>(cmp->getOperand(1))) tested = cmp->getOperand(0);
+        else if (isa<ConstantPointerNull>(cmp->getOperand(0))) tested = cmp->getOperand(1);
+        if (tested == NULL) return;
+
+        // p != NULL holds on the true edge of `ne`, and the false edge of `eq`.
+        unsigned nonNilEdge = cmp->getPredicate() == ICmpInst::ICMP_NE ? 0 : 1;
+        unsigned id = idOf(tested);
+        if (br->getSuccessor(nonNilEdge) == BB && id < values.size()) in.set(id);
+    }
+};
+
+/// Legacy pass manager wrapper, so that other passes can
+/// `getAnalysis<NullnessInfoWrapperPass>().getNullnessInfo()`.
+class NullnessInfoWrapperPass : public FunctionPass {
+    std::unique_ptr<NullnessInfo> info;
+
+public:
+    static char ID;
+    NullnessInfoWrapperPass() : FunctionPass(ID) {}
+
+    NullnessInfo &getNullnessInfo() { return *info; }
+
+    void getAnalysisUsage(AnalysisUsage &usage) const override {
+        usage.addRequired<DominatorTreeWrapperPass>();
+        usage.setPreservesAll();
+    }
+
+    bool runOnFunction(Function &function) override {
+        DominatorTree &dominators = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+        info.reset(new NullnessInfo(function, dominators));
+        return false;
+    }
+
+    void releaseMemory() override { info.reset(); }
+
+    void print(raw_ostream &os, const Module *) const override {
+        if (info) info->print(os);
+    }
+};
+
+#endif // NULLNESS_INFO_H
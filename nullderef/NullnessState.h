@@ -0,0 +1,98 @@
+#ifndef NULLNESS_STATE_H
+#define NULLNESS_STATE_H 1
+
+#include <llvm/ADT/BitVector.h>
+
+#include "PointerGraph.h"
+
+using namespace llvm;
+
+/// The nullness of a fixed set of pointer slots at one program point.
+///
+/// Every slot uses the bits of graph::LeafNodeType (NIL = 1, NON_NIL = 2,
+/// UNDEFINED = 8), but the bits are spread over three dense bit vectors:
+/// bit `i` of `mayBeNil` says that slot `i` may hold NULL, bit `i` of
+/// `mayBeNonNil` that it may hold a valid pointer, and bit `i` of
+/// `mayDangle` that it may hold a pointer that can't be dereferenced,
+/// because it was freed or never initialised. Joining and comparing two
+/// states are therefore bitwise operations over whole words, independent
+/// of how the slots are used.
+///
+/// A slot with no bit set has no value at all: the program point is
+/// unreachable. `get` reports this bottom element as 0, like a value the
+/// flow engine hasn't evaluated yet.
+class NullnessState {
+    BitVector mayBeNil;
+    BitVector mayBeNonNil;
+    BitVector mayDangle;
+
+public:
+    NullnessState() {}
+    explicit NullnessState(unsigned slots) : mayBeNil(slots), mayBeNonNil(slots), mayDangle(slots) {}
+
+    unsigned size() const { return mayBeNil.size(); }
+
+    /// The graph::LeafNodeType bits `slot` may hold, 0 if none.
+    unsigned get(unsigned slot) const {
+        return (mayBeNil.test(slot) ? graph::NIL : 0)
+             | (mayBeNonNil.test(slot) ? graph::NON_NIL : 0)
+             | (mayDangle.test(slot) ? graph::UNDEFINED : 0);
+    }
+
+    /// Strong update: `slot` holds exactly the bits of `type` from now on.
+    void set(unsigned slot, unsigned type) {
+        mayBeNil[slot] = (type & graph::NIL) != 0;
+        mayBeNonNil[slot] = (type & graph::NON_NIL) != 0;
+        mayDangle[slot] = (type & graph::UNDEFINED) != 0;
+    }
+
+    /// Set every slot to UNDEFINED, as at the entry of a function where
+    /// nothing was stored yet.
+    void setUninitialised() {
+        mayBeNil.reset();
+        mayBeNonNil.reset();
+        mayDangle.set();
+    }
+
+    /// `free` was called on the pointer in `slot`: unless it is NULL on
+    /// every path, it dangles now.
+    void markFreed(unsigned slot) {
+        if (get(slot) == graph::NIL) return;
+        set(slot, graph::UNDEFINED);
+    }
+
+    /// Refine `slot` with what a branch condition tells us about it. A
+    /// dangling pointer still compares unequal to NULL. Returns false if
+    /// the slot ends up without a value, i.e. the branch can't be taken
+    /// with this state.
+    bool refine(unsigned slot, graph::LeafNodeType type) {
+        if ((type & graph::NIL) == 0) mayBeNil.reset(slot);
+        if ((type & graph::NON_NIL) == 0) {
+            mayBeNonNil.reset(slot);
+            mayDangle.reset(slot);
+        }
+        return get(slot) != 0;
+    }
+
+    /// Least upper bound, used where control flow merges. Returns true if
+    /// this state changed.
+    bool join(const NullnessState &other) {
+        // BitVector::test(RHS) checks whether `this - RHS` is non-empty
+        bool changed = other.mayBeNil.test(mayBeNil) || other.mayBeNonNil.test(mayBeNonNil)
+                    || other.mayDangle.test(mayDangle);
+        mayBeNil |= other.mayBeNil;
+        mayBeNonNil |= other.mayBeNonNil;
+        mayDangle |= other.mayDangle;
+        return changed;
+    }
+
+    bool operator==(const NullnessState &other) const {
+        return mayBeNil == other.mayBeNil && mayBeNonNil == other.mayBeNonNil && mayDangle == other.mayDangle;
+    }
+
+    bool operator!=(const NullnessState &other) const {
+        return !(*this == other);
+    }
+};
+
+#endif // NULLNESS_STATE_H
@@ -0,0 +1,173 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H 1
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <llvm/Support/Format.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+/// The hardware events we count.
+enum PerfEvent {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    NUM_PERF_EVENTS
+};
+
+/// What one region of code cost.
+struct PerfSample {
+    /** Counter values; only meaningful if `counted` is set. */
+    uint64_t values[NUM_PERF_EVENTS] = {};
+    bool counted = false;
+
+    double millis = 0;
+
+    PerfSample &operator+=(const PerfSample &other) {
+        for (unsigned e = 0; e < NUM_PERF_EVENTS; ++e) values[e] += other.values[e];
+        counted |= other.counted;
+        millis += other.millis;
+        return *this;
+    }
+
+    void print(raw_ostream &os) const {
+        if (counted) {
+            os << "cycles=" << values[PERF_CYCLES]
+               << " instructions=" << values[PERF_INSTRUCTIONS];
+            if (values[PERF_CYCLES] != 0) {
+                os << " IPC=" << format("%.2f", (double) values[PERF_INSTRUCTIONS] / values[PERF_CYCLES]);
+            }
+            os << " L1D-misses=" << values[PERF_L1D_MISSES]
+               << " LLC-misses=" << values[PERF_LLC_MISSES]
+               << " branch-misses=" << values[PERF_BRANCH_MISSES] << " ";
+        }
+        os << "ms=" << format("%.3f", millis);
+    }
+};
+
+/// Hardware performance counters for the calling thread, read with
+/// perf_event_open(2). Where they can't be opened (not Linux, no PMU in
+/// a VM, perf_event_paranoid too high), only wall-clock time is measured.
+///
+/// Usage: `start()` before the region, `stop()` after it.
+class PerfCounters {
+    typedef std::chrono::steady_clock Clock;
+
+    int fds[NUM_PERF_EVENTS];
+    std::string unavailable;
+    Clock::time_point begin;
+
+public:
+    PerfCounters() {
+        for (unsigned e = 0; e < NUM_PERF_EVENTS; ++e) fds[e] = -1;
+
+#ifdef __linux__
+        const uint64_t l1dReadMiss = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                                   | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        const uint64_t llcReadMiss = PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                                   | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+
+        fds[PERF_CYCLES] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        fds[PERF_INSTRUCTIONS] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        fds[PERF_L1D_MISSES] = open(PERF_TYPE_HW_CACHE, l1dReadMiss);
+        fds[PERF_LLC_MISSES] = open(PERF_TYPE_HW_CACHE, llcReadMiss);
+        fds[PERF_BRANCH_MISSES] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+
+        // All or nothing: a partial set would be misleading.
+        for (unsigned e = 0; e < NUM_PERF_EVENTS; ++e) {
+            if (fds[e] == -1) {
+                unavailable = strerror(errno);
+                close();
+                break;
+            }
+        }
+#else
+        unavailable = "perf_event_open is Linux only";
+#endif
+    }
+
+    ~PerfCounters() { close(); }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters &operator=(const PerfCounters&) = delete;
+
+    bool available() const { return unavailable.empty(); }
+
+    /// Why the counters are not available.
+    const std::string &reason() const { return unavailable; }
+
+    void start() {
+#ifdef __linux__
+        for (int fd : fds) {
+            if (fd == -1) continue;
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+        begin = Clock::now();
+    }
+
+    PerfSample stop() {
+        PerfSample sample;
+        sample.millis = std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+
+#ifdef __linux__
+        for (int fd : fds) {
+            if (fd != -1) ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        }
+        if (!available()) return sample;
+
+        sample.counted = true;
+        for (unsigned e = 0; e < NUM_PERF_EVENTS; ++e) {
+            // Scale up if the kernel had to multiplex the counters.
+            uint64_t data[3]; // value, time enabled, time running
+            if (read(fds[e], data, sizeof(data)) != sizeof(data)) {
+                sample.counted = false;
+                break;
+            }
+            sample.values[e] = data[2] == 0 ? 0 : (uint64_t) ((double) data[0] * data[1] / data[2]);
+        }
+#endif
+        return sample;
+    }
+
+private:
+#ifdef __linux__
+    static int open(uint32_t type, uint64_t config) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return (int) syscall(__NR_perf_event_open, &attr, 0 /* this thread */, -1 /* any cpu */, -1, 0);
+    }
+#endif
+
+    void close() {
+#ifdef __linux__
+        for (int &fd : fds) {
+            if (fd != -1) ::close(fd);
+            fd = -1;
+        }
+#endif
+    }
+};
+
+#endif // PERF_COUNTERS_H
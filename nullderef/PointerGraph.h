@@ -1,16 +1,27 @@
 #ifndef POINTER_GRAPH_H
 #define POINTER_GRAPH_H 1
 
+#include <algorithm>
+#include <cassert>
 #include <string>
 #include <sstream>
 #include <vector>
 #include <iomanip>
+#include <memory>
+#include <type_traits>
 #include <unordered_map>
 
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/SmallVector.h>
 #include <llvm/IR/ValueMap.h>
 #include <llvm/IR/Value.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/ErrorHandling.h>
 #include <llvm/Support/raw_ostream.h>
 
+#include "GraphTrace.h"
+
 using std::string;
 using std::stringstream;
 using std::vector;
@@ -58,13 +69,9 @@ class Node {
     Node(RefNode ref) : type(REFERENCE_NODE), ref(ref) {}
 
 public:
-    Node(const Node &other) : type(other.type) {
-        switch (type) {
-        case LEAF_NODE: leaf = other.leaf; break;
-        case REFERENCE_NODE: ref = other.ref; break;
-        default: throw "unreachable";
-        }
-    }
+    // Both union members are trivially copyable, so copying the bytes is enough.
+    Node(const Node &other) noexcept = default;
+    Node &operator=(const Node &other) noexcept = default;
 
     static Node newLeafNode(LeafNodeType type) { return Node(LeafNode(type)); }
     static Node newRefNode(Node* referenced) { return Node(RefNode(referenced)); }
@@ -80,27 +87,31 @@ public:
     }
 
     /// Turn this node into a REF node point to the given node.
-    void transformToRefNode(Node *referenced) {
-        if (type != LEAF_NODE) throw "Transforming REF to REF node.";
+    Error transformToRefNode(Node *referenced) {
+        if (type != LEAF_NODE) {
+            return createStringError(inconvertibleErrorCode(), "Transforming REF to REF node.");
+        }
 
+        if (Trace *trace = Trace::active()) trace->recordTransform(this, referenced);
         type = REFERENCE_NODE;
         ref.referenced = referenced;
+        return Error::success();
     }
 
     int32_t depth() const {
         switch (type) {
         case LEAF_NODE: return 0;
         case REFERENCE_NODE: return 1 + ref.referenced->depth();
-        default: throw "unreachable";
         }
+        llvm_unreachable("invalid node type");
     }
 
     LeafNodeType status() const {
         switch (type) {
         case LEAF_NODE: return leaf.type;
         case REFERENCE_NODE: return NON_NIL;
-        default: throw "unreachable";
         }
+        llvm_unreachable("invalid node type");
     }
 
     string dumpHexId() const {
@@ -152,6 +163,31 @@ public:
     }
 };
 
+/// The leaf of `type` shared by every graph, or NULL if leaves of that
+/// type can't be shared. Nothing is ever stored, loaded or released
+/// through a NIL or UNDEFINED pointer (that is the error we report), so
+/// those leaves never change. NON_NIL and DONT_KNOW leaves may get a
+/// pointee, or be released, in place: each is an object.
+inline Node *sharedLeaf(LeafNodeType type) {
+    static Node nil = Node::newLeafNode(NIL);
+    static Node undefined = Node::newLeafNode(UNDEFINED);
+
+    switch (type) {
+    case NIL: return &nil;
+    case UNDEFINED: return &undefined;
+    default: return NULL;
+    }
+}
+
+inline bool isShared(const Node *node) {
+    return node->isLeaf() && sharedLeaf(node->status()) == node;
+}
+
+/// Record the graph operations of this thread into `file` (see Trace).
+inline void startTrace(TraceFile &file) {
+    Trace::start(file, sharedLeaf(NIL), sharedLeaf(UNDEFINED));
+}
+
 struct OffsetNodeKey {
     Node *original;
     int64_t offset;
@@ -163,7 +199,7 @@ struct OffsetNodeKey {
     friend bool operator ==(const OffsetNodeKey&, const OffsetNodeKey&);
 };
 
-bool operator==(const graph::OffsetNodeKey &lhs, const graph::OffsetNodeKey &rhs) {
+inline bool operator==(const graph::OffsetNodeKey &lhs, const graph::OffsetNodeKey &rhs) {
     return lhs.original == rhs.original && lhs.offset == rhs.offset;
 }
 
@@ -197,10 +233,47 @@ namespace graph {
 /// the graph. Given an LLVM value, we are able to look-up information
 /// like "is this value NULL?", or "what does this node reference?",
 /// etc.
-class Graph {
+///
+/// A graph can start from a shared, read-only `base` graph (the module's
+/// globals, see GlobalGraph): its entry points and offset nodes are
+/// visible here, but a node of the base is copied into this graph the
+/// first time it is modified, and from then on every lookup that would
+/// find the base node finds the copy.
+///
+/// Nodes are carved out of slabs, which `reset` keeps along with the
+/// buckets of the maps, so a graph reused for function after function
+/// stops allocating once it has grown to the largest of them.
+///
+/// NIL and UNDEFINED leaves are shared (see sharedLeaf), and `release`
+/// and `collect` let the Visitor drop the entry points of values it is
+/// done with and reuse the nodes no entry point reaches any more, so that
+/// a long function needs as many nodes as it has live pointers.
+///
+/// The entry points are kept in an `EntryMap` from Value* to Node*: a
+/// ValueMap for the analyses (Graph), a plain DenseMap where the values
+/// are only numbers (nullderef-replay).
+template <typename EntryMap>
+class BasicGraph {
+    typedef std::aligned_storage<sizeof(Node), alignof(Node)>::type NodeStorage;
+    static const size_t SLAB_NODES = 256;
+
+    vector<std::unique_ptr<NodeStorage[]>> slabs;
+    size_t slabsUsed = 0;
+    size_t nodesInSlab = SLAB_NODES; // in the last slab used
+
     vector<Node*> allocations;
+    vector<Node*> freeNodes;              // reclaimed by `collect`
+    size_t nextCollection = 0;            // twice the nodes left by the last `collect`
     unordered_map<OffsetNodeKey, Node*> offsetNodes;
-    ValueMap<Value*, Node*> entryMap;
+    DenseMap<const Node*, SmallVector<int64_t, 4>> offsetKeys; // node => its offsets in `offsetNodes`
+    EntryMap entryMap;
+
+    const BasicGraph *base;
+    DenseMap<const Node*, Node*> copies;       // node of `base` => its copy
+    DenseMap<const Node*, const Node*> originals; // copy => node of `base`
+
+    /// Nodes of a frozen graph, which may be used as a base.
+    DenseSet<const Node*> frozenNodes;
 
     /*
      * The following three private functions are the only functions
@@ -212,10 +285,25 @@ class Graph {
     /// is returned.
     Node *updateNode(Node *oldNode, Node newNode) {
         if (oldNode == NULL) {
-            Node *heapNode = new Node(newNode);
-            allocations.push_back(heapNode);
-            return heapNode;
+            if (!freeNodes.empty()) {
+                Node *reused = new (freeNodes.back()) Node(newNode);
+                freeNodes.pop_back();
+                allocations.push_back(reused);
+                if (Trace *trace = Trace::active()) trace->allocated(reused);
+                return reused;
+            }
+            if (nodesInSlab == SLAB_NODES) {
+                if (slabsUsed == slabs.size()) slabs.emplace_back(new NodeStorage[SLAB_NODES]);
+                ++slabsUsed;
+                nodesInSlab = 0;
+            }
+            // Nodes are trivially destructible: the slabs are freed as they are.
+            Node *slabNode = new (&slabs[slabsUsed - 1][nodesInSlab++]) Node(newNode);
+            allocations.push_back(slabNode);
+            if (Trace *trace = Trace::active()) trace->allocated(slabNode);
+            return slabNode;
         } else {
+            assert(!isShared(oldNode) && "modifying a shared leaf");
             *oldNode = newNode;
             return oldNode;
         }
@@ -228,61 +316,320 @@ class Graph {
 
     /// Add an offset node to the offset node map.
     void setOffsetNode(OffsetNodeKey key, Node* node) {
-        offsetNodes[key] = node;
+        auto inserted = offsetNodes.insert({key, node});
+        if (inserted.second) offsetKeys[key.original].push_back(key.offset);
+        else inserted.first->second = node;
     }
 
-public:
-    Graph() {}
+    /// A node with the contents of `node`: the shared leaf, or a new one.
+    Node *newNode(Node node) {
+        if (node.isLeaf()) {
+            if (Node *shared = sharedLeaf(node.status())) return shared;
+        }
+        return updateNode(NULL, node);
+    }
+
+    /// See getMutableNode.
+    Node *mutableNode(Value *value) {
+        Node *node = getNode(value);
+        if (isShared(node)) {
+            Node *own = updateNode(NULL, *node);
+            setEntryPoint(value, own);
+            return own;
+        }
+        if (base == NULL || !base->frozenNodes.count(node)) return node;
+
+        Node *copy = newNode(*node);
+        copies[node] = copy;
+        originals[copy] = node;
+        return copy;
+    }
 
-    ~Graph() {
-        // free graph nodes
-        while (!allocations.empty()) {
-            delete allocations.back();
-            allocations.pop_back();
+    /// See getOffset.
+    Expected<Node*> offsetNode(Value *value, int64_t offset) {
+        if (!isEntryPoint(value)) {
+            return createStringError(inconvertibleErrorCode(), "Creating offset of something I don't know");
         }
+
+        Node *node = getNode(value);
+        Node *keyNode = offsetKey(node);
+
+        auto it = offsetNodes.find(OffsetNodeKey(keyNode, offset));
+        if (it != offsetNodes.end()) return it->second;
+
+        if (base != NULL) {
+            if (Node *shared = base->sharedOffset(keyNode, offset)) return resolve(shared);
+        }
+
+        Node *leaf = newNode(Node::newLeafNode(node->status())); // take status of base
+        setOffsetNode(OffsetNodeKey(keyNode, offset), leaf);
+        return leaf;
+    }
+
+    /// The node the offsets of `node` are keyed by: offsets of a copied
+    /// node stay keyed by the node of the base graph.
+    Node *offsetKey(const Node *node) const {
+        auto original = originals.find(node);
+        return const_cast<Node*>(original == originals.end() ? node : original->second);
+    }
+
+    /// See setOffset. Allocates at most one node, the one returned.
+    Node *updateOffset(Node *node, int64_t offset, Node contents) {
+        OffsetNodeKey key(offsetKey(node), offset);
+        auto it = offsetNodes.find(key);
+        Node *field = it != offsetNodes.end() ? it->second : NULL;
+        if (field == NULL && base != NULL) field = base->sharedOffset(key.original, offset);
+
+        if (field == NULL || isShared(field)) {
+            Node *own = newNode(contents);
+            setOffsetNode(key, own);
+            return own;
+        }
+        field = resolve(field);
+        if (base == NULL || !base->frozenNodes.count(field)) return updateNode(field, contents);
+
+        Node *copy = updateNode(NULL, contents);
+        copies[field] = copy;
+        originals[copy] = field;
+        return copy;
+    }
+
+    /// The "node" operand of a trace event for `node`.
+    static uint64_t traceOperand(Trace *trace, Node &node) {
+        if (node.isRef()) return trace->refOperand(node.refPtr()->getReferenced());
+        return Trace::leafOperand(node.status());
+    }
+
+    /// The offset node of `node` at `offset` in a base graph, or NULL.
+    Node *sharedOffset(const Node *node, int64_t offset) const {
+        auto it = offsetNodes.find(OffsetNodeKey(const_cast<Node*>(node), offset));
+        return it == offsetNodes.end() ? NULL : it->second;
+    }
+
+public:
+    /// By default, `collectIfDue` doesn't bother below this many nodes.
+    static const size_t MIN_COLLECTION = 4096;
+
+    BasicGraph(const BasicGraph *base = NULL) : base(base) {
+        if (Trace *trace = Trace::active()) trace->recordReset(this, base);
+    }
+
+    BasicGraph(const BasicGraph&) = delete;
+    BasicGraph &operator=(const BasicGraph&) = delete;
+
+    /// Remove every node and entry point, and start again from `base`.
+    /// The memory of the nodes and maps is kept for the next function.
+    void reset(const BasicGraph *base = NULL) {
+        allocations.clear();
+        freeNodes.clear();
+        nextCollection = 0;
+        slabsUsed = 0;
+        nodesInSlab = SLAB_NODES;
+        offsetNodes.clear();
+        offsetKeys.clear();
+        entryMap.clear();
+        copies.clear();
+        originals.clear();
+        frozenNodes.clear();
+        this->base = base;
+        if (Trace *trace = Trace::active()) trace->recordReset(this, base);
     }
 
     /// Insert a new node in the graph without creating an entry with an LLVM value.
     Node *insertNode(Node node) {
-        return updateNode(NULL, node);
+        Node *result = newNode(node);
+        if (Trace *trace = Trace::active()) trace->recordInsert(this, traceOperand(trace, node), result);
+        return result;
     }
 
     /// Insert a new node in the graph and make the given value an entry point into the graph.
     Node *insertNode(Value *value, Node node) {
+        Node *result;
         if (isEntryPoint(value)) {
-            return updateNode(getNode(value), node);
+            result = updateNode(mutableNode(value), node);
         } else {
-            Node *result = updateNode(NULL, node);
+            result = newNode(node);
             setEntryPoint(value, result);
-            return result;
         }
+        if (Trace *trace = Trace::active()) {
+            trace->recordInsertEntry(this, value, traceOperand(trace, node), result);
+        }
+        return result;
     }
 
     /// Insert a new entry point; reuse given node.
     void insertNode(Value *value, Node *node) {
         setEntryPoint(value, node);
+        if (Trace *trace = Trace::active()) trace->recordSetEntry(this, value, node);
+    }
+
+    Node *getNode(Value *value) const {
+        auto it = entryMap.find(value);
+        if (it != entryMap.end()) return resolve(it->second);
+        return base != NULL ? resolve(base->getNode(value)) : NULL;
     }
 
-    Node *getNode(Value *value) {
-        return entryMap[value];
+    /// The node of `value`, to modify it. A node of the base graph is
+    /// copied into this one first; for a shared leaf, `value` gets a leaf
+    /// of its own.
+    Node *getMutableNode(Value *value) {
+        Node *result = mutableNode(value);
+        if (Trace *trace = Trace::active()) trace->recordMutable(this, value, result);
+        return result;
+    }
+
+    /// `node`, or its copy if it is a node of the base graph that has been
+    /// modified here. Nodes reached through a REF node must go through this.
+    Node *resolve(Node *node) const {
+        if (node == NULL || copies.empty()) return node;
+        auto it = copies.find(node);
+        return it == copies.end() ? node : it->second;
+    }
+
+    /// `value` won't be looked up again: remove its entry point. Its node
+    /// stays until `collect` finds nothing else reaches it.
+    void release(Value *value) {
+        entryMap.erase(value);
+        if (Trace *trace = Trace::active()) trace->recordRelease(this, value);
+    }
+
+    /// Reclaim the nodes that no entry point reaches, through references
+    /// and offsets, if the graph has at least `minNodes` nodes and has
+    /// doubled since the last time; every time if `minNodes` is 0.
+    void collectIfDue(size_t minNodes = MIN_COLLECTION) {
+        if (minNodes != 0 && allocations.size() < std::max(minNodes, nextCollection)) return;
+        collect();
+        nextCollection = 2 * allocations.size();
+    }
+
+    /// Reclaim the nodes that no entry point reaches, through references
+    /// and offsets: their memory goes to the next nodes inserted.
+    void collect() {
+        if (Trace *trace = Trace::active()) trace->recordCollect(this);
+
+        // Offset nodes by the node they are an offset of.
+        DenseMap<const Node*, SmallVector<Node*, 2>> offsetsOf;
+        for (auto &p : offsetNodes) offsetsOf[p.first.original].push_back(p.second);
+
+        DenseSet<const Node*> marked;
+        vector<Node*> stack;
+        auto reach = [&](Node *node) {
+            if (node != NULL && marked.insert(node).second) stack.push_back(node);
+        };
+
+        for (auto p : entryMap) reach(resolve(p.second));
+        for (auto &p : copies) reach(p.second);
+        // Offsets of nodes we don't own (the base's, the shared leaves)
+        // may be found from the base's entry points.
+        for (auto &p : offsetsOf) {
+            if (isShared(p.first) || (base != NULL && base->frozenNodes.count(p.first))) {
+                for (Node *offset : p.second) reach(offset);
+            }
+        }
+
+        while (!stack.empty()) {
+            Node *node = stack.back();
+            stack.pop_back();
+            if (node->isRef()) reach(resolve(node->refPtr()->getReferenced()));
+
+            auto original = originals.find(node);
+            auto offsets = offsetsOf.find(original == originals.end() ? node : original->second);
+            if (offsets != offsetsOf.end()) {
+                for (Node *offset : offsets->second) reach(offset);
+            }
+        }
+
+        size_t live = 0;
+        for (Node *node : allocations) {
+            if (marked.count(node)) allocations[live++] = node;
+            else freeNodes.push_back(node);
+        }
+        allocations.resize(live);
+
+        for (auto it = offsetNodes.begin(); it != offsetNodes.end();) {
+            Node *key = it->first.original;
+            bool owned = !isShared(key) && (base == NULL || !base->frozenNodes.count(key));
+            if (owned && !marked.count(key)) {
+                offsetKeys.erase(key);
+                it = offsetNodes.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    /// Make this graph read-only, so that it can be the base of others.
+    void freeze() {
+        frozenNodes.insert(allocations.begin(), allocations.end());
+        if (Trace *trace = Trace::active()) trace->recordFreeze(this);
+    }
+
+    /// Make `node` the offset node of `base` at `offset`.
+    void insertOffsetNode(Node *base, int64_t offset, Node *node) {
+        setOffsetNode(OffsetNodeKey(base, offset), node);
+        if (Trace *trace = Trace::active()) trace->recordInsertOffset(this, base, offset, node);
     }
 
     /// Get the offset node or creates and returns a new LEAF node with
-    /// the same status as the given value's status.
-    Node *getOffset(Value *value, int64_t offset) {
-        if (!isEntryPoint(value)) throw "Creating offset of something I don't know";
+    /// the same status as the given value's status. Fails if `value`
+    /// isn't an entry point.
+    Expected<Node*> getOffset(Value *value, int64_t offset) {
+        Expected<Node*> result = offsetNode(value, offset);
+        if (Trace *trace = Trace::active()) trace->recordOffset(this, value, offset, result ? *result : NULL);
+        return result;
+    }
 
-        Node *base = getNode(value);
-        if (containsOffsetNode(base, offset))
-            return offsetNodes[OffsetNodeKey(base, offset)];
+    /// The offset node of `node` at `offset`, if it has one, or NULL.
+    /// Unlike getOffset, nothing is created.
+    Node *findOffset(const Node *node, int64_t offset) const {
+        Node *key = offsetKey(node);
+        auto it = offsetNodes.find(OffsetNodeKey(key, offset));
+        if (it != offsetNodes.end()) return it->second;
+        return base != NULL ? resolve(base->sharedOffset(key, offset)) : NULL;
+    }
 
-        Node *leaf = insertNode(Node::newLeafNode(base->status())); // take status of base
-        setOffsetNode(OffsetNodeKey(base, offset), leaf);
-        return leaf;
+    /// The offsets `node` has offset nodes at, here or in the base graph,
+    /// in increasing order: its field table.
+    SmallVector<int64_t, 8> offsetsOf(const Node *node) const {
+        Node *key = offsetKey(node);
+        SmallVector<int64_t, 8> offsets;
+        auto own = offsetKeys.find(key);
+        if (own != offsetKeys.end()) offsets.append(own->second.begin(), own->second.end());
+        if (base != NULL) {
+            auto shared = base->offsetKeys.find(key);
+            if (shared != base->offsetKeys.end()) offsets.append(shared->second.begin(), shared->second.end());
+        }
+        std::sort(offsets.begin(), offsets.end());
+        offsets.erase(std::unique(offsets.begin(), offsets.end()), offsets.end());
+        return offsets;
+    }
+
+    /// Give the offset node of `node` at `offset` the contents `contents`,
+    /// and return it. The offset node is changed in place, so every value
+    /// it is the node of sees the change; an offset node of the base graph
+    /// is copied first, and one that is missing or a shared leaf is
+    /// replaced. This is how the field table of an object is written
+    /// without a value for each field (see Visitor::transferObject).
+    Node *setOffset(Node *node, int64_t offset, Node contents) {
+        Node *result = updateOffset(node, offset, contents);
+        if (Trace *trace = Trace::active()) {
+            trace->recordSetOffset(this, node, offset, traceOperand(trace, contents), result);
+        }
+        return result;
+    }
+
+    /// Number of nodes in the graph.
+    size_t size() const {
+        return allocations.size();
     }
 
-    bool isEntryPoint(Value *value) {
-        return entryMap.count(value) != 0;
+    /// Number of nodes the graph can hold before it allocates again.
+    size_t capacity() const {
+        return slabs.size() * SLAB_NODES;
+    }
+
+    bool isEntryPoint(Value *value) const {
+        return entryMap.count(value) != 0 || (base != NULL && base->isEntryPoint(value));
     }
 
     bool containsOffsetNode(Value *value, int64_t offset) {
@@ -290,8 +637,8 @@ public:
         return containsOffsetNode(getNode(value), offset);
     }
 
-    bool containsOffsetNode(Node *base, int64_t offset) {
-        return offsetNodes.count(OffsetNodeKey(base, offset)) != 0;
+    bool containsOffsetNode(Node *node, int64_t offset) {
+        return offsetNodes.count(OffsetNodeKey(node, offset)) != 0;
     }
 
     string dump(Value *value) {
@@ -320,7 +667,7 @@ public:
         os << "\nENTRY POINTS INTO GRAPH:\n";
         for (auto p : entryMap) {
             os << " - " << std::left << std::setw(60) << dump(p.first);
-            os << " => " << p.second->dump();
+            os << " => " << resolve(p.second)->dump();
             os << "\n";
         }
 
@@ -331,12 +678,17 @@ public:
             os << "\n";
         }
 
+        if (base != NULL) {
+            os << "\nSHARED GLOBAL ENTRIES: " << base->entryMap.size()
+               << " (" << copies.size() << " nodes copied)\n";
+        }
+
         return buf.str();
     }
 
 };
 
-
+typedef BasicGraph<ValueMap<Value*, Node*>> Graph;
 
 } // namespace graph
 
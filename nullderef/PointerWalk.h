@@ -0,0 +1,197 @@
+#ifndef POINTER_WALK_H
+#define POINTER_WALK_H 1
+
+#include <string>
+#include <utility>
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/Analysis/AliasAnalysis.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "ErrorCode.h"
+#include "HeapModel.h"
+#include "LoweredFunction.h"
+#include "PointsTo.h"
+
+using std::string;
+using namespace llvm;
+
+/// What the engines that compute statuses on demand, from the dereference
+/// back to the stores (ClobberAnalysis, DemandAnalysis), have in common:
+/// checking the dereferences, following a pointer through the values it
+/// was computed from, and placing it in the object it points into. They
+/// only differ in how they find what a load reads.
+///
+/// `Engine` derives from PointerWalk<Engine>, like an InstVisitor, and
+/// provides:
+///
+///  - `unsigned status(Value*)`: the memoized status of a value, as
+///    graph::LeafNodeType bits, that calls `compute` for the ones that
+///    `fixedStatus` doesn't know;
+///  - `unsigned contents(LoadInst*)`: the status of the pointer a load
+///    reads from a valid address;
+///  - `Value *loadedValue(LoadInst*)`: the value a load reads, if a single
+///    store writes it, or NULL;
+///  - `bool freedBefore(Value *ptr, Instruction *at)`: has the object
+///    `ptr` points into been freed on every path to `at`?
+template <typename Engine>
+class PointerWalk {
+public:
+    /// The error at `I`, if any.
+    ErrorCode result(Instruction &I) {
+        if (LoadInst *load = dyn_cast<LoadInst>(&I)) return checkDeref(load->getPointerOperand(), &I);
+        if (StoreInst *store = dyn_cast<StoreInst>(&I)) return checkDeref(store->getPointerOperand(), &I);
+
+        if (MemIntrinsic *mem = dyn_cast<MemIntrinsic>(&I)) {
+            ErrorCode code = checkDeref(mem->getDest(), &I);
+            if (MemTransferInst *transfer = dyn_cast<MemTransferInst>(mem)) {
+                if (code == OK) code = checkDeref(transfer->getSource(), &I);
+            }
+            return code;
+        }
+
+        // free(NULL) does nothing, but releasing an object twice does.
+        CallBase *call = dyn_cast<CallBase>(&I);
+        if (call != NULL && heapCallKind(*call) == RELEASES) {
+            Value *ptr = call->getArgOperand(0);
+            unsigned s = engine().status(ptr->stripPointerCasts());
+            if (s == graph::NIL) return OK;
+            return s == graph::UNDEFINED || engine().freedBefore(ptr, &I) ? UNDEFINED_DEREF : OK;
+        }
+        return OK;
+    }
+
+    /// The status of the pointer `value`, on every path.
+    graph::LeafNodeType valueStatus(Value *value) {
+        unsigned s = engine().status(value);
+        return s == 0 ? graph::DONT_KNOW : (graph::LeafNodeType) s;
+    }
+
+protected:
+    /// A pointer as an offset from the object it points into.
+    typedef std::pair<Value*, int64_t> Place;
+
+    Function &function;
+    const DataLayout &layout;
+    const PointsTo *pointsTo;
+
+    PointerWalk(Function &function, const PointsTo *pointsTo)
+        : function(function), layout(function.getParent()->getDataLayout()), pointsTo(pointsTo) {}
+
+    Engine &engine() { return static_cast<Engine&>(*this); }
+
+    ErrorCode checkDeref(Value *ptr, Instruction *at) {
+        unsigned s = engine().status(ptr->stripPointerCasts());
+        if (s == graph::NIL) return NULL_DEREF;
+        if (s == graph::UNDEFINED || engine().freedBefore(ptr, at)) return UNDEFINED_DEREF;
+        return OK;
+    }
+
+    /// The status of `value` if it doesn't depend on memory: constants,
+    /// and arguments with the points-to analysis. DONT_KNOW for other
+    /// values that aren't instructions, 0 for the instructions to compute.
+    unsigned fixedStatus(Value *value) {
+        unsigned fixed = LoweredFunction::fixedStatus(value);
+        if (fixed != 0 && fixed != graph::DONT_KNOW) return fixed;
+        if (pointsTo != NULL && isa<Argument>(value)) return pointsTo->nullness(value);
+        return fixed;
+    }
+
+    /// The status of the instruction `value`, from its operands.
+    unsigned compute(Value *value) {
+        if (LoadInst *load = dyn_cast<LoadInst>(value)) {
+            unsigned address = engine().status(load->getPointerOperand()->stripPointerCasts());
+            if (address == graph::NIL || address == graph::UNDEFINED) return graph::UNDEFINED; // result of an invalid dereference
+            if (!load->getType()->isPointerTy()) return graph::DONT_KNOW;
+            return engine().contents(load);
+        }
+        if (GetElementPtrInst *gep = dyn_cast<GetElementPtrInst>(value)) {
+            // Same as the Visitor: a field of X has the status of X, unless
+            // we can't tell which field it is.
+            return gep->hasAllConstantIndices() ? engine().status(gep->getPointerOperand()) : graph::DONT_KNOW;
+        }
+        if (isa<BitCastInst>(value) || isa<AddrSpaceCastInst>(value)) {
+            return engine().status(cast<Instruction>(value)->getOperand(0));
+        }
+        if (PHINode *phi = dyn_cast<PHINode>(value)) {
+            unsigned s = 0;
+            for (Value *incoming : phi->incoming_values()) s |= engine().status(incoming);
+            return s;
+        }
+        if (SelectInst *select = dyn_cast<SelectInst>(value)) {
+            return engine().status(select->getTrueValue()) | engine().status(select->getFalseValue());
+        }
+        return graph::DONT_KNOW;
+    }
+
+    /// `pointer` as an offset from the object it points into: constant
+    /// offsets are added up, and a loaded pointer is followed to the value
+    /// stored, when a single store writes it (see `loadedValue`).
+    Place placeOf(const Value *pointer) {
+        Value *ptr = const_cast<Value*>(pointer);
+        auto it = places.find(ptr);
+        if (it != places.end()) return it->second;
+
+        // A pointer loaded from memory it points into (a list walked in a
+        // loop): it is its own place until shown otherwise.
+        places[ptr] = Place(ptr, 0);
+        APInt offset(layout.getIndexTypeSizeInBits(ptr->getType()), 0);
+        Value *base = ptr->stripAndAccumulateConstantOffsets(layout, offset, true);
+
+        Place place(base, offset.getSExtValue());
+        if (LoadInst *load = dyn_cast<LoadInst>(base)) {
+            Value *stored = engine().loadedValue(load);
+            if (stored != NULL && stored->getType()->isPointerTy()) {
+                place = placeOf(stored);
+                place.second += offset.getSExtValue();
+            }
+        }
+        places[ptr] = place;
+        return place;
+    }
+
+    /// Do the `aSize` bytes at `a` and the `bSize` bytes at `b` certainly
+    /// not overlap? A size of 0 is unknown.
+    static bool disjoint(Place a, uint64_t aSize, Place b, uint64_t bSize) {
+        if (a.first != b.first) return isIdentifiedObject(a.first) && isIdentifiedObject(b.first);
+        if (aSize == 0 || bSize == 0) return false;
+        return a.second + (int64_t) aSize <= b.second || b.second + (int64_t) bSize <= a.second;
+    }
+
+    /// What `address` points to when the function is entered.
+    unsigned initialContents(const Value *address) {
+        Value *base = const_cast<Value*>(address)->stripPointerCasts();
+        if (isa<AllocaInst>(base) || pointsTo == NULL) return graph::DONT_KNOW;
+        return pointsTo->pointeeNullness(base);
+    }
+
+    static string dumpValue(Value *value) {
+        if (value->hasName()) return "%" + value->getName().str();
+
+        string s;
+        raw_string_ostream rso(s);
+        value->printAsOperand(rso, false);
+        return rso.str();
+    }
+
+    static const char *dumpStatus(unsigned type) {
+        switch (type) {
+        case graph::NIL: return "NIL";
+        case graph::NON_NIL: return "NON_NIL";
+        case graph::DONT_KNOW: return "DONT_KNOW";
+        case graph::UNDEFINED: return "UNDEFINED";
+        default: return "-";
+        }
+    }
+
+private:
+    /// Where pointers point, as far as followed.
+    DenseMap<Value*, Place> places;
+};
+
+#endif // POINTER_WALK_H
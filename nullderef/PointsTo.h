@@ -0,0 +1,458 @@
+#ifndef POINTS_TO_H
+#define POINTS_TO_H 1
+
+#include <vector>
+#include <utility>
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Module.h>
+
+#include "PointerGraph.h"
+#include "HeapModel.h"
+
+using std::pair;
+using std::vector;
+using namespace llvm;
+
+/// A unification-based (Steensgaard) points-to analysis over a whole
+/// module, extended with the nullness of the pointers involved.
+///
+/// Memory is partitioned into classes of abstract locations that are
+/// kept in a union-find structure. Every class knows the class its
+/// contents point to (`pointee`), and which LeafNodeType bits the
+/// pointers stored in it may have (`nullness`). SSA values get a class of
+/// their own, holding just that value, so loads, stores and copies can
+/// all be expressed as "the contents of class A flow into class B":
+/// their pointees are unified, and A's nullness is added to B's.
+///
+/// Unification happens while walking the module once. The nullness flow
+/// edges are only resolved at the end, on the final classes, so the whole
+/// analysis is close to linear in the size of the module.
+///
+/// Code we can't see (declarations, indirect calls, callers of
+/// externally visible functions) makes the classes it can reach
+/// `unknown`: their pointers are DONT_KNOW, and so is everything
+/// reachable from them. Only functions and globals with local linkage are
+/// known to have all their uses in the module, unless the caller says that
+/// the module is the whole program (e.g. after LTO).
+class PointsTo {
+    static const unsigned NONE = ~0u;
+
+    struct Class {
+        unsigned parent;
+        unsigned rank = 0;
+        unsigned pointee = NONE;
+        unsigned nullness = 0;  // graph::LeafNodeType bits
+        bool unknown = false;
+
+        Class(unsigned id) : parent(id) {}
+    };
+
+    vector<Class> classes;
+    DenseMap<const Value*, unsigned> registers; // SSA value => class holding it
+    DenseMap<const Value*, unsigned> objects;   // alloca, global, malloc => its memory
+    DenseMap<const Function*, unsigned> returns; // function => class of returned values
+    vector<pair<unsigned, unsigned>> edges;     // nullness flows from first to second
+
+    bool wholeProgram;
+
+public:
+    PointsTo(Module &module, bool wholeProgram = false) : wholeProgram(wholeProgram) {
+        Function *main = module.getFunction("main");
+
+        for (GlobalVariable &global : module.globals()) {
+            unsigned memory = object(&global);
+            if (!global.hasDefinitiveInitializer() || !seesAllUses(global)) {
+                makeUnknown(memory);
+            } else {
+                flow(global.getInitializer(), memory);
+            }
+        }
+
+        for (Function &function : module) {
+            if (function.isDeclaration()) continue;
+
+            bool calledFromOutside = !seesAllUses(function) || function.hasAddressTaken()
+                || &function == main;
+            if (calledFromOutside) {
+                for (Argument &arg : function.args()) {
+                    if (!tracks(arg.getType())) continue;
+                    unsigned reg = registerOf(&arg);
+                    classes[reg].nullness |= graph::DONT_KNOW;
+                    makeUnknown(pointee(reg));
+                }
+            }
+
+            for (BasicBlock &BB : function) {
+                for (Instruction &I : BB) {
+                    addConstraints(I);
+                }
+            }
+        }
+
+        finalize();
+    }
+
+    /// The nullness of the pointer `value`, over all executions.
+    graph::LeafNodeType nullness(Value *value) const {
+        if (isa<ConstantPointerNull>(value)) return graph::NIL;
+        if (isa<UndefValue>(value)) return graph::DONT_KNOW;
+        if (GlobalValue *global = dyn_cast<GlobalValue>(value->stripPointerCasts())) {
+            return global->hasExternalWeakLinkage() ? graph::DONT_KNOW : graph::NON_NIL;
+        }
+
+        auto it = registers.find(value);
+        if (it == registers.end()) return graph::DONT_KNOW;
+        return toStatus(classes[find(it->second)].nullness);
+    }
+
+    /// The nullness of the pointers that a load from `ptr` may return.
+    graph::LeafNodeType pointeeNullness(Value *ptr) const {
+        unsigned memory = memoryOf(ptr);
+        return memory == NONE ? graph::DONT_KNOW : toStatus(classes[memory].nullness);
+    }
+
+    /// May `a` and `b` point into the same memory? Two classes code we
+    /// can't see reaches may be the same memory out there.
+    bool mayAlias(Value *a, Value *b) const {
+        unsigned ma = memoryOf(a), mb = memoryOf(b);
+        return ma == NONE || mb == NONE || ma == mb || (classes[ma].unknown && classes[mb].unknown);
+    }
+
+    size_t numClasses() const { return classes.size(); }
+
+private:
+    /// Are all uses of `global` inside this module?
+    bool seesAllUses(const GlobalValue &global) const {
+        return global.hasLocalLinkage() || wholeProgram;
+    }
+
+    static bool tracks(Type *type) {
+        return type->isPointerTy() || type->isAggregateType() || type->isVectorTy();
+    }
+
+    static graph::LeafNodeType toStatus(unsigned nullness) {
+        switch (nullness) {
+        case graph::NIL: return graph::NIL;
+        case graph::NON_NIL: return graph::NON_NIL;
+        default: return graph::DONT_KNOW;
+        }
+    }
+
+    /* Union-find */
+
+    unsigned newClass() {
+        classes.push_back(Class(classes.size()));
+        return classes.size() - 1;
+    }
+
+    unsigned find(unsigned c) const {
+        while (classes[c].parent != c) c = classes[c].parent;
+        return c;
+    }
+
+    unsigned find(unsigned c) {
+        unsigned root = c;
+        while (classes[root].parent != root) root = classes[root].parent;
+        while (classes[c].parent != root) {
+            unsigned next = classes[c].parent;
+            classes[c].parent = root;
+            c = next;
+        }
+        return root;
+    }
+
+    /// Merge two classes, and (recursively) the classes they point to.
+    void unify(unsigned a, unsigned b) {
+        SmallVector<pair<unsigned, unsigned>, 8> work;
+        work.push_back(std::make_pair(a, b));
+
+        while (!work.empty()) {
+            unsigned x = find(work.back().first);
+            unsigned y = find(work.back().second);
+            work.pop_back();
+            if (x == y) continue;
+
+            if (classes[x].rank < classes[y].rank) std::swap(x, y);
+            if (classes[x].rank == classes[y].rank) classes[x].rank++;
+
+            classes[y].parent = x;
+            classes[x].nullness |= classes[y].nullness;
+            classes[x].unknown |= classes[y].unknown;
+
+            unsigned px = classes[x].pointee, py = classes[y].pointee;
+            if (px == NONE) classes[x].pointee = py;
+            else if (py != NONE) work.push_back(std::make_pair(px, py));
+        }
+    }
+
+    /// The class the contents of class `c` point to.
+    unsigned pointee(unsigned c) {
+        c = find(c);
+        if (classes[c].pointee == NONE) {
+            unsigned p = newClass(); // may move `classes`
+            classes[c].pointee = p;
+        }
+        return find(classes[c].pointee);
+    }
+
+    void makeUnknown(unsigned c) {
+        classes[find(c)].unknown = true;
+    }
+
+    /* Abstract locations */
+
+    unsigned registerOf(const Value *value) {
+        auto it = registers.find(value);
+        if (it != registers.end()) return it->second;
+        unsigned c = newClass();
+        registers[value] = c;
+        return c;
+    }
+
+    unsigned object(const Value *site) {
+        auto it = objects.find(site);
+        if (it != objects.end()) return it->second;
+        unsigned c = newClass();
+        objects[site] = c;
+        return c;
+    }
+
+    unsigned returnOf(const Function *function) {
+        auto it = returns.find(function);
+        if (it != returns.end()) return it->second;
+        unsigned c = newClass();
+        returns[function] = c;
+        return c;
+    }
+
+    /// The class of the memory `ptr` points to, when building constraints.
+    unsigned memory(Value *ptr) {
+        Value *base = ptr->stripPointerCasts();
+        if (GlobalVariable *global = dyn_cast<GlobalVariable>(base)) return object(global);
+        if (isa<Constant>(base)) return newClass(); // null, inttoptr, ...: nothing to share
+        return pointee(registerOf(base));
+    }
+
+    /// The class of the memory `ptr` points to, after finalize().
+    unsigned memoryOf(Value *ptr) const {
+        Value *base = ptr->stripPointerCasts();
+        if (GlobalVariable *global = dyn_cast<GlobalVariable>(base)) {
+            auto it = objects.find(global);
+            return it == objects.end() ? NONE : find(it->second);
+        }
+        auto it = registers.find(base);
+        if (it == registers.end()) return NONE;
+        unsigned pointee = classes[find(it->second)].pointee;
+        return pointee == NONE ? NONE : find(pointee);
+    }
+
+    /* Constraints */
+
+    /// The pointer `value` flows into class `to`.
+    void flow(Value *value, unsigned to) {
+        if (Constant *c = dyn_cast<Constant>(value)) {
+            flow(c, to);
+            return;
+        }
+
+        unsigned from = registerOf(value);
+        unify(pointee(to), pointee(from));
+        edges.push_back(std::make_pair(from, to));
+    }
+
+    /// The pointers in constant `c` flow into class `to`.
+    void flow(Constant *c, unsigned to) {
+        if (isa<ConstantAggregateZero>(c) || isa<ConstantPointerNull>(c)) {
+            classes[find(to)].nullness |= graph::NIL;
+        }
+        else if (isa<ConstantAggregate>(c)) {
+            for (unsigned i = 0; i < c->getNumOperands(); ++i) {
+                flow(cast<Constant>(c->getOperand(i)), to);
+            }
+        }
+        else if (!c->getType()->isPointerTy() || isa<UndefValue>(c)) {
+            return;
+        }
+        else if (GlobalValue *global = dyn_cast<GlobalValue>(c->stripPointerCasts())) {
+            classes[find(to)].nullness |= global->hasExternalWeakLinkage() ? graph::DONT_KNOW : graph::NON_NIL;
+            unify(pointee(to), object(global));
+        }
+        else {
+            // inttoptr and friends
+            classes[find(to)].nullness |= graph::DONT_KNOW;
+            makeUnknown(pointee(to));
+        }
+    }
+
+    /// Everything reachable through `value` can be changed by code we
+    /// don't see.
+    void escape(Value *value) {
+        if (isa<Constant>(value) && !isa<GlobalValue>(value->stripPointerCasts())) return;
+        makeUnknown(memory(value));
+    }
+
+    /// A value that comes from code we don't see.
+    void fromOutside(Value *value) {
+        unsigned reg = registerOf(value);
+        classes[reg].nullness |= graph::DONT_KNOW;
+        makeUnknown(pointee(reg));
+    }
+
+    void addConstraints(Instruction &I) {
+        if (AllocaInst *alloca = dyn_cast<AllocaInst>(&I)) {
+            unsigned reg = registerOf(alloca);
+            classes[reg].nullness |= graph::NON_NIL;
+            unify(pointee(reg), object(alloca));
+        }
+        else if (LoadInst *load = dyn_cast<LoadInst>(&I)) {
+            if (!tracks(load->getType())) return;
+            unsigned from = memory(load->getPointerOperand());
+            unsigned to = registerOf(load);
+            unify(pointee(to), pointee(from));
+            edges.push_back(std::make_pair(from, to));
+        }
+        else if (StoreInst *store = dyn_cast<StoreInst>(&I)) {
+            if (!tracks(store->getValueOperand()->getType())) return;
+            flow(store->getValueOperand(), memory(store->getPointerOperand()));
+        }
+        else if (isa<GetElementPtrInst>(&I) || isa<BitCastInst>(&I) || isa<AddrSpaceCastInst>(&I)
+                || isa<ExtractValueInst>(&I) || isa<ExtractElementInst>(&I)) {
+            // Field-insensitive: a field of X lives in the memory of X.
+            flow(I.getOperand(0), registerOf(&I));
+        }
+        else if (isa<PHINode>(&I) || isa<SelectInst>(&I) || isa<InsertValueInst>(&I)
+                || isa<InsertElementInst>(&I)) {
+            if (!tracks(I.getType())) return;
+            unsigned first = isa<SelectInst>(&I) ? 1 : 0;
+            for (unsigned i = first; i < I.getNumOperands(); ++i) {
+                if (tracks(I.getOperand(i)->getType())) flow(I.getOperand(i), registerOf(&I));
+            }
+        }
+        else if (isa<PtrToIntInst>(&I)) {
+            escape(I.getOperand(0));
+        }
+        else if (isa<IntToPtrInst>(&I)) {
+            fromOutside(&I);
+        }
+        else if (ReturnInst *ret = dyn_cast<ReturnInst>(&I)) {
+            Value *value = ret->getReturnValue();
+            if (value != NULL && tracks(value->getType())) flow(value, returnOf(I.getFunction()));
+        }
+        else if (CallBase *call = dyn_cast<CallBase>(&I)) {
+            addCallConstraints(*call);
+        }
+    }
+
+    void addCallConstraints(CallBase &call) {
+        if (MemTransferInst *transfer = dyn_cast<MemTransferInst>(&call)) {
+            unsigned from = memory(transfer->getRawSource());
+            unsigned to = memory(transfer->getRawDest());
+            unify(pointee(to), pointee(from));
+            edges.push_back(std::make_pair(from, to));
+            return;
+        }
+        if (MemSetInst *memset = dyn_cast<MemSetInst>(&call)) {
+            ConstantInt *value = dyn_cast<ConstantInt>(memset->getValue());
+            classes[find(memory(memset->getRawDest()))].nullness
+                |= (value != NULL && value->isZero()) ? graph::NIL : graph::DONT_KNOW;
+            return;
+        }
+        if (isa<IntrinsicInst>(&call)) return;
+
+        Function *callee = call.getCalledFunction();
+
+        if (callee != NULL && !callee->isDeclaration()) {
+            unsigned i = 0;
+            for (Argument &param : callee->args()) {
+                if (i >= call.arg_size()) break;
+                if (tracks(param.getType())) flow(call.getArgOperand(i), registerOf(&param));
+                ++i;
+            }
+            for (; i < call.arg_size(); ++i) escape(call.getArgOperand(i)); // varargs
+
+            if (tracks(call.getType())) {
+                unsigned from = returnOf(callee);
+                unsigned to = registerOf(&call);
+                unify(pointee(to), pointee(from));
+                edges.push_back(std::make_pair(from, to));
+            }
+            return;
+        }
+
+        HeapCallKind kind = heapCallKind(call);
+        if (kind == ALLOCATES_MAYBE_NULL || kind == ALLOCATES_NON_NIL) {
+            // one abstract object per allocation site, however often it runs
+            unsigned reg = registerOf(&call);
+            classes[reg].nullness |= kind == ALLOCATES_NON_NIL ? graph::NON_NIL : graph::DONT_KNOW;
+            // calloc zeroes the object, so its pointers start out NULL;
+            // the others leave it uninitialised.
+            unsigned memory = object(&call);
+            classes[find(memory)].nullness |= callee->getName() == "calloc" ? graph::NIL : graph::DONT_KNOW;
+            unify(pointee(reg), memory);
+            if (callee->getName() == "realloc") flow(call.getArgOperand(0), reg);
+            return;
+        }
+        if (kind == RELEASES) return;
+
+        for (Value *arg : call.args()) {
+            if (arg->getType()->isPointerTy()) escape(arg);
+        }
+        if (tracks(call.getType())) fromOutside(&call);
+    }
+
+    /// Resolve what is unknown and push nullness along the flow edges,
+    /// now that all classes are final.
+    void finalize() {
+        // Anything reachable from unknown memory is unknown too.
+        SmallVector<unsigned, 16> work;
+        for (unsigned c = 0; c < classes.size(); ++c) {
+            if (find(c) == c && classes[c].unknown) work.push_back(c);
+        }
+        while (!work.empty()) {
+            unsigned c = work.pop_back_val();
+            classes[c].nullness |= graph::DONT_KNOW;
+
+            unsigned p = classes[c].pointee;
+            if (p == NONE) continue;
+            p = find(p);
+            if (!classes[p].unknown) {
+                classes[p].unknown = true;
+                work.push_back(p);
+            }
+        }
+
+        vector<vector<unsigned>> successors(classes.size());
+        for (auto edge : edges) {
+            unsigned from = find(edge.first), to = find(edge.second);
+            if (from != to) successors[from].push_back(to);
+        }
+
+        for (unsigned c = 0; c < classes.size(); ++c) {
+            if (find(c) == c && classes[c].nullness != 0) work.push_back(c);
+        }
+        while (!work.empty()) {
+            unsigned c = work.pop_back_val();
+            for (unsigned to : successors[c]) {
+                unsigned merged = classes[to].nullness | classes[c].nullness;
+                if (merged != classes[to].nullness) {
+                    classes[to].nullness = merged;
+                    work.push_back(to);
+                }
+            }
+        }
+
+        // Flatten the union-find, so that the const queries are cheap.
+        for (unsigned c = 0; c < classes.size(); ++c) find(c);
+        edges.clear();
+        edges.shrink_to_fit();
+    }
+};
+
+#endif // POINTS_TO_H
@@ -0,0 +1,398 @@
+#ifndef SHARDED_ANALYSIS_H
+#define SHARDED_ANALYSIS_H 1
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/Function.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "Driver.h"
+
+using std::string;
+using std::vector;
+using namespace llvm;
+
+/// Analyses the functions of a module in forked processes, so that they
+/// run on as many cores and a worker that dies (an assertion, a segfault,
+/// a graph that doesn't fit in memory) costs one function instead of the
+/// whole run.
+///
+/// A function is forked off when the pass gets to it, so the fork sees
+/// the IR exactly as the pass does, whatever the passes after it do to the
+/// function later (or whether they delete it). At most `shards` functions
+/// are in flight: `add` waits for one to finish before forking another.
+///
+/// Each fork is a supervisor for its function: it forks the worker that
+/// analyses it, and when that worker dies, forks another one at a lower
+/// precision (see Precision), until a tier gets through or the last one
+/// dies too. With a memory limit, it kills a worker with more memory of
+/// its own than the limit (what it doesn't share with the compiler), and
+/// treats it as dead. The supervisor sends the output of its function to
+/// the compiler, which writes them all in module order at the end, as
+/// `analyzeFunction` would have.
+///
+/// Workers can't change the IR, or report anything but text, so
+/// annotations and summaries aren't supported.
+class ShardedAnalysis {
+public:
+    /// How a function is analysed, one tier lower each time a worker dies on it.
+    enum Precision {
+        /** As the options say. */
+        AS_CONFIGURED,
+
+        /** The graph engine, without calling contexts. */
+        GRAPH_ONLY,
+
+        /** The graph engine, with at most RETRY_MAX_NODES nodes. */
+        BUDGETED,
+
+        /** Not analysed. */
+        GAVE_UP
+    };
+
+    static const size_t RETRY_MAX_NODES = 1 << 16;
+
+    /// `memoryLimitMB` is 0 for no limit.
+    ShardedAnalysis(unsigned shards, unsigned memoryLimitMB)
+        : shards(std::max(1u, shards)), memoryLimit((size_t) memoryLimitMB << 20) {}
+
+    ~ShardedAnalysis() {
+        for (Job &job : jobs) {
+            if (job.pid > 0) kill(-job.pid, SIGKILL);
+        }
+        waitFor(0, NULL);
+    }
+
+    /// Fork the analysis of `function`, as it is now, once fewer than
+    /// `shards` functions are in flight. Functions are added in module order.
+    void add(Function &function, const AnalysisOptions &options, const PointsTo *pointsTo) {
+        waitFor(shards - 1, NULL);
+
+        jobs.emplace_back();
+        Job &job = jobs.back();
+        job.name = function.getName().str();
+
+        int pipeFds[2];
+        if (pipe(pipeFds) != 0) {
+            printError(("cannot create a pipe for a worker: " + string(strerror(errno))).c_str());
+            giveUp(job, "not analysed: no worker");
+            return;
+        }
+
+        // Whatever is buffered would be written again by the fork.
+        outs().flush();
+        // Each supervisor leads a process group of its own, with its
+        // workers, so that killing the group leaves no worker behind.
+        pid_t pid = fork();
+        if (pid == 0) {
+            setpgid(0, 0);
+            close(pipeFds[0]);
+            _exit(supervise(function, options, pointsTo, pipeFds[1]));
+        }
+        if (pid > 0) setpgid(pid, pid); // before the destructor can kill the group
+
+        close(pipeFds[1]);
+        if (pid < 0) {
+            printError(("cannot fork a worker: " + string(strerror(errno))).c_str());
+            close(pipeFds[0]);
+            giveUp(job, "not analysed: no worker");
+            return;
+        }
+        job.pid = pid;
+        job.fd = pipeFds[0];
+        ++running;
+    }
+
+    /// Wait for every function added, and write their output to `os`.
+    /// Returns the number of functions that ran out of budget; with
+    /// `triage`, counts the functions of each tier in `tierCounts`.
+    unsigned run(raw_ostream &os, unsigned tierCounts[3]) {
+        waitFor(0, tierCounts);
+
+        unsigned overBudget = 0;
+        for (Job &job : jobs) {
+            os << job.output;
+            overBudget += job.overBudget;
+        }
+        jobs.clear();
+        return overBudget;
+    }
+
+    /// Workers that died, and of those, the ones killed for their memory.
+    unsigned workersDied() const { return died; }
+    unsigned workersOverMemory() const { return killedOverMemory; }
+
+    /// Functions no tier could analyse.
+    unsigned functionsGivenUp() const { return givenUp; }
+
+private:
+    struct Job {
+        string name;
+
+        /** The supervisor, and what it has sent so far. */
+        pid_t pid = -1;
+        int fd = -1;
+        string received;
+
+        /** Once it is done: the output, and what the record said. */
+        string output;
+        bool overBudget = false;
+        unsigned tier = DEEP;
+        bool counted = false; // `tier` is in the tier counts
+    };
+
+    unsigned shards;
+    size_t memoryLimit;
+
+    vector<Job> jobs;
+    unsigned running = 0;
+
+    unsigned died = 0, killedOverMemory = 0, givenUp = 0;
+
+    /// Read what the supervisors send until at most `maxRunning` of them
+    /// are left, and count the tiers of the finished functions in
+    /// `tierCounts`, if given.
+    void waitFor(unsigned maxRunning, unsigned tierCounts[3]) {
+        while (running > maxRunning) {
+            vector<struct pollfd> fds;
+            vector<Job*> polled;
+            for (Job &job : jobs) {
+                if (job.fd < 0) continue;
+                fds.push_back({job.fd, POLLIN, 0});
+                polled.push_back(&job);
+            }
+            if (poll(fds.data(), fds.size(), -1) < 0 && errno != EINTR) break;
+
+            for (unsigned i = 0; i < fds.size(); ++i) {
+                if (fds[i].revents != 0 && !receive(*polled[i])) finish(*polled[i]);
+            }
+        }
+        if (tierCounts == NULL) return;
+        for (Job &job : jobs) {
+            if (job.fd >= 0 || job.counted) continue;
+            ++tierCounts[job.tier];
+            job.counted = true;
+        }
+    }
+
+    /// Read what the supervisor of `job` sent. Returns false once it has
+    /// closed its end.
+    bool receive(Job &job) {
+        char buffer[1 << 16];
+        ssize_t n = read(job.fd, buffer, sizeof(buffer));
+        if (n < 0) return errno == EINTR || errno == EAGAIN;
+        if (n == 0) return false;
+        job.received.append(buffer, n);
+        return true;
+    }
+
+    /// The supervisor of `job` is done: reap it, and read its record,
+    /// `<over budget> <tier> <workers died> <over memory> <gave up>
+    /// <length>\n<output>`.
+    void finish(Job &job) {
+        close(job.fd);
+        job.fd = -1;
+        --running;
+
+        int status = 0;
+        while (waitpid(job.pid, &status, 0) < 0 && errno == EINTR) {}
+        job.pid = -1;
+
+        StringRef rest(job.received);
+        size_t newline = rest.find('\n');
+        unsigned overBudget, tier, workers, overMemory, gaveUp;
+        unsigned long length;
+        string header = rest.substr(0, newline).str();
+        if (newline == StringRef::npos
+                || sscanf(header.c_str(), "%u %u %u %u %u %lu", &overBudget, &tier, &workers,
+                          &overMemory, &gaveUp, &length) != 6
+                || tier > DEEP || rest.size() != newline + 1 + length) {
+            giveUp(job, "not analysed: its supervisor " + describe(status, false));
+            job.received.clear();
+            return;
+        }
+
+        job.output = rest.substr(newline + 1, length).str();
+        job.overBudget = overBudget != 0;
+        job.tier = tier;
+        job.counted = gaveUp != 0; // a function not analysed has no tier
+        died += workers;
+        killedOverMemory += overMemory;
+        givenUp += gaveUp;
+        job.received.clear();
+    }
+
+    void giveUp(Job &job, const string &why) {
+        job.output = "\n\n";
+        note(job.output, job.name, why);
+        job.counted = true;
+        ++givenUp;
+    }
+
+    /// The body of the supervisor of `function`: run workers on it, one
+    /// tier lower each time one dies, and send the record of the first
+    /// that gets through to `fd` (see finish). Returns the exit code.
+    int supervise(Function &function, const AnalysisOptions &options, const PointsTo *pointsTo, int fd) {
+        bool graphOnly = options.engine == GraphEngine && options.contexts == NULL;
+        unsigned workers = 0, overMemory = 0;
+        string output, lastDeath;
+        unsigned overBudget = 0, tier = DEEP;
+
+        Precision precision = AS_CONFIGURED;
+        for (; precision != GAVE_UP; precision = lower(precision, graphOnly)) {
+            bool killed = false;
+            int status = 0;
+            if (attempt(function, options, pointsTo, precision, output, overBudget, tier, killed, status)) break;
+            ++workers;
+            overMemory += killed;
+            lastDeath = describe(status, killed);
+        }
+
+        if (precision == GAVE_UP) {
+            output = "\n\n";
+            note(output, function.getName().str(),
+                 "not analysed: a worker died on it at every precision, last " + lastDeath);
+            overBudget = 0;
+            tier = DEEP;
+        } else if (precision != AS_CONFIGURED) {
+            note(output, function.getName().str(), string("analysed ") + (precision == GRAPH_ONLY
+                 ? "with the graph engine only" : "with a node budget") + " after a worker died on it");
+        }
+
+        raw_fd_ostream out(fd, true);
+        out << overBudget << " " << tier << " " << workers << " " << overMemory << " "
+            << (precision == GAVE_UP) << " " << output.size() << "\n" << output;
+        out.flush();
+        return out.has_error() ? 1 : 0;
+    }
+
+    /// Fork a worker that analyses `function` at `precision`, and wait for
+    /// its output. Returns false if the worker died; `killed` tells if it
+    /// was for its memory, and `status` how it ended.
+    bool attempt(Function &function, const AnalysisOptions &options, const PointsTo *pointsTo,
+                 Precision precision, string &output, unsigned &overBudget, unsigned &tier,
+                 bool &killed, int &status) {
+        int pipeFds[2];
+        if (pipe(pipeFds) != 0) return false;
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(pipeFds[0]);
+            AnalysisOptions functionOptions = options;
+            lowerOptions(functionOptions, precision);
+
+            string text;
+            raw_string_ostream os(text);
+            FunctionResult result = analyzeFunction(function, functionOptions, pointsTo, os);
+            os.flush();
+
+            raw_fd_ostream out(pipeFds[1], true);
+            out << result.overBudget << " " << result.tier << " " << text.size() << "\n" << text;
+            out.flush();
+            _exit(out.has_error() ? 1 : 0);
+        }
+        close(pipeFds[1]);
+        if (pid < 0) {
+            close(pipeFds[0]);
+            return false;
+        }
+
+        // With a limit, look at the worker's memory every few ms.
+        string received;
+        char buffer[1 << 16];
+        for (;;) {
+            struct pollfd fds = {pipeFds[0], POLLIN, 0};
+            int ready = poll(&fds, 1, memoryLimit != 0 ? 20 : -1);
+            if (ready < 0 && errno != EINTR) break;
+            if (ready > 0) {
+                ssize_t n = read(pipeFds[0], buffer, sizeof(buffer));
+                if (n == 0 || (n < 0 && errno != EINTR && errno != EAGAIN)) break;
+                if (n > 0) received.append(buffer, n);
+            } else if (memoryLimit != 0 && !killed && privateBytes(pid) > memoryLimit) {
+                kill(pid, SIGKILL);
+                killed = true;
+            }
+        }
+        close(pipeFds[0]);
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+        if (killed || !WIFEXITED(status) || WEXITSTATUS(status) != 0) return false;
+
+        StringRef rest(received);
+        size_t newline = rest.find('\n');
+        unsigned long length;
+        string header = rest.substr(0, newline).str();
+        if (newline == StringRef::npos
+                || sscanf(header.c_str(), "%u %u %lu", &overBudget, &tier, &length) != 3
+                || tier > DEEP || rest.size() != newline + 1 + length) {
+            return false;
+        }
+        output = rest.substr(newline + 1, length).str();
+        return true;
+    }
+
+    /// The tier after `precision`; GRAPH_ONLY is skipped if that is what
+    /// the options say anyway.
+    static Precision lower(Precision precision, bool graphOnly) {
+        precision = (Precision) (precision + 1);
+        if (precision == GRAPH_ONLY && graphOnly) precision = BUDGETED;
+        return precision;
+    }
+
+    /// Add a line about how function `name` was analysed to its output,
+    /// where the BUDGET line would be.
+    static void note(string &output, const string &name, const string &what) {
+        output.insert(output.empty() ? 0 : output.size() - 1, "SHARD[" + name + "]: " + what + "\n");
+    }
+
+    static string describe(int status, bool overMemory) {
+        if (overMemory) return "over the memory limit";
+        if (WIFSIGNALED(status)) return "killed by signal " + std::to_string(WTERMSIG(status));
+        return "exited with " + std::to_string(WEXITSTATUS(status));
+    }
+
+    static void lowerOptions(AnalysisOptions &options, Precision precision) {
+        if (precision == AS_CONFIGURED) return;
+        options.engine = GraphEngine;
+        options.contexts = NULL;
+        options.triage = NULL;
+        if (precision == BUDGETED && (options.budget.maxNodes == 0 || options.budget.maxNodes > RETRY_MAX_NODES)) {
+            options.budget.maxNodes = RETRY_MAX_NODES;
+        }
+    }
+
+    /// The memory process `pid` doesn't share with any other (the pages
+    /// a worker wrote since it was forked), or 0 if it can't be read.
+    static size_t privateBytes(pid_t pid) {
+#ifdef __linux__
+        string path = "/proc/" + std::to_string(pid) + "/smaps_rollup";
+        FILE *smaps = fopen(path.c_str(), "r");
+        if (smaps == NULL) return 0;
+        size_t total = 0;
+        char line[256];
+        while (fgets(line, sizeof(line), smaps) != NULL) {
+            unsigned long kb;
+            if (sscanf(line, "Private_Clean: %lu kB", &kb) == 1 || sscanf(line, "Private_Dirty: %lu kB", &kb) == 1) {
+                total += (size_t) kb << 10;
+            }
+        }
+        fclose(smaps);
+        return total;
+#else
+        (void) pid;
+        return 0;
+#endif
+    }
+};
+
+#endif // SHARDED_ANALYSIS_H
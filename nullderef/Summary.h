@@ -0,0 +1,327 @@
+#ifndef SUMMARY_H
+#define SUMMARY_H 1
+
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Analysis/PostDominators.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/DebugInfo.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "PointerGraph.h"
+
+using std::string;
+using std::vector;
+using namespace llvm;
+
+/// What a call site passes to, and does with, a function that may be
+/// defined in another translation unit.
+struct CallSummary {
+    string caller;
+    string callee;
+    unsigned line = 0;
+
+    /** The call is executed whenever the caller is (it post-dominates the entry). */
+    bool always = false;
+
+    /** The returned pointer is dereferenced without being compared to NULL. */
+    bool resultDereferenced = false;
+
+    /** Bit i is set if argument i is NULL. */
+    uint64_t nilArgs = 0;
+
+    /** For each argument, the parameter of the caller it passes on, or -1. */
+    vector<int> forwarded;
+};
+
+/// The nullness summary of a function with external linkage.
+struct FunctionSummary {
+    string name;
+
+    /** Some return statement may return NULL, on some path. */
+    bool returnMayBeNil = false;
+
+    /** Bit i is set if parameter i is dereferenced whenever the function runs. */
+    uint64_t derefParams = 0;
+};
+
+/// The summaries of one translation unit, as written to its index file.
+struct ModuleSummary {
+    string module;
+    vector<FunctionSummary> functions;
+    vector<CallSummary> calls;
+};
+
+/// The index file is plain text, one record per line:
+///
+///     module <identifier>
+///     F <name> <returnMayBeNil> <derefParams>
+///     C <caller> <callee> <line> <always> <resultDereferenced> <nilArgs> <forwarded>...
+///
+/// Masks are written in hexadecimal. In the module identifier and the
+/// names, whitespace and '\\' are escaped as '\\' and two hex digits
+/// (see escapeField). Lines starting with '#' are comments.
+inline string escapeField(StringRef field) {
+    string escaped;
+    for (char c : field) {
+        if (isspace((unsigned char) c) || c == '\\') {
+            escaped += '\\';
+            escaped += hexdigit(((unsigned char) c) >> 4);
+            escaped += hexdigit(c & 15);
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+/// The inverse of `escapeField`. Returns false if `field` isn't escaped
+/// properly.
+inline bool unescapeField(StringRef field, string &result) {
+    result.clear();
+    for (size_t i = 0; i < field.size(); ++i) {
+        if (field[i] != '\\') {
+            result += field[i];
+            continue;
+        }
+        unsigned byte;
+        if (i + 2 >= field.size() || field.substr(i + 1, 2).getAsInteger(16, byte)) return false;
+        result += (char) byte;
+        i += 2;
+    }
+    return true;
+}
+
+inline void writeSummary(const ModuleSummary &summary, raw_ostream &os) {
+    os << "# nullderef summary index v1\n";
+    os << "module " << escapeField(summary.module) << "\n";
+    for (const FunctionSummary &f : summary.functions) {
+        os << "F " << escapeField(f.name) << " " << f.returnMayBeNil << " ";
+        os.write_hex(f.derefParams) << "\n";
+    }
+    for (const CallSummary &c : summary.calls) {
+        os << "C " << escapeField(c.caller) << " " << escapeField(c.callee) << " " << c.line << " "
+           << c.always << " " << c.resultDereferenced << " ";
+        os.write_hex(c.nilArgs);
+        for (int p : c.forwarded) os << " " << p;
+        os << "\n";
+    }
+}
+
+/// Parse an index file written by `writeSummary`. Returns false on the
+/// first malformed line, leaving its number in `errorLine`.
+inline bool readSummary(StringRef text, ModuleSummary &summary, unsigned &errorLine) {
+    SmallVector<StringRef, 16> lines, fields;
+    text.split(lines, '\n', -1, false);
+
+    errorLine = 0;
+    for (StringRef line : lines) {
+        ++errorLine;
+        line = line.trim();
+        if (line.empty() || line.startswith("#")) continue;
+
+        fields.clear();
+        line.split(fields, ' ', -1, false);
+
+        if (fields[0] == "module" && fields.size() == 2) {
+            if (!unescapeField(fields[1], summary.module)) return false;
+        } else if (fields[0] == "F" && fields.size() == 4) {
+            FunctionSummary f;
+            if (!unescapeField(fields[1], f.name)) return false;
+            f.returnMayBeNil = fields[2] == "1";
+            if (fields[3].getAsInteger(16, f.derefParams)) return false;
+            summary.functions.push_back(f);
+        } else if (fields[0] == "C" && fields.size() >= 7) {
+            CallSummary c;
+            if (!unescapeField(fields[1], c.caller) || !unescapeField(fields[2], c.callee)) return false;
+            if (fields[3].getAsInteger(10, c.line)) return false;
+            c.always = fields[4] == "1";
+            c.resultDereferenced = fields[5] == "1";
+            if (fields[6].getAsInteger(16, c.nilArgs)) return false;
+            for (unsigned i = 7; i < fields.size(); ++i) {
+                int p;
+                if (fields[i].getAsInteger(10, p)) return false;
+                c.forwarded.push_back(p);
+            }
+            summary.calls.push_back(c);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// Builds the summary of one function while the engine walks it. Like
+/// the Annotator, it is told about every instruction after it has been
+/// analysed, together with a way to ask for the status of a value at
+/// that point.
+///
+/// Unoptimized code keeps parameters and call results in stack slots, so
+/// a pointer is traced back through an alloca that is stored exactly once
+/// (see `origin`) to find the parameter or call it came from.
+///
+/// A return statement may return NULL if the returned value is NIL, or if
+/// it merges a NIL value with others: a phi or select with a NIL operand,
+/// or a load of the slot unoptimized code keeps the result in, after some
+/// path stored NIL to it. A value the engine merely knows nothing about
+/// (DONT_KNOW) doesn't count, or every returned parameter would.
+class SummaryBuilder {
+    Function &function;
+    PostDominatorTree postDominators;
+
+    FunctionSummary summary;
+    vector<CallSummary> calls;
+
+    DenseMap<Value*, unsigned> callIndex;  // call => index in `calls`
+    DenseMap<Value*, bool> dereferenced;   // call => result dereferenced
+    DenseMap<Value*, bool> checked;        // call => result compared to NULL
+
+    SmallPtrSet<Value*, 4> nilStored;      // slots some path stores NIL to
+    vector<LoadInst*> returnedLoads;       // returned loads of a slot
+
+public:
+    typedef function_ref<graph::LeafNodeType(Value*)> StatusFn;
+
+    SummaryBuilder(Function &function) : function(function), postDominators(function) {
+        summary.name = function.getName().str();
+    }
+
+    /// Record what `I` tells us, `status` giving the status of values
+    /// right after `I` was analysed.
+    void observe(Instruction &I, StatusFn status) {
+        if (LoadInst *load = dyn_cast<LoadInst>(&I)) {
+            noteDeref(I, load->getPointerOperand());
+        } else if (StoreInst *store = dyn_cast<StoreInst>(&I)) {
+            noteDeref(I, store->getPointerOperand());
+            Value *stored = store->getValueOperand();
+            if (stored->getType()->isPointerTy() && isNil(stored, status)) {
+                nilStored.insert(getUnderlyingObject(store->getPointerOperand()));
+            }
+        } else if (ReturnInst *ret = dyn_cast<ReturnInst>(&I)) {
+            Value *v = ret->getReturnValue();
+            if (v == NULL || !v->getType()->isPointerTy()) return;
+            if (mayBeNil(v, status)) {
+                summary.returnMayBeNil = true;
+            } else if (LoadInst *load = dyn_cast<LoadInst>(v)) {
+                // the stores to the slot may come later in layout order
+                returnedLoads.push_back(load);
+            }
+        } else if (ICmpInst *cmp = dyn_cast<ICmpInst>(&I)) {
+            for (Value *op : cmp->operands()) {
+                if (op->getType()->isPointerTy()) checked[origin(op)] = true;
+            }
+        } else if (CallBase *call = dyn_cast<CallBase>(&I)) {
+            noteCall(*call, status);
+        }
+    }
+
+    FunctionSummary functionSummary() const {
+        FunctionSummary result = summary;
+        for (LoadInst *load : returnedLoads) {
+            if (nilStored.count(getUnderlyingObject(load->getPointerOperand()))) result.returnMayBeNil = true;
+        }
+        return result;
+    }
+
+    /// The calls to other functions with external linkage.
+    vector<CallSummary> callSummaries() {
+        for (auto &p : callIndex) {
+            calls[p.second].resultDereferenced = dereferenced.lookup(p.first) && !checked.lookup(p.first);
+        }
+        return calls;
+    }
+
+private:
+    static bool isNil(Value *value, StatusFn status) {
+        if (isa<ConstantPointerNull>(value)) return true;
+        return status(value) == graph::NIL;
+    }
+
+    static bool mayBeNil(Value *value, StatusFn status) {
+        if (isNil(value, status)) return true;
+        if (PHINode *phi = dyn_cast<PHINode>(value)) {
+            return any_of(phi->incoming_values(), [&](Value *in) { return isNil(in, status); });
+        }
+        if (SelectInst *select = dyn_cast<SelectInst>(value)) {
+            return isNil(select->getTrueValue(), status) || isNil(select->getFalseValue(), status);
+        }
+        return false;
+    }
+
+    void noteCall(CallBase &call, StatusFn status) {
+        if (isa<DbgInfoIntrinsic>(call)) return;
+
+        Function *callee = call.getCalledFunction();
+        if (callee == NULL || callee->hasLocalLinkage() || callee->isIntrinsic()) return;
+
+        CallSummary c;
+        c.caller = summary.name;
+        c.callee = callee->getName().str();
+        if (DILocation *loc = call.getDebugLoc()) c.line = loc->getLine();
+        c.always = postDominatesEntry(call.getParent());
+
+        for (unsigned i = 0; i < call.arg_size(); ++i) {
+            Value *arg = call.getArgOperand(i);
+            if (!arg->getType()->isPointerTy()) {
+                c.forwarded.push_back(-1);
+                continue;
+            }
+            if (i < 64 && isNil(arg, status)) c.nilArgs |= uint64_t(1) << i;
+
+            Argument *param = dyn_cast<Argument>(origin(arg));
+            c.forwarded.push_back(param != NULL ? (int) param->getArgNo() : -1);
+        }
+
+        callIndex[&call] = calls.size();
+        calls.push_back(c);
+    }
+
+    void noteDeref(Instruction &I, Value *ptr) {
+        Value *from = origin(ptr);
+        if (Argument *param = dyn_cast<Argument>(from)) {
+            if (param->getArgNo() < 64 && postDominatesEntry(I.getParent())) {
+                summary.derefParams |= uint64_t(1) << param->getArgNo();
+            }
+        } else if (isa<CallBase>(from)) {
+            dereferenced[from] = true;
+        }
+    }
+
+    bool postDominatesEntry(BasicBlock *BB) {
+        return postDominators.dominates(BB, &function.getEntryBlock());
+    }
+
+    /// The value `ptr` was computed from: through casts and GEPs, and
+    /// through loads of a local slot that is only ever stored to once.
+    static Value *origin(Value *ptr) {
+        for (unsigned depth = 0; depth < 8; ++depth) {
+            ptr = getUnderlyingObject(ptr);
+
+            LoadInst *load = dyn_cast<LoadInst>(ptr);
+            if (load == NULL) return ptr;
+            AllocaInst *slot = dyn_cast<AllocaInst>(load->getPointerOperand());
+            if (slot == NULL) return ptr;
+
+            StoreInst *onlyStore = NULL;
+            for (User *user : slot->users()) {
+                if (isa<LoadInst>(user)) continue;
+                StoreInst *store = dyn_cast<StoreInst>(user);
+                if (store == NULL || store->getPointerOperand() != slot || onlyStore != NULL) return ptr;
+                onlyStore = store;
+            }
+            if (onlyStore == NULL) return ptr;
+            ptr = onlyStore->getValueOperand();
+        }
+        return ptr;
+    }
+};
+
+#endif // SUMMARY_H
@@ -0,0 +1,161 @@
+#ifndef TRIAGE_H
+#define TRIAGE_H 1
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+
+#include "GlobalGraph.h"
+#include "HeapModel.h"
+#include "LoweredFunction.h"
+#include "PointsTo.h"
+
+using namespace llvm;
+
+/// How much analysis a function needs, from the tier-0 scan (see Triage).
+enum Tier {
+    /** Nothing in it can be NULL or dangling: no engine can report anything. */
+    TRIVIALLY_SAFE = 0,
+
+    /** Straight-line code whose only NULL sources the graph engine models. */
+    LOCAL = 1,
+
+    /** Branches, loops, calls analysed per context or NULL flowing where
+        only the flow-sensitive engines follow it. */
+    DEEP = 2
+};
+
+/// The tier-0 scan: one linear pass over the instructions of a function,
+/// looking for where a NIL or UNDEFINED status could come from. Every
+/// engine starts from one of these:
+///  - a null pointer constant, including in a constant aggregate or
+///    expression (comparing with NULL doesn't count),
+///  - a value the points-to analysis finds NIL, or pointing to NIL,
+///  - a field of a constant global that is NULL (see GlobalGraph),
+///  - a released object (free, delete),
+///  - memory cleared by memset,
+///  - a pointer slot (alloca) loaded before the entry block stores to it,
+///    which the flow engine reports as UNDEFINED,
+///  - with context sensitivity, the result of a call to a defined function.
+/// A function with none of them is TRIVIALLY_SAFE and isn't analysed at
+/// all. The others are LOCAL if they are a single block where the graph
+/// engine follows every NULL constant (see graphFollows), and DEEP
+/// otherwise. Both get the engine of `-engine`, so that the tiers never
+/// change what is reported; LOCAL functions just don't need contexts,
+/// since they call no defined function.
+class Triage {
+public:
+    Triage(const PointsTo *pointsTo, bool contextSensitive)
+        : pointsTo(pointsTo), contextSensitive(contextSensitive) {}
+
+    Tier classify(Function &function) {
+        bool nullSource = false; // a NIL or UNDEFINED source in the function
+        bool deep = function.size() > 1;
+
+        for (Argument &arg : function.args()) nullSource |= pointsToNil(&arg);
+
+        // Slots the entry block stores to, so far. The entry block comes
+        // first and dominates every other one.
+        SmallPtrSet<const Value*, 8> initialised;
+        BasicBlock *entry = &function.getEntryBlock();
+
+        for (BasicBlock &BB : function) {
+            for (Instruction &I : BB) {
+                nullSource |= pointsToNil(&I);
+
+                if (StoreInst *store = dyn_cast<StoreInst>(&I)) {
+                    if (&BB == entry) initialised.insert(store->getPointerOperand());
+                } else if (LoadInst *load = dyn_cast<LoadInst>(&I)) {
+                    nullSource |= load->getType()->isPointerTy() && isa<AllocaInst>(load->getPointerOperand())
+                        && !initialised.count(load->getPointerOperand());
+                }
+
+                if (CallBase *call = dyn_cast<CallBase>(&I)) {
+                    if (heapCallKind(*call) == RELEASES) nullSource = true;
+                    if (MemSetInst *set = dyn_cast<MemSetInst>(call)) {
+                        ConstantInt *byte = dyn_cast<ConstantInt>(set->getValue());
+                        if (byte == NULL || byte->isZero()) nullSource = true;
+                    }
+                    if (contextSensitive && LoweredFunction::definedCallee(*call) != NULL) {
+                        nullSource = deep = true;
+                    }
+                }
+                if (isa<ICmpInst>(I)) continue;
+
+                for (unsigned i = 0; i < I.getNumOperands(); ++i) {
+                    Constant *c = dyn_cast<Constant>(I.getOperand(i));
+                    if (c == NULL) continue;
+
+                    nullSource |= pointsToNil(c);
+                    if (!holdsNull(c)) continue;
+
+                    nullSource = true;
+                    if (!graphFollows(I, i, c)) deep = true;
+                }
+            }
+        }
+
+        if (!nullSource) return TRIVIALLY_SAFE;
+        return deep ? DEEP : LOCAL;
+    }
+
+private:
+    const PointsTo *pointsTo;
+    bool contextSensitive;
+
+    /// Constants already scanned by `holdsNull`.
+    DenseMap<const Constant*, bool> scanned;
+
+    bool pointsToNil(Value *value) {
+        if (pointsTo == NULL || !value->getType()->isPointerTy()) return false;
+        return pointsTo->nullness(value) == graph::NIL || pointsTo->pointeeNullness(value) == graph::NIL;
+    }
+
+    /// Whether the graph engine follows the constant `c`, which holds a
+    /// null pointer, as operand `i` of `I`: a NULL stored, or an address
+    /// into a constant global.
+    static bool graphFollows(Instruction &I, unsigned i, Constant *c) {
+        if (StoreInst *store = dyn_cast<StoreInst>(&I)) {
+            if (i == 0) return c->getType()->isPointerTy();
+            return i == store->getPointerOperandIndex() && !c->isNullValue();
+        }
+        return isa<LoadInst>(I) && !c->isNullValue();
+    }
+
+    /// Whether `c` is or holds a null pointer: itself, a field, or a field
+    /// of a constant global it refers to.
+    bool holdsNull(const Constant *c) {
+        Type *type = c->getType();
+        if (type->isIntegerTy() || type->isFloatingPointTy()) return false;
+        if (isa<Function>(c)) return false;
+
+        auto it = scanned.find(c);
+        if (it != scanned.end()) return it->second;
+        scanned[c] = false; // constants may refer to themselves
+
+        bool result = c->isNullValue();
+        if (const GlobalVariable *global = dyn_cast<GlobalVariable>(c)) {
+            if (const Constant *initializer = GlobalGraph::fixedInitializer(*global)) {
+                result = initializer->getType()->isPointerTy()
+                    && GlobalGraph::constantStatus(initializer) == graph::NIL;
+
+                SmallVector<graph::LeafNodeType, 8> fields;
+                GlobalGraph::fieldStatuses(initializer, fields);
+                for (graph::LeafNodeType field : fields) result |= field == graph::NIL;
+            }
+        } else if (!isa<GlobalValue>(c)) {
+            for (const Use &op : c->operands()) {
+                if (result) break;
+                result = holdsNull(cast<Constant>(op.get()));
+            }
+        }
+
+        scanned[c] = result;
+        return result;
+    }
+};
+
+#endif // TRIAGE_H
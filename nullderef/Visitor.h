@@ -1,10 +1,22 @@
 #ifndef INST_VISITOR_H
 #define INST_VISITOR_H 1
 
+#include <algorithm>
+#include <iterator>
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SetVector.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/DataLayout.h>
 #include <llvm/IR/InstVisitor.h>
+#include <llvm/IR/Operator.h>
 
 #include "PointerGraph.h"
+#include "PointsTo.h"
+#include "HeapModel.h"
 #include "ErrorCode.h"
+#include "FlowAnalysis.h"
+#include "GlobalGraph.h"
 
 using graph::Graph;
 using graph::Node;
@@ -14,6 +26,37 @@ using namespace llvm;
 // http://llvm.org/docs/doxygen/html/classllvm_1_1InstVisitor.html
 class Visitor : public InstVisitor<Visitor, ErrorCode> {
 public:
+    /// `pointsTo` is the module-wide points-to analysis, if it was run. It
+    /// tells us about values the graph of this function doesn't know,
+    /// such as arguments and globals. With `contexts`, calls to functions
+    /// with a body are analysed per calling context (see CallContexts).
+    /// The graph starts from `globals`, the shared state of the module's
+    /// global variables, if given.
+    Visitor(const PointsTo *pointsTo = NULL, CallContexts *contexts = NULL,
+            const GlobalGraph *globals = NULL)
+        : graph(globals ? &globals->graph() : NULL), pointsTo(pointsTo), contexts(contexts) {}
+
+    /// Forget the function visited so far, to visit another one as if
+    /// with a new Visitor, but in the memory of this one's graph.
+    void reset(const PointsTo *pointsTo = NULL, CallContexts *contexts = NULL,
+               const GlobalGraph *globals = NULL) {
+        graph.reset(globals ? &globals->graph() : NULL);
+        this->pointsTo = pointsTo;
+        this->contexts = contexts;
+        tracker = NULL;
+        heapSites.clear();
+        escaped.clear();
+        written.clear();
+        writtenThroughPointer = false;
+        errorMessage.clear();
+    }
+
+    /// The callees analysed for `contexts` spend the steps of `tracker`,
+    /// the budget of the function visited; until reset, or set to NULL.
+    void setBudget(BudgetTracker *tracker) {
+        this->tracker = tracker;
+    }
+
     // http://llvm.org/docs/LangRef.html#store-instruction
     ErrorCode visitStoreInst(StoreInst &I) {
         Value *op1 = I.getOperand(0); // value to be stored
@@ -41,6 +84,8 @@ public:
         //
         // For that reason we split up the handling of this instruction as CASE 1-4.
 
+        seedFromPointsTo(op2);
+
         // CASE 1: We first detect whether the destination is known to us (CASE C).
         // If we know that it is NIL, then we report an error, regardless of what
         // op1 is (i.e. regardless of CASE A or B).
@@ -50,7 +95,16 @@ public:
 
         // CASE 2: the value we store is not a pointer type, skip. We only care about
         // the destination address in this case, and we already caught that in CASE 1.
+        // A struct or array is copied into op2 as a whole, its fields included.
+        if (op1->getType()->isAggregateType()) {
+            noteWrite(op2);
+            if (isa<ConstantAggregateZero>(op1)) zeroObject(op2, op1->getType());
+            else transferObject(op1, op2);
+            return OK;
+        }
         if (!op1->getType()->isPointerTy()) { return OK; }
+        noteWrite(op2);
+        noteEscape(op1);
 
         // CASE 3: A constant value is stored in some register (CASE A)(and it is a
         // pointer type (CASE 2), and the destination address is non-null (CASE 1)).
@@ -74,11 +128,13 @@ public:
         //    - CASE 4.1: We have information about the value stored (e.g. another pointer value).
         //    - CASE 4.2: We don't have information (e.g. reference to some non-pointer value).
         else {
+            seedFromPointsTo(op1);
             if (graph.isEntryPoint(op1)) {
                 Node *referenced = graph.getNode(op1);
                 graph.insertNode(op2, Node::newRefNode(referenced));
             } else {
-                Node *referenced = graph.insertNode(op1, Node::newLeafNode(graph::DONT_KNOW)); // TODO too conservative?
+                // Neither the graph nor the points-to analysis know anything.
+                Node *referenced = graph.insertNode(op1, Node::newLeafNode(graph::DONT_KNOW));
                 graph.insertNode(op2, Node::newRefNode(referenced));
             }
         }
@@ -90,6 +146,8 @@ public:
     ErrorCode visitLoadInst(LoadInst &I) {
         Value *op = I.getOperand(0);
 
+        seedFromPointsTo(op);
+
         // CASE 1: we have information about the operand being dereferenced. First, we
         // check whether the derefercing is an error. If it is, then we return an error.
         // In the other case, we make this instruction point to the referenced node of the
@@ -98,12 +156,17 @@ public:
             Node *n = graph.getNode(op);
             if (n->derefIsError()) {
                 return handleDerefError(I, n);
+            } else if (I.getType()->isAggregateType()) {
+                // A struct or array value: its fields are those of the object loaded.
+                graph.insertNode(&I, Node::newLeafNode(graph::NON_NIL));
+                transferObject(op, &I);
             } else if (n->isRef()) {
-                Node *deref = n->refPtr()->getReferenced();
+                Node *deref = graph.resolve(n->refPtr()->getReferenced());
                 graph.insertNode(&I, deref);
             } else {
                 Node *newLeaf = graph.insertNode(Node::newLeafNode(graph::DONT_KNOW));
-                n->transformToRefNode(newLeaf);
+                n = graph.getMutableNode(op);
+                if (Error err = n->transformToRefNode(newLeaf)) return fail(ERROR, std::move(err));
                 graph.insertNode(&I, newLeaf);
             }
         }
@@ -118,6 +181,7 @@ public:
 
         Value *op = I.getPointerOperand();
 
+        seedFromPointsTo(op);
         if (!graph.isEntryPoint(op)) {
             graph.insertNode(op, Node::newLeafNode(graph::DONT_KNOW));
         }
@@ -136,37 +200,391 @@ public:
             graph.insertNode(&I, Node::newLeafNode(graph::DONT_KNOW));
         } else {
             // copy status from op
-            Node *offsetNode = graph.getOffset(op, offset);
-            graph.insertNode(&I, offsetNode);
+            Expected<Node*> offsetNode = graph.getOffset(op, offset);
+            if (!offsetNode) return fail(MISSED_DEFINITION, offsetNode.takeError());
+            graph.insertNode(&I, *offsetNode);
         }
 
         return OK;
     }
 
+    // http://llvm.org/docs/LangRef.html#extractvalue-instruction
+    ErrorCode visitExtractValueInst(ExtractValueInst &I) {
+        // The field of a struct value loaded or passed around as a whole.
+        Value *aggregate = I.getAggregateOperand();
+        if (!I.getType()->isPointerTy() || !graph.isEntryPoint(aggregate)) return OK;
+
+        Node *field = graph.getNode(aggregate);
+        for (unsigned index : I.indices()) {
+            if ((field = graph.findOffset(field, index)) == NULL) return OK;
+        }
+        if (field->isRef()) graph.insertNode(&I, graph.resolve(field->refPtr()->getReferenced()));
+        return OK;
+    }
+
     // http://llvm.org/docs/LangRef.html#llvm-memcpy-intrinsic
-    ErrorCode visitMemCpyInst(MemCpyInst &I) {
+    // http://llvm.org/docs/LangRef.html#llvm-memmove-intrinsic
+    ErrorCode visitMemTransferInst(MemTransferInst &I) {
         Value *source = I.getSource();
         Value *dest = I.getDest();
 
-        // Just check whether the source and destination are known to be NULL.
+        // Check whether the source and destination are known to be NULL.
         if ((graph.isEntryPoint(source) && graph.getNode(source)->derefIsError())
                 || (graph.isEntryPoint(dest) && graph.getNode(dest)->derefIsError())) {
             return NULL_DEREF;
         }
 
+        // A copy of a whole object over another of the same type copies its
+        // field table; after any other, we don't know what `dest` holds.
+        Value *from = stripBitCasts(source), *to = stripBitCasts(dest);
+        noteWrite(to);
+        Type *type = objectType(to);
+        bool whole = type != NULL && type == objectType(from) && coversObject(I, type);
+        transferObject(whole ? from : NULL, to);
+        return OK;
+    }
+
+    // http://llvm.org/docs/LangRef.html#llvm-memset-intrinsics
+    ErrorCode visitMemSetInst(MemSetInst &I) {
+        Value *dest = I.getDest();
+
+        seedFromPointsTo(dest);
+        if (graph.isEntryPoint(dest) && graph.getNode(dest)->derefIsError()) {
+            return handleDerefError(graph.getNode(dest));
+        }
+
+        // Zeroing a whole object makes every pointer in it NULL.
+        Value *to = stripBitCasts(dest);
+        noteWrite(to);
+        Type *type = objectType(to);
+        ConstantInt *byte = dyn_cast<ConstantInt>(I.getValue());
+        if (byte != NULL && byte->isZero() && type != NULL && coversObject(I, type)) {
+            zeroObject(to, type);
+        } else {
+            transferObject(NULL, to);
+        }
+        return OK;
+    }
+
+    // http://llvm.org/docs/LangRef.html#bitcast-to-instruction
+    ErrorCode visitBitCastInst(BitCastInst &I) {
+        // A cast pointer is the same pointer: share its node.
+        Value *op = I.getOperand(0);
+        if (I.getType()->isPointerTy() && graph.isEntryPoint(op)) {
+            graph.insertNode(&I, graph.getNode(op));
+        }
         return OK;
     }
 
+    // http://llvm.org/docs/LangRef.html#call-instruction
+    ErrorCode visitCallInst(CallInst &I) {
+        switch (heapCallKind(I)) {
+        case ALLOCATES_MAYBE_NULL:
+            graph.insertNode(&I, allocationSite(I, graph::DONT_KNOW));
+            return OK;
+
+        case ALLOCATES_NON_NIL:
+            graph.insertNode(&I, allocationSite(I, graph::NON_NIL));
+            return OK;
+
+        case RELEASES: {
+            Value *ptr = I.getArgOperand(0)->stripPointerCasts();
+            if (!graph.isEntryPoint(ptr)) return OK;
+
+            // free(NULL) does nothing, but releasing an object twice does.
+            Node *n = graph.getNode(ptr);
+            if (n->status() == graph::UNDEFINED) return UNDEFINED_DEREF;
+            if (n->status() != graph::NIL) {
+                // Every pointer sharing this node now dangles.
+                graph.insertNode(ptr, Node::newLeafNode(graph::UNDEFINED));
+            }
+            return OK;
+        }
+
+        default: {
+            ErrorCode result = visitDefinedCall(I);
+            forgetWrittenBy(I);
+            return result;
+        }
+        }
+    }
+
+    /// With context sensitivity, the result of a call to a function with a
+    /// body gets the status the callee returns with these arguments, and
+    /// passing NULL where the callee dereferences it is an error.
+    ErrorCode visitDefinedCall(CallInst &I) {
+        if (contexts == NULL || LoweredFunction::definedCallee(I) == NULL) return OK;
+
+        SmallVector<unsigned, 8> args;
+        for (Value *arg : I.args()) {
+            args.push_back(arg->getType()->isPointerTy() ? argumentStatus(arg) : graph::DONT_KNOW);
+        }
+
+        CallEffect effect = FlowAnalysis::callEffect(I, args, contexts, 0, tracker);
+        if (I.getType()->isPointerTy() && (effect.returned == graph::NIL || effect.returned == graph::NON_NIL)) {
+            graph.insertNode(&I, Node::newLeafNode((graph::LeafNodeType) effect.returned));
+        }
+        return effect.nullDerefs > 0 ? NULL_DEREF : OK;
+    }
+
     ErrorCode visitInstruction(Instruction &I) {
         return OK;
     }
 
+    /// The status the graph currently knows for `value`, or DONT_KNOW if
+    /// the value isn't an entry point into the graph.
+    graph::LeafNodeType statusOf(Value *value) {
+        return graph.isEntryPoint(value) ? graph.getNode(value)->status() : graph::DONT_KNOW;
+    }
+
+    /// The graph node `value` is mapped to, or NULL if it isn't tracked.
+    Node *nodeOf(Value *value) {
+        return graph.isEntryPoint(value) ? graph.getNode(value) : NULL;
+    }
+
+    /// The instructions in `dead` won't be looked up again: drop their
+    /// entry points, and reclaim the nodes nothing reaches any more once
+    /// enough of them have piled up (see Graph::collectIfDue).
+    void release(ArrayRef<Instruction*> dead, size_t minCollection = Graph::MIN_COLLECTION) {
+        for (Instruction *I : dead) {
+            graph.release(I);
+            heapSites.erase(I);
+            if (AllocaInst *alloca = dyn_cast<AllocaInst>(I)) {
+                escaped.remove(alloca);
+                written.remove(alloca);
+            }
+        }
+        graph.collectIfDue(minCollection);
+    }
+
+    /// Number of nodes in the graph so far.
+    size_t graphSize() const {
+        return graph.size();
+    }
+
+    /// Number of nodes the graph can hold without allocating (see reset).
+    size_t graphCapacity() const {
+        return graph.capacity();
+    }
+
     std::string dump() {
         return graph.dump();
     }
 
+    /// What went wrong in the last visit that returned an ERROR code.
+    const std::string &lastError() const {
+        return errorMessage;
+    }
+
 private:
 
+    /// Remember the message of `err` for `lastError`, and return `code`.
+    ErrorCode fail(ErrorCode code, Error err) {
+        errorMessage = toString(std::move(err));
+        return code;
+    }
+
+    /// If `value` isn't in the graph yet, add what the module-wide points-to
+    /// analysis knows about it: whether it is NIL, and if not, whether the
+    /// pointers stored at it are. Locals are left to the graph itself.
+    void seedFromPointsTo(Value *value) {
+        if (pointsTo == NULL || isa<AllocaInst>(value) || graph.isEntryPoint(value)) return;
+
+        graph::LeafNodeType status = pointsTo->nullness(value);
+        if (status == graph::NIL) {
+            graph.insertNode(value, Node::newLeafNode(graph::NIL));
+        } else if (status == graph::NON_NIL) {
+            graph::LeafNodeType pointee = pointsTo->pointeeNullness(value);
+            if (pointee == graph::NIL || pointee == graph::NON_NIL) {
+                Node *leaf = graph.insertNode(Node::newLeafNode(pointee));
+                graph.insertNode(value, Node::newRefNode(leaf));
+            } else {
+                graph.insertNode(value, Node::newLeafNode(graph::NON_NIL));
+            }
+        }
+    }
+
+    /// The address of `value`, if it is a local, is now somewhere a callee
+    /// may find it.
+    void noteEscape(Value *value) {
+        if (AllocaInst *alloca = dyn_cast<AllocaInst>(stripBitCasts(value))) {
+            if (escaped.insert(alloca)) written.insert(alloca);
+        }
+    }
+
+    /// Something was stored at `dest`. If that may be an escaped local,
+    /// the next call has to forget what it holds again.
+    void noteWrite(Value *dest) {
+        Value *object = getUnderlyingObject(dest);
+        if (AllocaInst *alloca = dyn_cast<AllocaInst>(object)) {
+            if (escaped.count(alloca)) written.insert(alloca);
+        } else if (!isa<GlobalValue>(object)) {
+            writtenThroughPointer = true;
+        }
+    }
+
+    /// A call may write the objects passed to it, and every local whose
+    /// address escaped before: forget what they hold, fields included.
+    /// Only the escaped locals written since the last call can hold
+    /// anything we know, unless something was written through a pointer
+    /// that may lead to any of them.
+    void forgetWrittenBy(CallInst &I) {
+        if (isa<IntrinsicInst>(I) || I.onlyReadsMemory()) return;
+
+        for (unsigned i = 0; i < I.arg_size(); ++i) {
+            Value *arg = stripBitCasts(I.getArgOperand(i));
+            if (!arg->getType()->isPointerTy() || I.onlyReadsMemory(i)) continue;
+            if (GlobalVariable *global = dyn_cast<GlobalVariable>(arg)) {
+                if (global->isConstant()) continue;
+            } else if (isa<Constant>(arg)) {
+                continue;
+            }
+            noteEscape(arg);
+            transferObject(NULL, arg);
+        }
+        for (AllocaInst *alloca : writtenThroughPointer ? escaped : written) transferObject(NULL, alloca);
+        written.clear();
+        writtenThroughPointer = false;
+    }
+
+    /// How deep copyFields and zeroFields go into fields of fields, and how
+    /// many pointer fields zeroFields adds to the field table of an object.
+    static const unsigned MAX_FIELD_DEPTH = 8;
+    static const unsigned MAX_ZEROED_FIELDS = 256;
+
+    /// Make the object at `to` hold what the object at `from` holds, as a
+    /// copy of the whole object does: the pointer stored at its start, and
+    /// its field table, in one pass over the fields either of them has.
+    /// Without `from`, or if it isn't in the graph, what `to` holds is no
+    /// longer known.
+    void transferObject(Value *from, Value *to) {
+        Node *source = from != NULL && graph.isEntryPoint(from) ? graph.getNode(from) : NULL;
+        graph::LeafNodeType status;
+        if (graph.isEntryPoint(to)) {
+            status = graph.getNode(to)->status();
+            if (graph.getNode(to) == source) return;
+        } else if (source != NULL) {
+            status = isa<AllocaInst>(to) ? graph::NON_NIL : graph::DONT_KNOW;
+        } else {
+            return; // nothing to forget
+        }
+
+        Node *target = graph.insertNode(to, contentsOf(source, status));
+        copyFields(source, target, 0);
+    }
+
+    /// Give each field of `target` the contents of the same field of
+    /// `source` (NULL for none): a field `source` doesn't have holds
+    /// something unknown.
+    void copyFields(Node *source, Node *target, unsigned depth) {
+        SmallVector<int64_t, 8> sourceOffsets, offsets;
+        if (source != NULL) sourceOffsets = graph.offsetsOf(source);
+        SmallVector<int64_t, 8> targetOffsets = graph.offsetsOf(target);
+        std::set_union(sourceOffsets.begin(), sourceOffsets.end(), targetOffsets.begin(), targetOffsets.end(),
+                       std::back_inserter(offsets));
+
+        graph::LeafNodeType status = target->status();
+        for (int64_t offset : offsets) {
+            Node *from = std::binary_search(sourceOffsets.begin(), sourceOffsets.end(), offset)
+                ? graph.findOffset(source, offset) : NULL;
+            Node *field = graph.setOffset(target, offset, contentsOf(from, status));
+            if (depth < MAX_FIELD_DEPTH && field != from) copyFields(from, field, depth + 1);
+        }
+    }
+
+    /// Make every pointer in the object of `type` at `to` NULL, the ones in
+    /// its fields included, as a memset to 0 or a store of zeroinitializer does.
+    void zeroObject(Value *to, Type *type) {
+        Node *nil = graph.insertNode(Node::newLeafNode(graph::NIL));
+        Node *target = graph.insertNode(to, Node::newRefNode(nil));
+        unsigned budget = MAX_ZEROED_FIELDS;
+        zeroFields(target, type, nil, budget, 0);
+    }
+
+    /// Make the fields of `object` that `type` (if known) says hold
+    /// pointers, and those it already has, hold NULL.
+    void zeroFields(Node *object, Type *type, Node *nil, unsigned &budget, unsigned depth) {
+        SmallVector<int64_t, 8> offsets = graph.offsetsOf(object);
+        auto known = offsets.size();
+        unsigned count = 0;
+        if (type != NULL && type->isStructTy()) count = type->getStructNumElements();
+        if (type != NULL && type->isArrayTy()) count = std::min<uint64_t>(type->getArrayNumElements(), budget);
+        for (unsigned i = 0; i < count && budget > 0; ++i) {
+            if (!GlobalGraph::holdsPointers(fieldType(type, i))) continue;
+            if (!std::binary_search(offsets.begin(), offsets.begin() + known, (int64_t) i)) --budget;
+            offsets.push_back(i);
+        }
+        std::sort(offsets.begin(), offsets.end());
+        offsets.erase(std::unique(offsets.begin(), offsets.end()), offsets.end());
+
+        for (int64_t offset : offsets) {
+            Node *field = graph.setOffset(object, offset, Node::newRefNode(nil));
+            if (depth < MAX_FIELD_DEPTH) zeroFields(field, fieldType(type, offset), nil, budget, depth + 1);
+        }
+    }
+
+    /// What a copy of `source` holds, at a place of `status`: the same
+    /// pointer if `source` holds one, or something unknown.
+    Node contentsOf(Node *source, graph::LeafNodeType status) {
+        if (source != NULL && source->isRef()) return Node::newRefNode(graph.resolve(source->refPtr()->getReferenced()));
+        return Node::newLeafNode(status);
+    }
+
+    /// Does the memory intrinsic `I` cover the whole of an object of `type`?
+    static bool coversObject(MemIntrinsic &I, Type *type) {
+        ConstantInt *length = dyn_cast<ConstantInt>(I.getLength());
+        if (length == NULL || !type->isSized()) return false;
+        return length->getZExtValue() >= I.getModule()->getDataLayout().getTypeAllocSize(type).getFixedSize();
+    }
+
+    /// The type of the object at `object`, if it is a local, a global or
+    /// a field of one, or NULL.
+    static Type *objectType(Value *object) {
+        if (AllocaInst *alloca = dyn_cast<AllocaInst>(object)) {
+            return alloca->isArrayAllocation() ? NULL : alloca->getAllocatedType();
+        }
+        if (GlobalVariable *global = dyn_cast<GlobalVariable>(object)) return global->getValueType();
+        if (GEPOperator *gep = dyn_cast<GEPOperator>(object)) return gep->getResultElementType();
+        return NULL;
+    }
+
+    /// The type of field `offset` of an object of `type`, as the Visitor
+    /// numbers them (`getelementptr %p, 0, offset`), or NULL.
+    static Type *fieldType(Type *type, int64_t offset) {
+        if (type == NULL || offset < 0) return NULL;
+        if (type->isStructTy()) return offset < type->getStructNumElements() ? type->getStructElementType(offset) : NULL;
+        if (type->isArrayTy()) return (uint64_t) offset < type->getArrayNumElements() ? type->getArrayElementType() : NULL;
+        return NULL;
+    }
+
+    /// `value` without the bitcasts around it. Unlike stripPointerCasts,
+    /// a getelementptr to the first field stays: that is another object.
+    static Value *stripBitCasts(Value *value) {
+        while (BitCastOperator *cast = dyn_cast<BitCastOperator>(value)) value = cast->getOperand(0);
+        return value;
+    }
+
+    /// The status of the pointer `value` passed to a call.
+    graph::LeafNodeType argumentStatus(Value *value) {
+        unsigned fixed = LoweredFunction::fixedStatus(value);
+        if (fixed == graph::NIL || fixed == graph::NON_NIL) return (graph::LeafNodeType) fixed;
+
+        seedFromPointsTo(value);
+        return statusOf(value);
+    }
+
+    /// The node for the object allocated at `site`. There is one node per
+    /// call site, whatever the number of times it is executed, so the graph
+    /// stays bounded by the number of sites.
+    Node *allocationSite(Instruction &site, graph::LeafNodeType status) {
+        auto it = heapSites.find(&site);
+        if (it != heapSites.end()) return it->second;
+
+        Node *n = graph.insertNode(Node::newLeafNode(status));
+        heapSites[&site] = n;
+        return n;
+    }
+
     ErrorCode handleDerefError(Node *n) {
         switch (n->status()) {
 
@@ -183,6 +601,13 @@ private:
     }
 
     Graph graph;
+    const PointsTo *pointsTo;
+    CallContexts *contexts;
+    BudgetTracker *tracker = NULL;
+    DenseMap<Instruction*, Node*> heapSites;
+    SetVector<AllocaInst*> escaped, written; // see noteEscape and noteWrite
+    bool writtenThroughPointer = false;
+    std::string errorMessage;
 };
 
 #endif // INST_VISITOR_H
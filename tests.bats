@@ -244,6 +244,43 @@ function assert_undefderef_at_instruction() {
   assert_nullderef_at_instruction 22 "%17 = load i32, i32* %16, align 4"
 }
 
+@test "struct/example6" {
+  run ./run $BATS_TEST_DESCRIPTION
+  assert_failure
+
+  run ./opt $BATS_TEST_DESCRIPTION
+  assert_events_count 1
+  assert_nullderef_at_instruction 11 "%9 = load i32, i32* %8, align 4"
+}
+
+@test "struct/example7" {
+  run ./run $BATS_TEST_DESCRIPTION
+  assert_failure
+
+  # Only in main: in initialised(), init() sets the field memset cleared
+  run ./opt $BATS_TEST_DESCRIPTION
+  assert_events_count 1
+  assert_nullderef_at_instruction 7 "%6 = load i32, i32* %5, align 4"
+}
+
+@test "struct/example8" {
+  run ./run $BATS_TEST_DESCRIPTION
+  assert_failure
+
+  run ./opt $BATS_TEST_DESCRIPTION
+  assert_events_count 1
+  assert_nullderef_at_instruction 27 "%20 = load i32, i32* %19, align 4"
+}
+
+@test "struct/example9" {
+  source settings
+  run $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef -t \
+    examples/$BATS_TEST_DESCRIPTION.ll -o /dev/null
+  assert_events_count 2
+  assert_nullderef_at_instruction 8 "%6 = load i32, i32* %5, align 4"
+  assert_nullderef_at_instruction 11 "%9 = load i32, i32* %8, align 4"
+}
+
 @test "flow/example0" {
   run ./run $BATS_TEST_DESCRIPTION
   assert_success
@@ -295,7 +332,396 @@ function assert_undefderef_at_instruction() {
   assert_nullderef_at_instruction 8 "%5 = load i32, i32* %4, align 4"
 }
 
+@test "flow/example2 (flow engine)" {
+  source settings
+  ./emitbc flow/example2
+  run $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef -t -engine=flow \
+    build/examples/flow/example2.bc -o /dev/null
+  assert_events_count 1
+  assert_nullderef_at_instruction 10 "%8 = load i32, i32* %7, align 4"
+}
+
+@test "flow/example2 (flow engine, budgets)" {
+  source settings
+  ./emitbc flow/example2
+  run $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef -t -engine=flow -max-steps=1 \
+    build/examples/flow/example2.bc -o /dev/null
+  assert_events_count 0
+  assert_output --partial "BUDGET[main]: step limit reached after 2 steps"
+  assert_output --partial "Functions over budget in build/examples/flow/example2.bc: 1"
+
+  # The flow engine has no graph: -max-nodes doesn't apply to it.
+  run $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef -t -engine=flow -max-nodes=1 \
+    build/examples/flow/example2.bc -o /dev/null
+  assert_events_count 1
+  assert_output --partial "Functions over budget in build/examples/flow/example2.bc: 0"
+}
+
+@test "flow/example2 (background)" {
+  source settings
+  ./emitbc flow/example2
+  run $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef -t -engine=flow -background \
+    build/examples/flow/example2.bc -O2 -o /dev/null
+  assert_events_count 1
+  assert_nullderef_at_instruction 10 "%8 = load i32, i32* %7, align 4"
+}
+
+@test "flow/example2 (background, joined at the end of -O1)" {
+  source settings
+  ./emitbc flow/example2
+  run $OPT -load build/nullderef/libNullDereferenceDetection.so -t -engine=flow -background \
+    build/examples/flow/example2.bc -O1 -debug-pass=Structure -o /dev/null
+  assert_events_count 1
+  assert_nullderef_at_instruction 10 "%8 = load i32, i32* %7, align 4"
+  assert_output --partial "Null Dereference Background Join"
+}
+
+@test "others/extern_weak (flow engine)" {
+  source settings
+  run $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef -t -engine=flow \
+    examples/others/extern_weak.ll -o /dev/null
+  assert_events_count 1
+  assert_nullderef_at_instruction 10 "%9 = load i32, i32* %8, align 4"
+}
+
+@test "others/calloc_fields (memory SSA engine)" {
+  source settings
+  run $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef -t -engine=mssa \
+    examples/others/calloc_fields.ll -o /dev/null
+  assert_events_count 1
+  assert_nullderef_at_instruction 6 "%6 = load i32, i32* %5, align 4"
+}
+
+@test "others/nocapture_out (demand engine, query lines)" {
+  source settings
+  run $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef -t -engine=demand -query-lines=6 \
+    examples/others/nocapture_out.ll -o /dev/null
+  assert_events_count 0
+
+  run $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef -t -engine=demand -query-lines=6,9 \
+    examples/others/nocapture_out.ll -o /dev/null
+  assert_events_count 1
+  assert_output --partial "TEST[9]:NULL_DEREF  %6 = load i32, i32* %5, align 4"
+}
+
+@test "flow/example2 (demand engine)" {
+  source settings
+  ./emitbc flow/example2
+  run $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef -t -engine=demand \
+    build/examples/flow/example2.bc -o /dev/null
+  assert_events_count 1
+  assert_nullderef_at_instruction 10 "%8 = load i32, i32* %7, align 4"
+}
+
+@test "flow/example7" {
+  source settings
+  ./emitbc $BATS_TEST_DESCRIPTION
+  run $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef -t -engine=mssa \
+    build/examples/$BATS_TEST_DESCRIPTION.bc -o /dev/null
+  assert_events_count 0
+}
+
+@test "struct/example5 (mssa engine)" {
+  source settings
+  ./emitbc struct/example5
+  run $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef -t -engine=mssa \
+    build/examples/struct/example5.bc -o /dev/null
+  assert_events_count 1
+  assert_nullderef_at_instruction 22 "%17 = load i32, i32* %16, align 4"
+}
+
+@test "struct/example5 (tiered)" {
+  source settings
+  ./emitbc struct/example5
+  run $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef -t -tiered -engine=flow \
+    build/examples/struct/example5.bc -o /dev/null
+  assert_events_count 1
+  assert_nullderef_at_instruction 22 "%17 = load i32, i32* %16, align 4"
+  assert_output --partial "Tiers in build/examples/struct/example5.bc: 0 trivially safe, 1 local, 0 deep"
+}
+
+@test "struct/example5 (shards)" {
+  source settings
+  ./emitbc struct/example5
+  run $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef -t -shards=2 \
+    build/examples/struct/example5.bc -o /dev/null
+  assert_events_count 1
+  assert_nullderef_at_instruction 22 "%17 = load i32, i32* %16, align 4"
+  assert_output --partial "Shards in build/examples/struct/example5.bc: 0 workers died"
+}
+
+@test "interprocedural/example3 (shards, function deleted later)" {
+  source settings
+  ./emitbc interprocedural/example3
+  run $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef -t -shards=2 \
+    build/examples/interprocedural/example3.bc -internalize -internalize-public-api-list=main -globaldce -o /dev/null
+  assert_success
+  assert_events_count 1
+  assert_nullderef_at_instruction 4 "%3 = load i32, i32* %2, align 4"
+  assert_output --partial "Shards in build/examples/interprocedural/example3.bc: 0 workers died"
+}
+
+@test "struct/example5 (trace replay)" {
+  source settings
+  ./emitbc struct/example5
+  run $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef -t \
+    -trace=build/examples/struct/example5.trace build/examples/struct/example5.bc -o /dev/null
+  assert_events_count 1
+
+  run build/nullderef/nullderef-replay build/examples/struct/example5.trace
+  assert_success
+  assert_output --partial "0 mismatches"
+}
+
 @test "others/array_unknown_indices" {
   run ./opt $BATS_TEST_DESCRIPTION
   assert_events_count 0
-}
\ No newline at end of file
+}
+
+@test "others/return_local (annotate)" {
+  source settings
+  ./emitbc others/return_local
+  run $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef -annotate \
+    build/examples/others/return_local.bc -S -o -
+  assert_output --partial "define dso_local nonnull i32** @local()"
+  refute_output --partial "dereferenceable"
+}
+
+@test "others/return_local (annotate, flow engine)" {
+  source settings
+  ./emitbc others/return_local
+  run $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef -annotate -engine=flow \
+    build/examples/others/return_local.bc -S -o -
+  assert_output --partial "ERROR: -annotate only goes with -engine=graph; not annotating"
+  refute_output --partial "nonnull"
+}
+
+@test "struct/example9 (perf)" {
+  source settings
+  run $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef -perf \
+    examples/struct/example9.ll -o /dev/null
+  assert_success
+  # Without counters (no perf_event_open, e.g. in a container), time only
+  if [[ "$output" != *"cycles="* ]]; then
+    assert_line --regexp "^Hardware counters unavailable \(.+\), reporting time only$"
+  fi
+  assert_line --regexp "^PERF\[main\] visit: .*ms=[0-9]+\.[0-9]{3}$"
+  assert_line --regexp "^PERF\[main\] teardown: .*ms=[0-9]+\.[0-9]{3}$"
+  assert_line --regexp "^PERF\[examples/struct/example9.ll\] visit: .*ms=[0-9]+\.[0-9]{3}$"
+  assert_line --regexp "^PERF\[examples/struct/example9.ll\] teardown: .*ms=[0-9]+\.[0-9]{3}$"
+}
+
+@test "others/annotate_alias (annotate, parameters that may alias)" {
+  source settings
+  run $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef -annotate \
+    examples/others/annotate_alias.ll -S -o -
+  assert_line --partial "define dso_local i32* @f("
+  assert_line "  %v = load i32*, i32** %p, align 8"
+  assert_output --partial "define dso_local nonnull i32* @local()"
+  assert_line "  %v = load i32*, i32** %slot, align 8, !nonnull !0"
+}
+
+@test "others/const_table" {
+  run ./opt $BATS_TEST_DESCRIPTION
+  assert_events_count 1
+  assert_output --partial "NULL_DEREF  %7 = load i32, i32* %6, align 4"
+}
+
+@test "others/const_nested" {
+  run ./opt $BATS_TEST_DESCRIPTION
+  assert_events_count 1
+  assert_nullderef_at_instruction 9 "%7 = load i32, i32* %6, align 4"
+}
+
+@test "interprocedural/example0" {
+  run ./run $BATS_TEST_DESCRIPTION
+  assert_failure
+
+  source settings
+  ./emitbc $BATS_TEST_DESCRIPTION
+  run $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef -t -whole-program \
+    build/examples/$BATS_TEST_DESCRIPTION.bc -o /dev/null
+  assert_events_count 1
+  assert_nullderef_at_instruction 3 "%3 = load i32, i32* %2, align 4"
+
+  # Without -whole-program, another module may set the pointer
+  run ./opt $BATS_TEST_DESCRIPTION
+  assert_events_count 0
+}
+
+@test "interprocedural/example1" {
+  run ./run $BATS_TEST_DESCRIPTION
+  assert_failure
+
+  source settings
+  ./emitbc $BATS_TEST_DESCRIPTION
+  run $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef -t -whole-program \
+    build/examples/$BATS_TEST_DESCRIPTION.bc -o /dev/null
+  assert_events_count 1
+  assert_nullderef_at_instruction 4 "%4 = load i32, i32* %3, align 4"
+
+  # Without -whole-program, another module may call deref
+  run ./opt $BATS_TEST_DESCRIPTION
+  assert_events_count 0
+}
+
+@test "interprocedural/example2" {
+  source settings
+  ./emitbc $BATS_TEST_DESCRIPTION
+  run $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef -t -engine=flow \
+    -context-depth=1 build/examples/$BATS_TEST_DESCRIPTION.bc -o /dev/null
+  assert_events_count 2
+  assert_output --partial "TEST[8]:NULL_DEREF  %6 = call i32 @first("
+  assert_nullderef_at_instruction 12 "%9 = load i32, i32* %8, align 4"
+}
+
+@test "interprocedural/chain (flow engine, contexts within the budget)" {
+  source settings
+  run $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef -t -engine=flow \
+    -context-depth=3 -max-steps=8 examples/interprocedural/chain.ll -o /dev/null
+  assert_events_count 1
+  assert_output --partial "TEST[1]:NULL_DEREF  %v = call i32 @a(i32* null)"
+  assert_output --partial "Functions over budget in examples/interprocedural/chain.ll: 0"
+
+  # The callees analysed for main's contexts spend main's steps
+  run $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef -t -engine=flow \
+    -context-depth=3 -max-steps=3 examples/interprocedural/chain.ll -o /dev/null
+  assert_events_count 0
+  assert_output --partial "BUDGET[main]: step limit reached after 4 steps"
+  assert_output --partial "Functions over budget in examples/interprocedural/chain.ll: 1"
+}
+
+@test "heap/example0" {
+  run ./opt $BATS_TEST_DESCRIPTION
+  assert_events_count 1
+  assert_undefderef_at_instruction 10 "%8 = load i32, i32* %7, align 4"
+}
+
+@test "heap/example1 (flow engine)" {
+  source settings
+  ./emitbc heap/example1
+  run $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef -t -engine=flow \
+    build/examples/heap/example1.bc -o /dev/null
+  assert_events_count 1
+  assert_nullderef_at_instruction 16 "%12 = load i32, i32* %11, align 4"
+}
+
+@test "heap/example2 (flow engine)" {
+  source settings
+  ./emitbc heap/example2
+  run $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef -t -engine=flow \
+    build/examples/heap/example2.bc -o /dev/null
+  assert_events_count 1
+  assert_output --partial "TEST[24]:UNDEFINED_DEREF  call void @free(i8* noundef %19)"
+}
+
+@test "others/uninitialised (flow engine, tiered)" {
+  source settings
+  ./emitbc others/uninitialised
+  run $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef -t -tiered -engine=flow \
+    build/examples/others/uninitialised.bc -o /dev/null
+  assert_events_count 1
+  assert_undefderef_at_instruction 5 "%4 = load i32, i32* %3, align 4"
+  assert_output --partial "Tiers in build/examples/others/uninitialised.bc: 0 trivially safe, 1 local, 0 deep"
+}
+
+@test "tiered (every engine)" {
+  source settings
+  for example in others/uninitialised others/const_table heap/example2 struct/example8 flow/example2; do
+    ./emitbc $example
+    for engine in graph flow mssa demand; do
+      run $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef -t -engine=$engine \
+        build/examples/$example.bc -o /dev/null
+      untiered=$(echo "$output" | grep "^$RESULT")
+      run $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef -t -tiered -engine=$engine \
+        build/examples/$example.bc -o /dev/null
+      assert_equal "$(echo "$output" | grep "^$RESULT")" "$untiered"
+    done
+  done
+}
+
+@test "collect after every instruction" {
+  source settings
+  for example in struct/example8 heap/example0 basic/example9 others/list; do
+    ./emitbc $example
+    run $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef -t \
+      build/examples/$example.bc -o /dev/null
+    expected=$(echo "$output" | grep "^$RESULT")
+    run $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef -t \
+      -release-min-instructions=0 -collect-min-nodes=0 build/examples/$example.bc -o /dev/null
+    assert_equal "$(echo "$output" | grep "^$RESULT")" "$expected"
+  done
+}
+
+@test "library (two modules, reset)" {
+  run build/nullderef/nullderef-library-test examples/struct/example9.ll examples/others/nocapture_out.ll
+  assert_success
+  assert_output --partial "examples/struct/example9.ll: main: NULL_DEREF  %6 = load i32, i32* %5, align 4"
+  assert_output --partial "examples/struct/example9.ll: main: NULL_DEREF  %9 = load i32, i32* %8, align 4"
+  assert_output --partial "examples/others/nocapture_out.ll: main: NULL_DEREF  %6 = load i32, i32* %5, align 4"
+  assert_output --partial "Capacity stable at"
+  assert_events_count 0
+}
+
+@test "others/nullness_info" {
+  source settings
+  ./emitbc $BATS_TEST_DESCRIPTION
+  run $OPT -load build/nullderef/libNullDereferenceDetection.so -analyze -nullness-info \
+    build/examples/$BATS_TEST_DESCRIPTION.bc
+  assert_success
+  assert_line "non-NULL on entry of %6: %3 %4"
+  assert_line "non-NULL on entry of %9: %3"
+  assert_line "non-NULL: %7"
+  refute_output --partial "NULL: %4"
+}
+
+@test "server (analyze, with a client that sends nothing)" {
+  source settings
+  ./emitbc flow/example2
+  socket=$BATS_TMPDIR/nullderef-server-$$.sock
+  build/nullderef/nullderef-server -t -timeout-ms=500 $socket 3>&- &
+  server=$!
+  while [ ! -S $socket ]; do sleep 0.1; done
+
+  # Holds the server up until the timeout, not for good.
+  sleep 5 | nc -U $socket 3>&- &
+  sleep 0.2
+  run bash -c "echo 'analyze build/examples/flow/example2.bc' | nc -U $socket"
+  assert_events_count 1
+  assert_nullderef_at_instruction 10 "%8 = load i32, i32* %7, align 4"
+  assert_output --partial "DONE"
+
+  echo shutdown | nc -U $socket
+  wait $server
+}
+
+@test "crossmodule/example0" {
+  source settings
+  for part in lib main; do
+    ./emitbc crossmodule/example0_$part
+    $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef \
+      -summary-index=build/examples/crossmodule/example0_$part.sum \
+      build/examples/crossmodule/example0_$part.bc -o /dev/null
+  done
+
+  run build/nullderef/nullderef-link build/examples/crossmodule/example0_lib.sum build/examples/crossmodule/example0_main.sum
+  assert_failure
+  assert_output --partial "NULL is passed as argument 1 of wrap"
+  assert_output --partial "the result of find may be NULL"
+}
+
+@test "crossmodule/example1 (NULL on one path, a module path with a space)" {
+  source settings
+  for part in lib main; do
+    ./emitbc crossmodule/example1_$part
+    cp build/examples/crossmodule/example1_$part.bc "build/examples/crossmodule/example1 $part.bc"
+    $OPT -load build/nullderef/libNullDereferenceDetection.so -nullderef \
+      -summary-index=build/examples/crossmodule/example1_$part.sum \
+      "build/examples/crossmodule/example1 $part.bc" -o /dev/null
+  done
+
+  run build/nullderef/nullderef-link build/examples/crossmodule/example1_lib.sum build/examples/crossmodule/example1_main.sum
+  assert_failure
+  assert_output --partial "example1 main.bc:5: NULL_DEREF in main: the result of lookup may be NULL"
+  assert_output --partial "(build/examples/crossmodule/example1 lib.bc)"
+}